@@ -22,12 +22,29 @@ namespace ant {
 			EEnd
         };
 
+        enum Async_policy {
+            EAsyncDrop = 1,     // a message which doesn't fit the buffer is dropped and counted
+            EAsyncBlock = 2     // the logging thread waits for room
+        };
+
     public:
         typedef void (*log_function)(char const *text);
 
         static void set(log_function func);
         static void enable_log_level(Log_level level);
         static void enable_log_name(Log_name name, Log_level level);
+
+        // async mode: a logging thread formats into its own ring buffer of ring_bytes without locks,
+        // a background thread delivers the messages of all threads in time order
+        // turning it off delivers what has been logged so far
+        static void set_async(bool enable, Async_policy policy = EAsyncDrop, unsigned ring_bytes = 64 * 1024);
+        // messages go to the file instead of the log function, nullptr goes back to the function
+        // return 0 if success or system error code
+        static int set_file(char const *path);
+        // waits until the messages logged so far have been delivered
+        static void flush();
+        // messages dropped by full buffers in async mode
+        static unsigned long long dropped();
     };
     
 }
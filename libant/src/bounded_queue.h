@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <utility>
+
+// Multi-producer queue with a capacity and a policy for a full queue:
+// the producer waits for room, fails with EAGAIN or pushes out the oldest item.
+// push() can be called from any thread; drain() from the consumer thread only.
+// Item must be default constructible and movable.
+template<typename Item>
+class bounded_queue
+{
+public:
+  enum Policy {
+    EBlock = 1,
+    EFailFast = 2,
+    EDropOldest = 3
+  };
+
+  explicit bounded_queue(size_t capacity = 0, Policy policy = EBlock)
+    : _capacity(capacity)
+    , _policy(policy)
+    , _closed(false)
+    , _waiting(0)
+    , _rejected(0)
+    , _dropped(0)
+  {}
+
+  bounded_queue(bounded_queue const&) = delete;
+  bounded_queue& operator=(bounded_queue const&) = delete;
+
+  // capacity 0 is unbounded
+  void set_limit(size_t capacity, Policy policy)
+  {
+    lock_t lock(_mutex);
+    _capacity = capacity;
+    _policy = policy;
+    _room.notify_all();
+  }
+
+  // return 0 if the item is queued, EAGAIN if the queue is full (EFailFast, or EBlock after timeout_ms,
+  // -1 waits without limit) or ECANCELED if the queue is closed
+  // the item pushed out by EDropOldest is destroyed by the caller's thread
+  int push(Item&& item, int timeout_ms = -1)
+  {
+    Item dropped;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_capacity && _items.size() >= _capacity && !_closed) {
+        if (_policy == EDropOldest) {
+          dropped = std::move(_items.front());
+          _items.pop_front();
+          ++_dropped;
+        } else if (_policy == EFailFast || !timeout_ms) {
+          ++_rejected;
+          return EAGAIN;
+        } else {
+          ++_waiting;
+          auto has_room = [this]() { return _closed || !_capacity || _items.size() < _capacity; };
+          bool ready = true;
+          if (timeout_ms < 0)
+            _room.wait(lock, has_room);
+          else
+            ready = _room.wait_for(lock, std::chrono::milliseconds(timeout_ms), has_room);
+          --_waiting;
+          if (!ready) {
+            ++_rejected;
+            return EAGAIN;
+          }
+        }
+      }
+      if (_closed)
+        return ECANCELED;
+      _items.push_back(std::move(item));
+    }
+    return 0;
+  }
+
+  // moves all queued items to the end of batch, returns the number of moved items
+  size_t drain(std::vector<Item>& batch)
+  {
+    lock_t lock(_mutex);
+    size_t count = _items.size();
+    for (auto &item: _items)
+      batch.push_back(std::move(item));
+    _items.clear();
+    if (_waiting)
+      _room.notify_all();
+    return count;
+  }
+
+  // wakes blocked producers, later pushes fail with ECANCELED, the queued items are destroyed
+  void close()
+  {
+    std::deque<Item> items;
+    {
+      lock_t lock(_mutex);
+      _closed = true;
+      std::swap(items, _items);
+      _room.notify_all();
+    }
+  }
+
+  // takes items again after close()
+  void open()
+  {
+    lock_t lock(_mutex);
+    _closed = false;
+  }
+
+  size_t size() const
+  {
+    lock_t lock(_mutex);
+    return _items.size();
+  }
+  // pushes refused by EFailFast or a timeout
+  uint64_t rejected() const
+  {
+    lock_t lock(_mutex);
+    return _rejected;
+  }
+  // items pushed out by EDropOldest
+  uint64_t dropped() const
+  {
+    lock_t lock(_mutex);
+    return _dropped;
+  }
+
+private:
+  typedef std::lock_guard<std::mutex> lock_t;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _room;
+  std::deque<Item> _items;
+  size_t _capacity;
+  Policy _policy;
+  bool _closed;
+  unsigned _waiting;
+  uint64_t _rejected;
+  uint64_t _dropped;
+};
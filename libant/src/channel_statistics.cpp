@@ -21,6 +21,49 @@ TEST(Statistics, network_bandwith) {
 	st.tests();
 }
 
+TEST(Statistics, concurrent) {
+	// writers of all kinds of events and a reader, every thread owns a part of the time line
+	channel_statistics st;
+	const int writers = 4;
+	const stat_time_ms end = 61000;
+	std::atomic<bool> done(false);
+	std::thread reader([&]() {
+		while (!done) {
+			int sent = st.sma_sent(60000, stat_time_ms(end));
+			EXPECT_TRUE(sent == NO_STAT_DATA || (sent >= 0 && sent <= writers * 1000));
+			int buffer = st.max_buffer(60000, stat_time_ms(end));
+			EXPECT_TRUE(buffer == NO_STAT_DATA || (buffer >= 0 && buffer < writers));
+			st.publish(end);
+		}
+	});
+	std::vector<std::thread> threads;
+	for (int w = 0; w < writers; ++w) {
+		threads.emplace_back([&st, w]() {
+			for (stat_time_ms t = 1001; t <= end; ++t) {
+				st.push_sent_event(1, std::move(t));
+				st.push_sending_event(2, std::move(t));
+				st.push_buffer_event(w, std::move(t));
+			}
+		});
+	}
+	for (auto &t: threads)
+		t.join();
+	done = true;
+	reader.join();
+
+	// events racing a rotation may move to the next bucket but none is lost
+	EXPECT_EQ(st.sma_sent(60000, stat_time_ms(end)), writers * 1000);
+	EXPECT_EQ(st.sma_sending(60000, stat_time_ms(end)), writers * 2000);
+	EXPECT_EQ(st.min_buffer(60000, stat_time_ms(end)), 0);
+	EXPECT_EQ(st.max_buffer(60000, stat_time_ms(end)), writers - 1);
+
+	st.publish(end);
+	stat_snapshot snap = st.published();
+	EXPECT_EQ(snap.time, end);
+	EXPECT_EQ(snap.sent[2], writers * 1000);
+	EXPECT_EQ(snap.max_buffer[2], writers - 1);
+}
+
 void channel_statistics::tests()
 {
 
@@ -93,75 +136,281 @@ void channel_statistics::tests()
 	size_t buf = min_buffer(2000, 29200);
 	assert(buf = 5000);
 
-	// test limit
+	// test rates at 100k events per second
+	clear();
+	for(stat_time_ms t = 1001; t <= 61000; ++t)
+		for(int i = 0; i < 100; ++i)
+			push_sent_event(1000, std::move(t));
+	assert(sma_sent(1000, 61000) == 100000000);
+	assert(sma_sent(10000, 61000) == 100000000);
+	assert(sma_sent(60000, 61000) == 100000000);
+	// longer periods are cut to the window
+	assert(sma_sent(61000, 62000) == 98333333);
+	// the last second has gone quiet
+	assert(sma_sent(2000, 62000) == 50000000);
+	assert(sma_sent(1000, 62000) == NO_STAT_DATA);
+	assert(sma_sent(1000, 200000) == NO_STAT_DATA);
+
+	// test window of buffer extremes
 	clear();
-	for(int i = 0; i<lru_limit*2; ++i)
-		push_sent_event(100, 100);
-	assert(_sent.size()==lru_limit);
+	for(stat_time_ms t = 1000; t <= 60000; t += 1000)
+		push_buffer_event(t / 1000 % 7 * 1000, std::move(t));
+	assert(min_buffer(1000, 60000) == 4000);   // 60 % 7
+	assert(max_buffer(1000, 60000) == 4000);
+	assert(min_buffer(3000, 60000) == 2000);
+	assert(max_buffer(3000, 60000) == 4000);
+	assert(min_buffer(7000, 60000) == 0);
+	assert(max_buffer(7000, 60000) == 6000);
+	assert(max_buffer(10000, 70000) == NO_STAT_DATA);
 
 }
 
 #endif
 
+sliding_sum::sliding_sum(stat_time_ms window, stat_time_ms resolution)
+	: _resolution(std::max<stat_time_ms>(resolution, 1))
+	, _slots(std::max<size_t>((window + _resolution - 1) / _resolution, 1) + 1)
+	, _totals(new std::atomic<uint64_t>[_slots]())
+{
+	clear();
+}
+
+void sliding_sum::clear() {
+	_lock.write_lock();
+	_total.store(0, std::memory_order_relaxed);
+	_pending.store(0, std::memory_order_relaxed);
+	_first.store(EEmpty, std::memory_order_relaxed);
+	_last.store(EEmpty, std::memory_order_relaxed);
+	_lock.write_unlock();
+}
+
+void sliding_sum::push(uint64_t value, stat_time_ms time) {
+	long long bucket = bucket_of(time);
+	long long last = _last.load(std::memory_order_relaxed);
+	// an event racing a rotation can be counted in the next bucket
+	if (last != EEmpty && bucket <= last)
+		_pending.fetch_add(value, std::memory_order_relaxed);
+	else
+		rotate(bucket, value);
+}
+
+void sliding_sum::rotate(long long bucket, uint64_t value) {
+	_lock.write_lock();
+	long long last = _last.load(std::memory_order_relaxed);
+	long long size = _slots;
+	if (last == EEmpty) {
+		_first.store(bucket, std::memory_order_relaxed);
+		_last.store(bucket, std::memory_order_relaxed);
+	} else if (bucket > last) {
+		uint64_t total = _total.load(std::memory_order_relaxed) + _pending.exchange(0, std::memory_order_relaxed);
+		_totals[last % size].store(total, std::memory_order_relaxed);
+		// the buckets skipped by the gap keep the total, a gap longer than the window wraps once
+		for (long long b = std::max(last + 1, bucket - size + 1); b < bucket; ++b)
+			_totals[b % size].store(total, std::memory_order_relaxed);
+		_total.store(total, std::memory_order_relaxed);
+		_last.store(bucket, std::memory_order_relaxed);
+	}
+	_pending.fetch_add(value, std::memory_order_relaxed);
+	_lock.write_unlock();
+}
+
+bool sliding_sum::sum(stat_time_ms period, stat_time_ms now_ts, uint64_t& result) const {
+	long long size = _slots;
+	period = std::min(period, window());
+	// events of buckets after the cutoff are in the period
+	long long cutoff = bucket_of(now_ts - period);
+	bool found;
+	unsigned seq;
+	do {
+		seq = _lock.read_begin();
+		long long first = _first.load(std::memory_order_relaxed);
+		long long last = _last.load(std::memory_order_relaxed);
+		found = last != EEmpty && cutoff < last;
+		if (!found)
+			continue;
+		// the buckets before the newest one are in the ring
+		uint64_t before = 0;
+		if (cutoff >= first && cutoff > last - size)
+			before = _totals[cutoff % size].load(std::memory_order_relaxed);
+		else if (cutoff >= first)
+			before = _totals[(last + 1) % size].load(std::memory_order_relaxed); // the oldest total
+		result = _total.load(std::memory_order_relaxed) + _pending.load(std::memory_order_relaxed) - before;
+	} while (_lock.read_retry(seq));
+	return found;
+}
+
+sliding_extremum::sliding_extremum(EType type, stat_time_ms window, stat_time_ms resolution)
+	: _type(type)
+	, _resolution(std::max<stat_time_ms>(resolution, 1))
+	, _buckets(std::max<long long>((window + _resolution - 1) / _resolution, 1))
+	, _none(type == min ? LLONG_MAX : LLONG_MIN)
+{
+	_rings.emplace_back(new ring(16));
+	_ring.store(_rings.back().get(), std::memory_order_relaxed);
+	clear();
+}
+
+void sliding_extremum::clear() {
+	_lock.write_lock();
+	_head.store(0, std::memory_order_relaxed);
+	_size.store(0, std::memory_order_relaxed);
+	_pending.store(_none, std::memory_order_relaxed);
+	_last.store(EEmpty, std::memory_order_relaxed);
+	_lock.write_unlock();
+}
+
+void sliding_extremum::grow() {
+	ring const* old = _ring.load(std::memory_order_relaxed);
+	size_t head = _head.load(std::memory_order_relaxed);
+	size_t size = _size.load(std::memory_order_relaxed);
+	_rings.emplace_back(new ring(old->capacity * 2));
+	ring* r = _rings.back().get();
+	for (size_t i = 0; i < size; ++i) {
+		entry& e = at(old, head, i);
+		r->entries[i].bucket.store(e.bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		r->entries[i].value.store(e.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	_ring.store(r, std::memory_order_release);
+	_head.store(0, std::memory_order_relaxed);
+}
+
+void sliding_extremum::better_pending(long long value) {
+	long long pending = _pending.load(std::memory_order_relaxed);
+	while (better(value, pending) && !_pending.compare_exchange_weak(pending, value, std::memory_order_relaxed))
+		;
+}
+
+void sliding_extremum::push(long long value, stat_time_ms time) {
+	long long bucket = bucket_of(time);
+	long long last = _last.load(std::memory_order_relaxed);
+	// an event racing a rotation can be counted in the next bucket
+	if (last != EEmpty && bucket <= last)
+		better_pending(value);
+	else
+		rotate(bucket, value);
+}
+
+void sliding_extremum::rotate(long long bucket, long long value) {
+	_lock.write_lock();
+	long long last = _last.load(std::memory_order_relaxed);
+	if (last == EEmpty || bucket > last) {
+		long long pending = _pending.exchange(_none, std::memory_order_relaxed);
+		if (last != EEmpty && pending != _none)
+			append(last, pending);
+		// the front leaves the window
+		size_t size = _size.load(std::memory_order_relaxed);
+		size_t head = _head.load(std::memory_order_relaxed);
+		ring const* r = _ring.load(std::memory_order_relaxed);
+		while (size && at(r, head, 0).bucket.load(std::memory_order_relaxed) <= bucket - _buckets) {
+			head = (head + 1) & (r->capacity - 1);
+			--size;
+		}
+		_head.store(head, std::memory_order_relaxed);
+		_size.store(size, std::memory_order_relaxed);
+		_last.store(bucket, std::memory_order_relaxed);
+	}
+	better_pending(value);
+	_lock.write_unlock();
+}
+
+void sliding_extremum::append(long long bucket, long long value) {
+	size_t size = _size.load(std::memory_order_relaxed);
+	size_t head = _head.load(std::memory_order_relaxed);
+	ring const* r = _ring.load(std::memory_order_relaxed);
+	// older values which are no better never win again
+	while (size && !better(at(r, head, size - 1).value.load(std::memory_order_relaxed), value))
+		--size;
+	_size.store(size, std::memory_order_relaxed);
+	if (size == r->capacity) {
+		grow();
+		head = 0;
+		r = _ring.load(std::memory_order_relaxed);
+	}
+	entry& e = at(r, head, size);
+	e.bucket.store(bucket, std::memory_order_relaxed);
+	e.value.store(value, std::memory_order_relaxed);
+	_size.store(size + 1, std::memory_order_relaxed);
+}
+
+bool sliding_extremum::get(stat_time_ms period, stat_time_ms now_ts, long long& result) const {
+	long long cutoff = bucket_of(now_ts - std::min(period, _buckets * _resolution));
+	bool found;
+	unsigned seq;
+	do {
+		seq = _lock.read_begin();
+		found = false;
+		long long last = _last.load(std::memory_order_relaxed);
+		if (last == EEmpty || last <= cutoff)
+			continue;
+		// a ring outgrown meanwhile is still valid, the retry discards what has been read from it
+		ring const* r = _ring.load(std::memory_order_acquire);
+		size_t head = _head.load(std::memory_order_relaxed);
+		size_t size = std::min(_size.load(std::memory_order_relaxed), r->capacity);
+		// the first entry after the cutoff
+		size_t lo = 0, hi = size;
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (at(r, head, mid).bucket.load(std::memory_order_relaxed) > cutoff)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		if (lo < size) {
+			result = at(r, head, lo).value.load(std::memory_order_relaxed);
+			found = true;
+		}
+		long long pending = _pending.load(std::memory_order_relaxed);
+		if (pending != _none && (!found || better(pending, result))) {
+			result = pending;
+			found = true;
+		}
+	} while (_lock.read_retry(seq));
+	return found;
+}
+
+const stat_time_ms stat_snapshot::periods[stat_snapshot::EPeriods] = {1000, 10000, 60000};
+
+channel_statistics::channel_statistics(stat_time_ms window, stat_time_ms resolution)
+	: _sending(window, resolution)
+	, _sent(window, resolution)
+	, _min_buffer(sliding_extremum::min, window, resolution)
+	, _max_buffer(sliding_extremum::max, window, resolution)
+{
+	_published.time = 0;
+	for (int i = 0; i < stat_snapshot::EPeriods; ++i)
+		_published.sent[i] = _published.sending[i] = _published.min_buffer[i] = _published.max_buffer[i] = NO_STAT_DATA;
+}
+
 void channel_statistics::clear() {
 	_sent.clear();
 	_sending.clear();
+	_min_buffer.clear();
+	_max_buffer.clear();
 }
 
-int channel_statistics::simple_moving_average(least_recently_used<stat_event> const& a_data, stat_time_ms const& period, stat_time_ms& now_ts) const {
-
-	if(a_data.empty())
-		return NO_STAT_DATA;
+int channel_statistics::simple_moving_average(sliding_sum const& a_data, stat_time_ms const& period, stat_time_ms& now_ts) const {
 
 	stat_time_ms period_ts = now_ts - period;
 	if(period_ts <= 0)
 		return NO_STAT_DATA;
 
-	stat_time_ms sum = 0;
-	bool found_data = false;
-	for(auto it = a_data.end(), end = a_data.begin(); end!=it; )
-	{
-		--it;
-		if(it->_time > period_ts) {
-			assert(it->_time <= now_ts);
-			sum += it->_value;
-			found_data = true;
-		}
-		else
-			break;
-	}
-
-	if(!found_data)
+	uint64_t sum = 0;
+	if(!a_data.sum(period, now_ts, sum))
 		return NO_STAT_DATA;
 
-	size_t cma = sum / (period/1000.0); // per second
+	size_t cma = sum / (std::min(period, a_data.window())/1000.0); // per second
 	return cma;
 }
 
-int channel_statistics::extremum(least_recently_used<stat_event> const& a_data,  EType type, stat_time_ms const& period, stat_time_ms& now_ts) const {
+int channel_statistics::extremum(sliding_extremum const& a_data, stat_time_ms const& period, stat_time_ms& now_ts) const {
 
 	stat_time_ms period_ts = now_ts - period;
 	if(period_ts <= 0)
 		return NO_STAT_DATA;
-	int val = type==min ? INT_MAX : 0;
-	bool found_data = false;
-	for(auto it = a_data.end(), end = a_data.begin(); end!=it; )
-	{
-		--it;
-		if(it->_time > period_ts) {
-			found_data = true;
-			assert(it->_time <= now_ts);
-			if(min==type)
-				val = std::min(val, (int)(it->_value));
-			if(max==type)
-				val = std::max(val, (int)(it->_value));
-		}
-		else
-			break;
-	}
-	if(!found_data)
+	long long val = 0;
+	if(!a_data.get(period, now_ts, val))
 		return NO_STAT_DATA;
-	return val;
+	return std::min<long long>(val, INT_MAX);
 }
 
 int channel_statistics::sma_sent(stat_time_ms const& period, stat_time_ms&& now_ts) const {
@@ -173,28 +422,72 @@ int channel_statistics::sma_sending(stat_time_ms const& period, stat_time_ms&& n
 }
 
 int channel_statistics::min_buffer(stat_time_ms const& period, stat_time_ms&& now_ts) const {
-	return extremum(_out_buffer, channel_statistics::min, period, now_ts);
+	return extremum(_min_buffer, period, now_ts);
 }
 
 int channel_statistics::max_buffer(stat_time_ms const& period, stat_time_ms&& now_ts) const {
-	return extremum(_out_buffer, channel_statistics::max, period, now_ts);
+	return extremum(_max_buffer, period, now_ts);
 }
 
 void channel_statistics::push_sent_event(size_t a_sent_data, stat_time_ms &&a_time) {
-	_sent.emplace_back(stat_event(a_sent_data, a_time));
+	_sent.push(a_sent_data, a_time);
 }
 
 void channel_statistics::push_sending_event(size_t a_sending_data, stat_time_ms &&a_time) {
-	_sending.emplace_back(stat_event(a_sending_data, a_time));
+	_sending.push(a_sending_data, a_time);
 }
 
 void channel_statistics::push_buffer_event(size_t a_buffer_size, stat_time_ms &&a_time) {
-	_out_buffer.emplace_back(stat_event(a_buffer_size, a_time));
+	_min_buffer.push(a_buffer_size, a_time);
+	_max_buffer.push(a_buffer_size, a_time);
+}
+
+stat_snapshot channel_statistics::snapshot(stat_time_ms now_ts) const {
+	stat_snapshot snap;
+	snap.time = now_ts;
+	for (int i = 0; i < stat_snapshot::EPeriods; ++i) {
+		stat_time_ms period = stat_snapshot::periods[i];
+		snap.sent[i] = simple_moving_average(_sent, period, now_ts);
+		snap.sending[i] = simple_moving_average(_sending, period, now_ts);
+		snap.min_buffer[i] = extremum(_min_buffer, period, now_ts);
+		snap.max_buffer[i] = extremum(_max_buffer, period, now_ts);
+	}
+	return snap;
+}
+
+void channel_statistics::publish(stat_time_ms now_ts) {
+	stat_snapshot snap = snapshot(now_ts);
+	_publish_lock.write_lock();
+	_published.time.store(snap.time, std::memory_order_relaxed);
+	for (int i = 0; i < stat_snapshot::EPeriods; ++i) {
+		_published.sent[i].store(snap.sent[i], std::memory_order_relaxed);
+		_published.sending[i].store(snap.sending[i], std::memory_order_relaxed);
+		_published.min_buffer[i].store(snap.min_buffer[i], std::memory_order_relaxed);
+		_published.max_buffer[i].store(snap.max_buffer[i], std::memory_order_relaxed);
+	}
+	_publish_lock.write_unlock();
+}
+
+stat_snapshot channel_statistics::published() const {
+	stat_snapshot snap;
+	unsigned seq;
+	do {
+		seq = _publish_lock.read_begin();
+		snap.time = _published.time.load(std::memory_order_relaxed);
+		for (int i = 0; i < stat_snapshot::EPeriods; ++i) {
+			snap.sent[i] = _published.sent[i].load(std::memory_order_relaxed);
+			snap.sending[i] = _published.sending[i].load(std::memory_order_relaxed);
+			snap.min_buffer[i] = _published.min_buffer[i].load(std::memory_order_relaxed);
+			snap.max_buffer[i] = _published.max_buffer[i].load(std::memory_order_relaxed);
+		}
+	} while (_publish_lock.read_retry(seq));
+	return snap;
 }
 
 void channel_statistics::dump() {
-	 // to do union of all events sorted by time
-	for(auto it = _sent.begin(), end = _sent.end(); end!=it; ++it) {
-		LOG(ant::Log::EDebug, ant::Log::EAnt, "net stat dump: sent(%d, %d);\n", it->_time, it->_value);
+	stat_snapshot snap = snapshot();
+	for (int i = 0; i < stat_snapshot::EPeriods; ++i) {
+		LOG(ant::Log::EDebug, ant::Log::EAnt, "net stat dump: %lld ms: sent %d B/s, sending %d B/s, buffer %d..%d\n",
+			stat_snapshot::periods[i], snap.sent[i], snap.sending[i], snap.min_buffer[i], snap.max_buffer[i]);
 	}
 }
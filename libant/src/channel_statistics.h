@@ -2,53 +2,173 @@
 #ifndef LIBANT_CHANNEL_STATISTICS_H
 #define LIBANT_CHANNEL_STATISTICS_H
 
-#include <list>
+#include <vector>
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <thread>
 #include <memory>
 #include <cstdint>
-#include <memory>
 
-const size_t lru_limit = 100;
 #define STAT_PERIOD 1000  // ms
+#define STAT_WINDOW 60000 // ms, the longest period of the statistics
+#define STAT_RESOLUTION 10 // ms
 #define NO_STAT_DATA -1
 typedef long long stat_time_ms;
 
-template<class T>
-class least_recently_used  {
+inline long long stat_bucket(stat_time_ms time, stat_time_ms resolution)
+{
+	long long end = time + resolution - 1;
+	return end >= 0 ? end / resolution : (end - resolution + 1) / resolution;
+}
 
+// Sequence lock: writers take turns, readers don't block and repeat a read which overlapped a write.
+// The guarded data must be atomics accessed with relaxed order.
+class stat_seqlock {
 public:
-	void push_back(typename std::list<T>::value_type const& item) {
-		if(_list.size()>=lru_limit)
-			_list.pop_front();
-		_list.push_back(item);
+	stat_seqlock() : _seq(0) {}
+
+	void write_lock() {
+		unsigned seq = _seq.load(std::memory_order_relaxed);
+		for (;;) {
+			if (seq & 1) {
+				std::this_thread::yield();
+				seq = _seq.load(std::memory_order_relaxed);
+			} else if (_seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+				break;
+			}
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void write_unlock() {
+		_seq.fetch_add(1, std::memory_order_release);
 	}
 
-	void emplace_back(T&& new_obj) {
-		if(_list.size()>=lru_limit)
-			_list.pop_front();
-		_list.emplace_back(new_obj);
+	unsigned read_begin() const {
+		unsigned seq;
+		while ((seq = _seq.load(std::memory_order_acquire)) & 1)
+			std::this_thread::yield();
+		return seq;
 	}
+	// return true if the read has to be repeated
+	bool read_retry(unsigned seq) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return _seq.load(std::memory_order_relaxed) != seq;
+	}
+
+private:
+	std::atomic<unsigned> _seq;
+};
+
+// Sum of values over the last window of time.
+// A ring of time buckets keeps the running total at the end of every bucket, so the sum of any period
+// up to the window is the difference of two totals. Events older than the newest one count into its bucket.
+// Thread safe: events of the newest bucket are added atomically, the first event of a new bucket folds
+// the previous one into the ring under the seqlock, which readers check.
+class sliding_sum {
+public:
+	sliding_sum(stat_time_ms window, stat_time_ms resolution);
 
-	typename std::list<T>::const_iterator begin() const noexcept
-		{return _list.begin(); }
+	void clear();
+	void push(uint64_t value, stat_time_ms time);
+	// sum of the events in (now_ts - period, now_ts], periods longer than the window are cut to it
+	// return false if there is no event in the period
+	bool sum(stat_time_ms period, stat_time_ms now_ts, uint64_t& result) const;
+
+	stat_time_ms window() const { return _resolution * (_slots - 1); }
+
+private:
+	// bucket b holds times in ((b - 1) * resolution, b * resolution], so periods ending at a multiple
+	// of the resolution are exact
+	long long bucket_of(stat_time_ms time) const {
+		return stat_bucket(time, _resolution);
+	}
+	void rotate(long long bucket, uint64_t value);
+
+	enum { EEmpty = LLONG_MIN };
+
+	stat_time_ms _resolution;
+	size_t _slots; // a window and one
+	// the running total at the end of bucket b in slot b % _slots
+	std::unique_ptr<std::atomic<uint64_t>[]> _totals;
+	std::atomic<uint64_t> _total; // up to the newest bucket
+	std::atomic<uint64_t> _pending; // of the newest bucket
+	std::atomic<long long> _first; // buckets of the oldest and the newest event
+	std::atomic<long long> _last;
+	stat_seqlock _lock;
+};
 
-	typename std::list<T>::const_iterator end() const noexcept
-		{return _list.end(); }
+// Minimum or maximum of values over the last window of time.
+// A monotonic deque of bucket extremes: the values get worse from the front to the back while the buckets
+// get newer, so the answer for a period is the first entry inside it. The deque is a ring which grows
+// up to one entry per bucket.
+// Thread safe like sliding_sum: the extreme of the newest bucket is updated by CAS and moved to the deque
+// when the next bucket starts. Outgrown rings are kept, a reader can still be in one.
+class sliding_extremum {
+public:
+	enum EType {
+		min = 0,
+		max = 1
+	};
 
-	T const& back() const noexcept
-		{return _list.back(); }
+	sliding_extremum(EType type, stat_time_ms window, stat_time_ms resolution);
 
-	size_t size() const noexcept
-		{ return _list.size(); }
+	void clear();
+	void push(long long value, stat_time_ms time);
+	// return false if there is no event in (now_ts - period, now_ts]
+	bool get(stat_time_ms period, stat_time_ms now_ts, long long& result) const;
+
+private:
+	struct entry {
+		std::atomic<long long> bucket;
+		std::atomic<long long> value;
+	};
+	struct ring {
+		explicit ring(size_t size) : capacity(size), entries(new entry[size]()) {}
+		size_t capacity; // power of two
+		std::unique_ptr<entry[]> entries;
+	};
 
-	bool empty() const noexcept
-		{ return _list.empty(); }
+	bool better(long long a, long long b) const {
+		return _type == min ? a < b : a > b;
+	}
+	long long bucket_of(stat_time_ms time) const {
+		return stat_bucket(time, _resolution);
+	}
+	// the i-th entry from the front
+	entry& at(ring const* r, size_t head, size_t i) const {
+		return r->entries[(head + i) & (r->capacity - 1)];
+	}
+	void better_pending(long long value);
+	void rotate(long long bucket, long long value);
+	void append(long long bucket, long long value);
+	void grow();
+
+	enum { EEmpty = LLONG_MIN };
+
+	EType _type;
+	stat_time_ms _resolution;
+	long long _buckets;
+	long long _none; // the pending value of an empty bucket
+	std::vector<std::unique_ptr<ring>> _rings; // the last one is used
+	std::atomic<ring*> _ring;
+	std::atomic<size_t> _head;
+	std::atomic<size_t> _size;
+	std::atomic<long long> _pending; // the extreme of the newest bucket
+	std::atomic<long long> _last;
+	stat_seqlock _lock;
+};
 
-	 void clear() noexcept
-	 	{ _list.clear();  }
+// Rates and buffer extremes over the last 1, 10 and 60 seconds, NO_STAT_DATA where there are no events.
+struct stat_snapshot {
+	enum { EPeriods = 3 };
+	static const stat_time_ms periods[EPeriods];
 
-protected:
-	std::list<T> _list;
+	stat_time_ms time;
+	int sent[EPeriods];
+	int sending[EPeriods];
+	int min_buffer[EPeriods];
+	int max_buffer[EPeriods];
 };
 
 static stat_time_ms start_stats = std::chrono::duration_cast<std::chrono::milliseconds >(std::chrono::system_clock::now().time_since_epoch()).count();
@@ -69,9 +189,15 @@ struct stat_event {
 	size_t _value;
 };
 
+// Rates and buffer extremes of a channel over periods up to the window, the window and the bucket
+// resolution are set in milliseconds. Pushes and queries are O(1) without allocation except
+// the extremum query, which is a binary search over its deque.
+// The push and query methods can be called from any thread without locking.
 class channel_statistics {
 public:
 	typedef std::shared_ptr<channel_statistics> ptr;
+
+	explicit channel_statistics(stat_time_ms window = STAT_WINDOW, stat_time_ms resolution = STAT_RESOLUTION);
 	void clear();
 
 	void push_sent_event(size_t a_sent_data, stat_time_ms &&a_time = now());
@@ -96,20 +222,33 @@ public:
 	// return NO_STAT_DATA if there is no one stat event for this period
 	int max_buffer(stat_time_ms const& period = STAT_PERIOD, stat_time_ms&& now_ts = now()) const;
 
+	// queries all periods at now_ts
+	stat_snapshot snapshot(stat_time_ms now_ts = now()) const;
+	// stores the snapshot at now_ts for published(), called by the thread which owns the channel
+	void publish(stat_time_ms now_ts = now());
+	// the last published snapshot, time is 0 before the first one
+	stat_snapshot published() const;
+
 protected:
 
 	// return NO_STAT_DATA if there is no one stat event for this period
-	int simple_moving_average(least_recently_used<stat_event> const& a_data, stat_time_ms const& period, stat_time_ms& now_ts) const;
-	enum EType {
-		min = 0,
-		max = 1
-	};
+	int simple_moving_average(sliding_sum const& a_data, stat_time_ms const& period, stat_time_ms& now_ts) const;
 	// return NO_STAT_DATA if there is no one stat event for this period
-	int extremum(least_recently_used<stat_event> const& a_data, EType type, stat_time_ms const& period, stat_time_ms& now_ts) const;
-
-	least_recently_used<stat_event> _sending; // sent / buffered by Ant
-	least_recently_used<stat_event> _sent; // sent/buffered by UTP
-	least_recently_used<stat_event> _out_buffer;
+	int extremum(sliding_extremum const& a_data, stat_time_ms const& period, stat_time_ms& now_ts) const;
+
+	sliding_sum _sending; // sent / buffered by Ant
+	sliding_sum _sent; // sent/buffered by UTP
+	sliding_extremum _min_buffer;
+	sliding_extremum _max_buffer;
+
+	struct {
+		std::atomic<stat_time_ms> time;
+		std::atomic<int> sent[stat_snapshot::EPeriods];
+		std::atomic<int> sending[stat_snapshot::EPeriods];
+		std::atomic<int> min_buffer[stat_snapshot::EPeriods];
+		std::atomic<int> max_buffer[stat_snapshot::EPeriods];
+	} _published;
+	stat_seqlock _publish_lock;
 };
 
 
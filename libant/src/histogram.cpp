@@ -0,0 +1,134 @@
+#include "histogram.h"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Latency_histogram, buckets)
+{
+    // exact below 32, then within 1/32 and continuous
+    for (uint64_t v = 0; v < 32; ++v) {
+        EXPECT_EQ(Latency_histogram::bucket_of(v), (int) v);
+        EXPECT_EQ(Latency_histogram::bucket_max((int) v), v);
+    }
+    for (int b = 32; b < Latency_histogram::EBuckets - 1; ++b) {
+        uint64_t high = Latency_histogram::bucket_max(b);
+        uint64_t low = Latency_histogram::bucket_max(b - 1) + 1;
+        EXPECT_EQ(Latency_histogram::bucket_of(low), b);
+        EXPECT_EQ(Latency_histogram::bucket_of(high), b);
+        EXPECT_LE(high - low, low / 32);
+    }
+    EXPECT_EQ(Latency_histogram::bucket_of(UINT64_MAX), Latency_histogram::EBuckets - 1);
+}
+
+TEST(Latency_histogram, percentiles)
+{
+    Latency_histogram h;
+    EXPECT_EQ(h.percentile(99), 0u);
+    for (uint64_t v = 1; v <= 10000; ++v)
+        h.record(v);
+    EXPECT_EQ(h.count(), 10000u);
+    EXPECT_EQ(h.min(), 1u);
+    EXPECT_EQ(h.max(), 10000u);
+    EXPECT_EQ(h.mean(), 5000u);
+    for (double p: {50.0, 90.0, 99.0, 99.9}) {
+        uint64_t exact = (uint64_t) (p * 100);
+        EXPECT_GE(h.percentile(p), exact);
+        EXPECT_LE(h.percentile(p), exact + exact / 32);
+    }
+    EXPECT_EQ(h.percentile(100), 10000u);
+    EXPECT_EQ(h.percentile(0), 1u);
+
+    // a spike in the tail
+    Latency_histogram spike;
+    spike.record(5000000);
+    h.merge(spike);
+    EXPECT_EQ(h.count(), 10001u);
+    EXPECT_EQ(h.max(), 5000000u);
+    EXPECT_LE(h.percentile(99.9), 10000u + 10000 / 32);
+    EXPECT_EQ(h.percentile(100), 5000000u);
+
+    h.clear();
+    EXPECT_EQ(h.count(), 0u);
+    EXPECT_EQ(h.max(), 0u);
+}
+
+TEST(Latency_recorder, window)
+{
+    Latency_recorder r;
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; ++i)
+        r.record(100);
+    EXPECT_EQ(r.window(now).count(), 100u);
+
+    // the fast values leave the window, the total keeps them
+    for (int i = 0; i < 100; ++i)
+        r.record(5000);
+    now += std::chrono::milliseconds(Latency_recorder::EWindowMs);
+    Latency_histogram window = r.window(now);
+    EXPECT_EQ(window.count(), 100u);
+    EXPECT_GE(window.percentile(50), 5000u);
+    EXPECT_EQ(r.total().count(), 200u);
+    EXPECT_LT(r.total().percentile(50), 5000u);
+
+    // read within the window, the previous one still counts
+    r.record(7000);
+    EXPECT_EQ(r.window(now + std::chrono::milliseconds(1)).count(), 101u);
+    now += std::chrono::milliseconds(Latency_recorder::EWindowMs);
+    EXPECT_EQ(r.window(now).count(), 1u);
+    now += std::chrono::milliseconds(Latency_recorder::EWindowMs);
+    EXPECT_EQ(r.window(now).count(), 0u);
+}
+
+}
+#endif
+
+void ant::Latency_histogram::clear()
+{
+    std::fill(_buckets, _buckets + EBuckets, 0);
+    _count = 0;
+    _sum = 0;
+    _min = UINT64_MAX;
+    _max = 0;
+}
+
+void ant::Latency_histogram::merge(Latency_histogram const& other)
+{
+    if (!other._count)
+        return;
+    for (int i = 0; i < EBuckets; ++i)
+        _buckets[i] += other._buckets[i];
+    _count += other._count;
+    _sum += other._sum;
+    _min = std::min(_min, other._min);
+    _max = std::max(_max, other._max);
+}
+
+uint64_t ant::Latency_histogram::percentile(double p) const
+{
+    if (!_count)
+        return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * _count + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < EBuckets; ++i) {
+        seen += _buckets[i];
+        if (seen >= rank)
+            return std::max(std::min(bucket_max(i), _max), _min);
+    }
+    return _max;
+}
+
+ant::Latency_histogram ant::Latency_recorder::window(std::chrono::steady_clock::time_point now)
+{
+    if (now - _window_start >= std::chrono::milliseconds(EWindowMs)) {
+        _previous = _recent;
+        _recent.clear();
+        _window_start = now;
+    }
+    Latency_histogram out = _previous;
+    out.merge(_recent);
+    return out;
+}
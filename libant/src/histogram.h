@@ -0,0 +1,120 @@
+#ifndef LIBANT_HISTOGRAM_H
+#define LIBANT_HISTOGRAM_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+namespace ant {
+
+    // Log-linear latency histogram (microseconds) in the manner of HdrHistogram.
+    // Values below 2^ESubBits have a bucket each, every following power of two is split into 2^ESubBits
+    // buckets, so a value is known within 1/32 of it. Values above 2^EMaxBits us (71 min) share the last
+    // bucket, min and max are exact.
+    // Recording is constant time, histograms of the same kind merge by adding the buckets.
+    class Latency_histogram
+    {
+    public:
+        enum {
+            ESubBits = 5,
+            EMaxBits = 32,
+            EBuckets = (EMaxBits - ESubBits + 1) << ESubBits
+        };
+
+        Latency_histogram() { clear(); }
+
+        void clear();
+
+        void record(uint64_t value_us) {
+            ++_buckets[bucket_of(value_us)];
+            ++_count;
+            _sum += value_us;
+            _min = std::min(_min, value_us);
+            _max = std::max(_max, value_us);
+        }
+
+        // adds the values recorded by other
+        void merge(Latency_histogram const& other);
+
+        uint64_t count() const { return _count; }
+        uint64_t min() const { return _count ? _min : 0; }
+        uint64_t max() const { return _max; }
+        uint64_t mean() const { return _count ? _sum / _count : 0; }
+        uint64_t sum() const { return _sum; }
+
+        // the highest value equivalent to the given percentile (0..100), within min..max
+        uint64_t percentile(double p) const;
+
+        static int bucket_of(uint64_t value) {
+            if (value < (uint64_t(1) << ESubBits))
+                return (int) value;
+            if (value >> EMaxBits)
+                return EBuckets - 1;
+            int shift = msb(value) - ESubBits;
+            return ((shift + 1) << ESubBits) + (int) (value >> shift) - (1 << ESubBits);
+        }
+        // the highest value of the bucket
+        static uint64_t bucket_max(int bucket) {
+            if (bucket < (1 << ESubBits))
+                return bucket;
+            int shift = (bucket >> ESubBits) - 1;
+            uint64_t sub = (bucket & ((1 << ESubBits) - 1)) + (1 << ESubBits);
+            return ((sub + 1) << shift) - 1;
+        }
+
+    private:
+        // the index of the highest set bit, value isn't 0
+        static int msb(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+            return 63 - __builtin_clzll(value);
+#else
+            int i = 0;
+            while (value >>= 1)
+                ++i;
+            return i;
+#endif
+        }
+
+        uint64_t _buckets[EBuckets];
+        uint64_t _count;
+        uint64_t _sum;
+        uint64_t _min;
+        uint64_t _max;
+    };
+
+    // The histogram since the start, for the exporters whose counters must not go backwards,
+    // the histogram of the current interval, which a reader can start over,
+    // and a sliding window of recent values for the quantiles of the exporters.
+    class Latency_recorder
+    {
+    public:
+        enum {
+            EWindowMs = 60000
+        };
+
+        void record(uint64_t value_us) {
+            _total.record(value_us);
+            _interval.record(value_us);
+            _recent.record(value_us);
+        }
+
+        Latency_histogram const& total() const { return _total; }
+        Latency_histogram const& interval() const { return _interval; }
+        // starts a new interval, the total isn't affected
+        void reset() { _interval.clear(); }
+        // the values of the last one or two windows of EWindowMs, the window advances when it's read,
+        // so a reader calling less often than once a window gets the values since its previous call
+        Latency_histogram window(std::chrono::steady_clock::time_point now);
+
+    private:
+        Latency_histogram _total;
+        Latency_histogram _interval;
+        Latency_histogram _recent;      // since _window_start
+        Latency_histogram _previous;    // the window before
+        std::chrono::steady_clock::time_point _window_start;
+    };
+
+}
+
+#endif //LIBANT_HISTOGRAM_H
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+
+// Multi-producer queue of one FIFO per key, items are never dropped.
+// drain() keeps the order of the items of a key, the keys come in the order their FIFOs became non-empty.
+// With a capacity the producers wait for room, except push_over() of a thread which can't wait (the consumer).
+// push() and push_over() can be called from any thread; drain() from the consumer thread only.
+template<typename Key, typename Item>
+class keyed_queue
+{
+public:
+  explicit keyed_queue(size_t capacity = 0)
+    : _capacity(capacity)
+    , _size(0)
+    , _closed(false)
+    , _waits(0)
+  {}
+
+  keyed_queue(keyed_queue const&) = delete;
+  keyed_queue& operator=(keyed_queue const&) = delete;
+
+  // the total number of queued items, 0 is unbounded
+  void set_limit(size_t capacity)
+  {
+    lock_t lock(_mutex);
+    _capacity = capacity;
+    _room.notify_all();
+  }
+
+  // return 0 if the item is queued, EAGAIN if there is no room after timeout_ms (-1 waits without limit)
+  // or ECANCELED if the queue is closed, the item is left to the caller if it isn't queued
+  int push(Key const& key, Item& item, int timeout_ms = -1)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_capacity && _size >= _capacity && !_closed) {
+      ++_waits;
+      auto has_room = [this]() { return _closed || !_capacity || _size < _capacity; };
+      if (timeout_ms < 0)
+        _room.wait(lock, has_room);
+      else if (!_room.wait_for(lock, std::chrono::milliseconds(timeout_ms), has_room))
+        return EAGAIN;
+    }
+    if (_closed)
+      return ECANCELED;
+    append(key, item);
+    return 0;
+  }
+  // queued whatever the capacity
+  int push_over(Key const& key, Item& item)
+  {
+    lock_t lock(_mutex);
+    if (_closed)
+      return ECANCELED;
+    append(key, item);
+    return 0;
+  }
+
+  // moves all queued items to the end of batch, returns the number of moved items
+  size_t drain(std::vector<Item>& batch)
+  {
+    lock_t lock(_mutex);
+    size_t count = _size;
+    for (auto &key: _ready) {
+      auto itr = _fifos.find(key);
+      for (auto &item: itr->second)
+        batch.push_back(std::move(item));
+      _fifos.erase(itr);
+    }
+    _ready.clear();
+    _size = 0;
+    _room.notify_all();
+    return count;
+  }
+
+  // wakes waiting producers, later pushes fail with ECANCELED, the queued items are destroyed
+  void close()
+  {
+    std::unordered_map<Key, std::deque<Item>> fifos;
+    {
+      lock_t lock(_mutex);
+      _closed = true;
+      std::swap(fifos, _fifos);
+      _ready.clear();
+      _size = 0;
+      _room.notify_all();
+    }
+  }
+  // takes items again after close()
+  void open()
+  {
+    lock_t lock(_mutex);
+    _closed = false;
+  }
+
+  size_t size() const
+  {
+    lock_t lock(_mutex);
+    return _size;
+  }
+  // pushes which had to wait for room
+  uint64_t waits() const
+  {
+    lock_t lock(_mutex);
+    return _waits;
+  }
+
+private:
+  typedef std::lock_guard<std::mutex> lock_t;
+
+  void append(Key const& key, Item& item)
+  {
+    std::deque<Item> &fifo = _fifos[key];
+    if (fifo.empty())
+      _ready.push_back(key);
+    fifo.push_back(std::move(item));
+    ++_size;
+  }
+
+  mutable std::mutex _mutex;
+  std::condition_variable _room;
+  std::unordered_map<Key, std::deque<Item>> _fifos;
+  std::vector<Key> _ready;
+  size_t _capacity;
+  size_t _size;
+  bool _closed;
+  uint64_t _waits;
+};
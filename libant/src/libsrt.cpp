@@ -9,7 +9,12 @@
 
 enum {
     SRT_BUF_SIZE = 50000,
-    SRT_DEF_MSS  = 1360,    // SRT_LIVE_DEF_PLSIZE(1316) + UDP.hdr(28) + SRT.hdr(16)
+    SRT_DEF_MSS  = 1360,    // SRT_LIVE_DEF_PLSIZE(1316) + UDP.hdr(28) + SRT.hdr(16), lowered for a narrower route
+    SRT_IPV6_EXTRA_HDR = 20, // SRT counts MSS with IPv4 header
+    SRT_UDP_IP_HDR = 28,    // SRT sizes buffers in packets of MSS minus UDP and IPv4 headers
+    SRT_DEF_FC = 25600,     // default flow control window in packets
+    SRT_EPOLL_TIMEOUT_MS = 200,
+    SRT_ACK_POLL_MS = 10,   // epoll timeout while some messages are waiting for ACK
 };
 
 extern "C" void srt_log_handler(void* opaque, int level, const char* file, int line, const char* area, const char* msg)
@@ -32,10 +37,16 @@ ant::Srt_connection::Srt_connection()
     , _hwm(-1)
     , _lwm(-1)
     , _mss(SRT_DEF_MSS)
+    , _payload_size(0)
     , _congestion(ENoCongestion)
+    , _packets_sent(0)
+    , _bytes_queued(0)
+    , _bytes_sent(0)
     , _read_count(0)
 {
     memset(&_addr, 0, sizeof(_addr));
+    memset(&_local_addr, 0, sizeof(_local_addr));
+    memset(&_route_addr, 0, sizeof(_route_addr));
 }
 
 ant::Srt::Srt(Srt_events* events, Network::ptr a_net)
@@ -46,7 +57,10 @@ ant::Srt::Srt(Srt_events* events, Network::ptr a_net)
     , _poll_id(-1)
     , _congestion(0)
     , _ant_network(a_net)
+    , _link_listener(0)
+    , _record_interval_ms(100)
 {
+    memset(&_buffers, 0, sizeof(_buffers));
     // TODO need to change from enable_log_name
     srt_setlogflags( 0
                     | SRT_LOGF_DISABLE_TIME
@@ -67,6 +81,8 @@ ant::Srt::Srt(Srt_events* events, Network::ptr a_net)
 
 ant::Srt::~Srt()
 {
+    if (_link_listener)
+        _ant_network->remove_link_listener(_link_listener);
     stop();
     srt_cleanup();
 }
@@ -76,7 +92,23 @@ void ant::Srt::start(sockaddr_storage const& bind_addr)
 	LOG(ant::Log::EDebug, ant::Log::EAnt, "Srt::start %s\n", ant::print_sockaddr(bind_addr).c_str())
     _poll_id = srt_epoll_create();
 
-    if(!listen(bind_addr))
+    if (_ant_network && !_link_listener)
+        _link_listener = _ant_network->add_link_listener(std::bind(&Srt::on_link_change, this, std::placeholders::_1));
+
+    if (_ant_network && _ant_network->srt_demux()) {
+        // the network port is shared, remotes reach the listener through relays
+        sockaddr_storage loopback;
+        memset(&loopback, 0, sizeof(loopback));
+        loopback.ss_family = bind_addr.ss_family;
+        if (bind_addr.ss_family == AF_INET6)
+            SOCK_ADDR_IN6_ADDR(&loopback) = in6addr_loopback;
+        else
+            SOCK_ADDR_IN_ADDR(&loopback).s_addr = htonl(INADDR_LOOPBACK);
+        if (listen(loopback))
+            _ant_network->set_srt_listener(_addr);
+        else
+            LOG(ant::Log::EError, ant::Log::EAnt, "srt listen failed\n");
+    } else if(!listen(bind_addr))
 		LOG(ant::Log::EError, ant::Log::EAnt, "srt listen failed\n");
 
 	_thread = new std::thread(&Srt::thread_proc, this);
@@ -121,6 +153,64 @@ void ant::Srt::set_stat_handler(Srt_connection_id const& conn_id, channel_statis
         it->second->_stats = a_stats;
 }
 
+bool ant::Srt::latency(Srt_connection_id const& conn_id, Latency_kind kind, Latency_histogram& histogram,
+                       bool reset)
+{
+    std::lock_guard<std::mutex> lock(_peers_mt);
+
+    auto it = _peers.find(conn_id);
+    if (it == _peers.end())
+        return false;
+    Latency_recorder *source = &it->second->_delivery_latency;
+    if (kind == ESendSojourn)
+        source = &it->second->_send_sojourn;
+    else if (kind == ESrtRtt)
+        source = &it->second->_srt_rtt;
+    histogram = source->interval();
+    if (reset)
+        source->reset();
+    return true;
+}
+
+void ant::Srt::collect_metrics(Metrics_sink& sink)
+{
+    {
+        std::lock_guard<std::mutex> lock(_peers_mt);
+
+        for (auto &itr: _peers) {
+            Srt_connection::ptr peer = itr.second;
+            Metric_labels labels = {{"conn", std::to_string(itr.first)}, {"peer", print_sockaddr(peer->_addr)}};
+            sink.gauge("ant_srt_send_queue_bytes", "Bytes waiting for srt_sendmsg2()", labels, peer->_bufsize);
+            sink.gauge("ant_srt_send_queue_messages", "Messages waiting for srt_sendmsg2()", labels,
+                       peer->_send_buf.size());
+            sink.gauge("ant_srt_unacked_messages", "Messages sent but not acknowledged", labels, peer->_unacked.size());
+            sink.gauge("ant_srt_congestion", "1 while the send queue is above the high water mark", labels,
+                       peer->_congestion == Srt_connection::ECongestion);
+            sink.counter("ant_srt_packets_sent_total", "SRT packets handed to srt_sendmsg2()", labels,
+                         peer->_packets_sent);
+            sink.histogram("ant_srt_delivery_latency_seconds", "Delay from send() to the acknowledgement", labels,
+                           peer->_delivery_latency);
+            sink.histogram("ant_srt_send_sojourn_seconds", "Time in the send queue", labels,
+                           peer->_send_sojourn);
+            sink.histogram("ant_srt_rtt_seconds", "RTT estimated by SRT", labels, peer->_srt_rtt);
+            if (peer->_stats) {
+                // the snapshot of the last second the loop published
+                stat_snapshot snap = peer->_stats->published();
+                if (snap.sent[0] != NO_STAT_DATA)
+                    sink.gauge("ant_srt_sent_bytes_per_second", "Bytes sent over the last second", labels,
+                               snap.sent[0]);
+                if (snap.sending[0] != NO_STAT_DATA)
+                    sink.gauge("ant_srt_sending_bytes_per_second", "Bytes queued over the last second", labels,
+                               snap.sending[0]);
+                if (snap.max_buffer[0] != NO_STAT_DATA)
+                    sink.gauge("ant_srt_max_buffer_bytes", "The largest send queue over the last second", labels,
+                               snap.max_buffer[0]);
+            }
+        }
+    }
+    sink.thread(thread_stats());
+}
+
 void ant::Srt::set_buffer(Srt_connection_id const& conn_id, int size, int hwm, int lwm)
 {
     std::lock_guard<std::mutex> lock(_peers_mt);
@@ -172,9 +262,10 @@ bool ant::Srt::listen(sockaddr_storage const &bind_addr)
     srt_setsockflag(_sock, SRTO_PASSPHRASE, &opt, opt_len);
     opt = 0;
     srt_setsockflag(_sock, SRTO_RCVSYN, &opt, opt_len);
-    //fixme: fix for using address 127.0.0.1
+    // the handshake takes the smaller MSS of the peers, nothing confirms a larger path to an accepted peer
     opt = SRT_DEF_MSS;
     srt_setsockflag(_sock, SRTO_MSS, &opt, opt_len);
+    apply_buffers(_sock, opt);
     opt = 0;
     srt_setsockflag(_sock, SRTO_MAXBW, &opt, opt_len);
 
@@ -206,6 +297,43 @@ bool ant::Srt::listen(sockaddr_storage const &bind_addr)
     return true;
 }
 
+int ant::Srt::mss_for(sockaddr_storage const& to_addr)
+{
+    if (!_ant_network)
+        return SRT_DEF_MSS;
+
+    // the route MTU only limits the MSS, a larger MSS than the default would need a DF probe
+    // answered by the peer, SRT's own socket gets the ICMP reports
+    int mss = SRT_DEF_MSS;
+    int mtu = _ant_network->path_mtu(to_addr);
+    if (mtu > 0)
+        mss = std::min<int>(mss, mtu - (to_addr.ss_family == AF_INET6 ? SRT_IPV6_EXTRA_HDR : 0));
+    mss = std::max<int>(mss, Path_mtu::EMinMtu);
+    LOG(ant::Log::EDebug, ant::Log::EAnt, "srt mss for %s is %d bytes\n", print_sockaddr(to_addr).c_str(), mss)
+    return mss;
+}
+
+void ant::Srt::apply_buffers(SRTSOCKET sock, int mss)
+{
+    int opt_len = sizeof(int);
+    int udp_rcvbuf = _buffers.udp_rcvbuf ? _buffers.udp_rcvbuf : _buffers.rcvbuf;
+    int udp_sndbuf = _buffers.udp_sndbuf ? _buffers.udp_sndbuf : _buffers.sndbuf;
+    if (udp_rcvbuf > 0)
+        srt_setsockflag(sock, SRTO_UDP_RCVBUF, &udp_rcvbuf, opt_len);
+    if (udp_sndbuf > 0)
+        srt_setsockflag(sock, SRTO_UDP_SNDBUF, &udp_sndbuf, opt_len);
+
+    if (_buffers.rcvbuf > 0) {
+        // SRT cuts the receiver buffer down to the flow control window
+        int packets = _buffers.rcvbuf / std::max(mss - SRT_UDP_IP_HDR, 1) + 1;
+        int fc = std::max<int>(packets, SRT_DEF_FC);
+        srt_setsockflag(sock, SRTO_FC, &fc, opt_len);
+        srt_setsockflag(sock, SRTO_RCVBUF, &_buffers.rcvbuf, opt_len);
+    }
+    if (_buffers.sndbuf > 0)
+        srt_setsockflag(sock, SRTO_SNDBUF, &_buffers.sndbuf, opt_len);
+}
+
 bool ant::Srt::connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_id, Srt_connecting_cb const& connecting_cb)
 {
     std::lock_guard<std::mutex> lock(_peers_mt);
@@ -218,6 +346,17 @@ bool ant::Srt::connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_
         return true;
     }
 
+    // SRT connects to the relay of the remote if the network port is shared
+    sockaddr_storage srt_addr = to_addr;
+    if (_ant_network && _ant_network->srt_demux()) {
+        int error = _ant_network->srt_relay(to_addr, srt_addr);
+        if (error) {
+            LOG(ant::Log::EError, ant::Log::EAnt, "srt relay for %s failed: %s(%d)\n",
+                print_sockaddr(to_addr).c_str(), strerror(error), error)
+            return false;
+        }
+    }
+
     SRTSOCKET sock = srt_socket(to_addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
     if (sock == -1) {
         LOG(ant::Log::EDebug, ant::Log::EAnt, "srt_socket() error: %s\n", srt_getlasterror_str())
@@ -235,9 +374,9 @@ bool ant::Srt::connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_
     srt_setsockflag(sock, SRTO_RCVSYN, &opt, opt_len);
     opt = 0;
     srt_setsockflag(sock, SRTO_LINGER, &opt, opt_len);
-    //fixme: fix for using address 127.0.0.1
-    opt = SRT_DEF_MSS;
+    opt = mss_for(to_addr);
     srt_setsockflag(sock, SRTO_MSS, &opt, opt_len);
+    apply_buffers(sock, opt);
     opt = 0;
     srt_setsockflag(sock, SRTO_MAXBW, &opt, opt_len);
 
@@ -254,6 +393,7 @@ bool ant::Srt::connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_
     peer->_sock = sock;
     peer->_status = SRTS_CONNECTING;
     peer->_addr = to_addr;
+    Network::local_interface(to_addr, peer->_route_addr);
 
     _peers[peer->_sock] = peer;
 
@@ -272,7 +412,7 @@ bool ant::Srt::connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_
         RUNTIME_ERROR("unsupported family %d\n", to_addr.ss_family);
     }
 
-    rc = srt_connect(sock, (struct sockaddr *) &to_addr, soc_size);
+    rc = srt_connect(sock, (struct sockaddr *) &srt_addr, soc_size);
     if (rc == SRT_ERROR) {
         LOG(ant::Log::EDebug, ant::Log::EAnt, "srt_connect() error: %s\n", srt_getlasterror_str())
         return false;
@@ -281,7 +421,7 @@ bool ant::Srt::connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_
     return true;
 }
 
-int ant::Srt::send(Srt_connection_id const& conn_id, std::vector<uint8_t>&& data)
+int ant::Srt::send(Srt_connection_id const& conn_id, std::vector<uint8_t>&& data, Srt_delivered_cb const& delivered_cb)
 {
     std::lock_guard<std::mutex> lock(_peers_mt);
 
@@ -293,14 +433,16 @@ int ant::Srt::send(Srt_connection_id const& conn_id, std::vector<uint8_t>&& data
     if (peer->_stats)
         peer->_stats->push_sending_event(data.size());
 
-    peer->_send_buf.emplace_back(data);
-    peer->_bufsize += data.size();
+    size_t data_size = data.size();
+    peer->_bytes_queued += data_size;
+    peer->_send_buf.push_back({std::move(data), std::chrono::steady_clock::now(), delivered_cb});
+    peer->_bufsize += data_size;
 
     if (!peer->_congestion) {
         internal_send(peer);
     } else {
         LOG(ant::Log::EWarning, ant::Log::EAnt, "peer (%s): HWM(+%d=%d)\n",
-            ant::print_sockaddr(peer->_addr).c_str(), data.size(), peer->_bufsize+data.size())
+            ant::print_sockaddr(peer->_addr).c_str(), data_size, peer->_bufsize)
     }
 
     if (peer->_bufsize) {
@@ -332,19 +474,28 @@ void ant::Srt::internal_send(Srt_connection::ptr peer)
     int sent_bytes = 0;
     int error = 0;
     while (peer->_bufsize) {
-        std::vector<uint8_t> &sbuf = peer->_send_buf.front();
+        Srt_connection::Outgoing_message &msg = peer->_send_buf.front();
+        std::vector<uint8_t> &sbuf = msg._data;
         size_t len = sbuf.size();
 
-        int rc = srt_sendmsg(peer->_sock, (const char *) sbuf.data(), len, -1, 1);
+        SRT_MSGCTRL mctrl = srt_msgctrl_default;
+        mctrl.msgttl = -1;
+        mctrl.inorder = 1;
+        int rc = srt_sendmsg2(peer->_sock, (const char *) sbuf.data(), len, &mctrl);
         if (rc > 0) {
-            LOG(ant::Log::EDebug, ant::Log::EAnt, "srt_sendmsg(%d, %d) = %d bytes\n", peer->_sock, len, rc)
+            LOG(ant::Log::EDebug, ant::Log::EAnt, "srt_sendmsg(%d, %d) = %d bytes, msgno %d\n", peer->_sock, len, rc, mctrl.msgno)
             peer->_bufsize -= rc;
             sent_bytes += rc;
+            peer->_packets_sent += peer->packets_for(rc);
+            peer->_bytes_sent += rc;
 
             if (peer->_stats)
                 peer->_stats->push_sent_event(rc);
 
             if (rc == len) {
+                peer->_send_sojourn.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - msg._enqueued).count());
+                peer->_unacked.push_back({mctrl.msgno, peer->_packets_sent, msg._enqueued, std::move(msg._delivered_cb)});
                 peer->_send_buf.pop_front();
             } else {
                 sbuf.erase(sbuf.begin(), sbuf.begin() + rc);  //todo: move ptr instead of call erase()
@@ -369,6 +520,86 @@ void ant::Srt::internal_send(Srt_connection::ptr peer)
     }
 }
 
+bool ant::Srt::check_delivery(std::vector<std::pair<SRTSOCKET, Task>>& notifications)
+{
+    bool waiting = false;
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto &itr: _peers) {
+        Srt_connection::ptr peer = itr.second;
+        if (peer->_unacked.empty())
+            continue;
+
+        // SRTO_SNDDATA is the number of packets still kept in the sender buffer, i.e. not acknowledged yet
+        int unacked_packets = 0;
+        int opt_len = sizeof unacked_packets;
+        if (srt_getsockflag(peer->_sock, SRTO_SNDDATA, &unacked_packets, &opt_len) == SRT_ERROR) {
+            waiting = true;
+            continue;
+        }
+        uint64_t acked_packets = peer->_packets_sent - std::min<uint64_t>(unacked_packets, peer->_packets_sent);
+        bool acked = !peer->_unacked.empty() && peer->_unacked.front()._last_packet <= acked_packets;
+
+        while (!peer->_unacked.empty() && peer->_unacked.front()._last_packet <= acked_packets) {
+            Srt_connection::Unacked_message &msg = peer->_unacked.front();
+            uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(now - msg._enqueued).count();
+            peer->_delivery_latency.record(latency_us);
+
+            LOG(ant::Log::EDebug, ant::Log::EAnt, "connection(%d): msgno %d acknowledged for %llu us\n",
+                peer->_sock, msg._msg_no, (unsigned long long) latency_us)
+
+            if (msg._delivered_cb)
+                notifications.emplace_back(peer->_sock,
+                    std::bind(msg._delivered_cb, (Srt_connection_id) peer->_sock, msg._msg_no, latency_us));
+            peer->_unacked.pop_front();
+        }
+
+        if (acked) {
+            SRT_TRACEBSTATS perf;
+            if (srt_bstats(peer->_sock, &perf, 0) != SRT_ERROR && perf.msRTT > 0)
+                peer->_srt_rtt.record((uint64_t) (perf.msRTT * 1000));
+        }
+
+        if (!peer->_unacked.empty())
+            waiting = true;
+    }
+    return waiting;
+}
+
+void ant::Srt::on_link_change(Link_change const& change)
+{
+    if (change.kind != Link_change::ELinkDown && change.kind != Link_change::EAddressRemoved)
+        return;
+
+    // the loop thread only marks the connections, the SRT thread breaks them
+    std::lock_guard<std::mutex> lock(_peers_mt);
+    for (auto &itr: _peers) {
+        Srt_connection::ptr const& peer = itr.second;
+        for (auto &addr: change.addrs) {
+            if (Link_monitor::same_ip(addr, peer->_route_addr) || Link_monitor::same_ip(addr, peer->_local_addr)) {
+                LOG(ant::Log::EWarning, ant::Log::EAnt, "connection(%d): local interface %d is down\n",
+                    itr.first, change.ifindex)
+                _links_down.push_back(itr.first);
+                break;
+            }
+        }
+    }
+}
+
+void ant::Srt::break_links_down()
+{
+    std::vector<SRTSOCKET> affected;
+    affected.swap(_links_down);
+    // SRT would notice the loss after the peer idle timeout only
+    for (SRTSOCKET s: affected) {
+        if (_peers.find(s) == _peers.end())
+            continue;
+        srt_clearlasterror();
+        connection_broken(s);
+        srt_close(s);
+    }
+}
+
 void ant::Srt::close(Srt_connection_id const& conn_id)
 {
 	LOG(ant::Log::EDebug, ant::Log::EAnt, "Srt::close %d\n", conn_id);
@@ -387,6 +618,9 @@ void ant::Srt::close(Srt_connection_id const& conn_id)
 void ant::Srt::thread_proc()
 {
     LOGS(Log::EInfo, Log::EAnt, "SRT thread is running\n")
+    _meter.start("ant-srt");
+    apply_latency_mode(_latency, "SRT");
+    Spin_budget spin(_latency.spin_us);
 
     int peers_count = _peers.size();
 
@@ -395,10 +629,13 @@ void ant::Srt::thread_proc()
     int rc = srt_epoll_add_usock(_poll_id, _sock, &events);
     if (rc == SRT_ERROR) {
         LOG(ant::Log::EError, ant::Log::EAnt, "srt_epoll_add_usock() error: %s\n", srt_getlasterror_str())
+        _meter.stop();
         return;
     }
 
     auto start_time = std::chrono::steady_clock::now();
+    bool waiting_ack = false;
+    std::vector<std::pair<SRTSOCKET, Task>> delivered;
 
     while (!_break_loop) {
         int rnum = 1+peers_count;
@@ -406,8 +643,14 @@ void ant::Srt::thread_proc()
         SRTSOCKET rfds[rnum], wfds[wnum];
 
         Chronometer<std::chrono::milliseconds> ch;
-        int rc = srt_epoll_wait(_poll_id, rfds, &rnum, wfds, &wnum, 200LL, nullptr, 0, nullptr, 0);
+        int64_t timeout = spin.timeout(waiting_ack ? SRT_ACK_POLL_MS : SRT_EPOLL_TIMEOUT_MS);
+        if (_recorder)
+            timeout = std::min<int64_t>(timeout, _record_interval_ms);
+        _meter.begin_wait();
+        int rc = srt_epoll_wait(_poll_id, rfds, &rnum, wfds, &wnum, timeout, nullptr, 0, nullptr, 0);
+        _meter.end_wait();
         ch.stop();
+        spin.on_poll(rc > 0);
         // LOG(ant::Log::EDebug, ant::Log::EAnt, "epoll slept for %u ms, rnum: %d, wnum: %d\n", ch.count(), rnum, wnum)
         _epoll_time_ms += ch.count();
         _epoll_events += rnum;
@@ -519,6 +762,24 @@ void ant::Srt::thread_proc()
             }
 #endif
         }
+
+        {
+            std::lock_guard<std::mutex> lock(_peers_mt);
+            if (!_links_down.empty()) {
+                break_links_down();
+                peers_count = _peers.size();
+            }
+            waiting_ack = check_delivery(delivered);
+            if (_recorder && std::chrono::steady_clock::now() >= _next_record) {
+                record_stats();
+                _next_record = std::chrono::steady_clock::now() + std::chrono::milliseconds(_record_interval_ms);
+            }
+        }
+        // notify() can wait for room in the Network queue, so it's called without _peers_mt
+        for (auto &f: delivered)
+            notify(f.first, std::move(f.second));
+        delivered.clear();
+
         //fixme: for debug purposes only
         auto stop_time = std::chrono::steady_clock::now();
         auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(stop_time - start_time);
@@ -527,17 +788,53 @@ void ant::Srt::thread_proc()
                 LOG(Log::EInfo, Log::EAnt, "connection(%d): TS: %d, epoll_time: %u ms, events: %u; read count: %u\n",
                     itr.first, delta.count(), _epoll_time_ms, _epoll_events, itr.second->_read_count)
                 itr.second->_read_count = 0;
+                if (itr.second->_stats)
+                    itr.second->_stats->publish();
             }
             _epoll_time_ms = 0;
             _epoll_events = 0;
+            Thread_stats loop = _meter.stats();
+            LOG(Log::EDebug, Log::EAnt, "loop: %llu iterations, cpu %.1f%%, busy %.1f%%\n",
+                (unsigned long long) loop.iterations, 100 * loop.cpu_utilization(), 100 * loop.busy_ratio())
 
             start_time = stop_time;
         }
     }
 
+    _meter.stop();
     LOGS(Log::EInfo, Log::ESrt, "thread stopped\n")
 }
 
+void ant::Srt::notify(SRTSOCKET s, Task f)
+{
+    // the receiving stops until the loop takes the event, stop() breaks the wait
+    while (_ant_network->post_event(s, f, 100) == EAGAIN && !_break_loop)
+        ;
+}
+
+void ant::Srt::record_stats()
+{
+    uint64_t now_us = Stat_recorder::now_us();
+    for (auto &itr: _peers) {
+        Srt_connection::ptr peer = itr.second;
+        Stat_record record;
+        memset(&record, 0, sizeof(record));
+        record.time_us = now_us;
+        record.conn_id = itr.first;
+        record.buffer_bytes = peer->_bufsize;
+        record.sent_bytes = peer->_bytes_sent;
+        record.sending_bytes = peer->_bytes_queued;
+        SRT_TRACEBSTATS perf;
+        if (srt_bstats(peer->_sock, &perf, 0) != SRT_ERROR) {
+            record.rtt_us = perf.msRTT > 0 ? (uint32_t) (perf.msRTT * 1000) : 0;
+            record.loss_pkts = perf.pktSndLossTotal;
+            record.retrans_pkts = perf.pktRetransTotal;
+            record.bandwidth_kbps = perf.mbpsBandwidth > 0 ? (uint32_t) (perf.mbpsBandwidth * 1000) : 0;
+        }
+        _recorder->record(record);
+    }
+}
+
 void ant::Srt::connection_established()
 {
     int len = 0;
@@ -550,19 +847,26 @@ void ant::Srt::connection_established()
     peer->_status = SRTS_CONNECTED;
     peer->_sock = srt_accept(_sock, (struct sockaddr *) &peer->_addr, &len);
     assert(peer->_sock != SRT_ERROR);
+    // the peer of a shared network port is its relay
+    sockaddr_storage remote;
+    if (_ant_network && _ant_network->srt_demux() && _ant_network->srt_remote(peer->_addr, remote))
+        peer->_addr = remote;
 
     LOG(ant::Log::EDebug, ant::Log::EAnt, "peer (%s): new incoming connection\n",
         ant::print_sockaddr(peer->_addr).c_str())
+    Network::local_interface(peer->_addr, peer->_route_addr);
 
     int opt = 0;
     int opt_len = sizeof opt;
     srt_getsockflag(peer->_sock, SRTO_UDP_SNDBUF, &opt, &opt_len);
     LOG(ant::Log::EInfo, ant::Log::EAnt, "SRTO_UDP_SNDBUF is %d bytes\n", opt)
-    srt_getsockflag(peer->_sock, SRTO_UDP_SNDBUF, &opt, &opt_len);
+    srt_getsockflag(peer->_sock, SRTO_UDP_RCVBUF, &opt, &opt_len);
     LOG(ant::Log::EInfo, ant::Log::EAnt, "SRTO_UDP_RCVBUF is %d bytes\n", opt)
     srt_getsockflag(peer->_sock, SRTO_MSS, &opt, &opt_len);
     LOG(ant::Log::EInfo, ant::Log::EAnt, "SRTO_MSS is %d bytes\n", opt)
     peer->_mss = opt;
+    srt_getsockflag(peer->_sock, SRTO_PAYLOADSIZE, &opt, &opt_len);
+    peer->_payload_size = opt;
 
     opt = 0;
     srt_setsockflag(peer->_sock, SRTO_SNDSYN, &opt, opt_len);
@@ -588,7 +892,7 @@ void ant::Srt::connection_established()
 
     if (_events) {
         _peers_mt.unlock();
-        _ant_network->do_asynch(std::bind(&Srt_events::srt_on_accept, _events, peer->_sock, peer->_addr));
+        notify(peer->_sock, std::bind(&Srt_events::srt_on_accept, _events, peer->_sock, peer->_addr));
         _peers_mt.lock();
     }
 }
@@ -629,11 +933,13 @@ void ant::Srt::connection_received(SRTSOCKET s)
                 int opt_len = sizeof opt;
                 srt_getsockflag(peer->_sock, SRTO_UDP_SNDBUF, &opt, &opt_len);
                 LOG(ant::Log::EInfo, ant::Log::EAnt, "SRTO_UDP_SNDBUF is %d bytes\n", opt)
-                srt_getsockflag(peer->_sock, SRTO_UDP_SNDBUF, &opt, &opt_len);
+                srt_getsockflag(peer->_sock, SRTO_UDP_RCVBUF, &opt, &opt_len);
                 LOG(ant::Log::EInfo, ant::Log::EAnt, "SRTO_UDP_RCVBUF is %d bytes\n", opt)
                 srt_getsockflag(peer->_sock, SRTO_MSS, &opt, &opt_len);
                 LOG(ant::Log::EInfo, ant::Log::EAnt, "SRTO_MSS is %d bytes\n", opt)
                 peer->_mss = opt;
+                srt_getsockflag(peer->_sock, SRTO_PAYLOADSIZE, &opt, &opt_len);
+                peer->_payload_size = opt;
 
                 opt = 0;
                 opt_len = sizeof opt;
@@ -642,12 +948,11 @@ void ant::Srt::connection_received(SRTSOCKET s)
                 srt_setsockflag(peer->_sock, SRTO_OHEADBW, &opt, opt_len);
 
                 if (_events)
-                    _ant_network->do_asynch(
-                            std::bind(&Srt_events::srt_on_connect, _events, s, peer->_addr));
+                    notify(s, std::bind(&Srt_events::srt_on_connect, _events, s, peer->_addr));
             }
 
             if (_events)
-                _ant_network->do_asynch(std::bind(&Srt_events::srt_on_recv, _events, s, rbuf));
+                notify(s, std::bind(&Srt_events::srt_on_recv, _events, s, std::move(rbuf)));
 
             _peers_mt.lock();
 
@@ -700,7 +1005,7 @@ void ant::Srt::connection_ready_to_send(SRTSOCKET s)
 
         if (_events) {
             _peers_mt.unlock();
-            _ant_network->do_asynch(std::bind(&Srt_events::srt_on_lwm, _events, peer->_sock));
+            notify(peer->_sock, std::bind(&Srt_events::srt_on_lwm, _events, peer->_sock));
             _peers_mt.lock();
         }
     }
@@ -721,8 +1026,8 @@ void ant::Srt::connection_broken(SRTSOCKET s)
     if (peer->_status == SRTS_CONNECTING) {
         if (_events) {
             _peers_mt.unlock();
-            _ant_network->do_asynch(std::bind(&Srt_events::srt_on_connect_error, _events,
-                                              peer->_sock, peer->_addr, srt_getlasterror_str()));
+            notify(peer->_sock, std::bind(&Srt_events::srt_on_connect_error, _events,
+                            peer->_sock, peer->_addr, srt_getlasterror_str()));
             _peers_mt.lock();
         }
     } else {
@@ -738,13 +1043,14 @@ void ant::Srt::connection_broken(SRTSOCKET s)
 
         peer->_send_buf.clear();
         peer->_bufsize = 0;
+        peer->_unacked.clear();
 
         if (peer->_stats)
             peer->_stats->push_buffer_event(peer->_bufsize);
 
         if (_events) {
             _peers_mt.unlock();
-            _ant_network->do_asynch(std::bind(&Srt_events::srt_on_break, _events, s));
+            notify(s, std::bind(&Srt_events::srt_on_break, _events, s));
             _peers_mt.lock();
         }
     }
@@ -11,13 +11,19 @@
 #include <map>
 #include <vector>
 #include <thread>
+#include <deque>
+#include <functional>
 #include <sys/socket.h>
 #include <srt.h>
 #include "network.h"
 #include "channel_statistics.h"
+#include "histogram.h"
+#include "thread_util.h"
+#include "stat_recorder.h"
 
 #define SRT_DEFAULT_PORT 3010
 #define SRT_EMPTY_CONN_ID -1
+#define SRT_HEADERS_SIZE 44     // UDP.hdr(28) + SRT.hdr(16)
 
 //#define USE_SRT_RECEIVE_LIMITER
 //#define RECEIVE_LIMIT_BYTES_PER_SECOND 200000
@@ -53,23 +59,35 @@ namespace ant
     };
 #endif
 
+    using Srt_connection_id = int;
+    // called on the network thread once the peer has acknowledged every packet of the message
+    using Srt_delivered_cb = std::function<void(Srt_connection_id, int32_t msg_no, uint64_t latency_us)>;
+
     struct Srt_connection {
         typedef std::shared_ptr<Srt_connection> ptr;
 
         Srt_connection();
 
         sockaddr_storage _local_addr;
+        // source address of the route to the peer, it finds the peers of a lost interface
+        sockaddr_storage _route_addr;
         sockaddr_storage _addr;
         SRTSOCKET _sock;
         SRT_SOCKSTATUS _status;
 
-        typedef std::deque<std::vector<uint8_t>> outgoing_buffer;
+        struct Outgoing_message {
+            std::vector<uint8_t> _data;
+            std::chrono::steady_clock::time_point _enqueued;
+            Srt_delivered_cb _delivered_cb;
+        };
+        typedef std::deque<Outgoing_message> outgoing_buffer;
         outgoing_buffer _send_buf;
         unsigned _bufsize;
         int _max_size;
         int _hwm;
         int _lwm;
         int _mss;
+        int _payload_size;  // SRTO_PAYLOADSIZE, 0 fills the packets up to the MSS (file mode)
 
         enum Congestion_state {
             ENoCongestion = 0,
@@ -79,21 +97,51 @@ namespace ant
 
         channel_statistics::ptr _stats;
 
+        // messages handed to srt_sendmsg2() but not acknowledged by the peer yet
+        struct Unacked_message {
+            int32_t _msg_no;
+            uint64_t _last_packet;  // sequential number of the message's last packet
+            std::chrono::steady_clock::time_point _enqueued;
+            Srt_delivered_cb _delivered_cb;
+        };
+        std::deque<Unacked_message> _unacked;
+        uint64_t _packets_sent;     // packets handed to srt_sendmsg2() since connection start
+        uint64_t _bytes_queued;     // by send() since connection start
+        uint64_t _bytes_sent;       // handed to srt_sendmsg2() since connection start
+        Latency_recorder _delivery_latency; // enqueue-to-ack
+        Latency_recorder _send_sojourn;     // enqueue-to-srt_sendmsg2()
+        Latency_recorder _srt_rtt;          // RTT estimated by SRT, sampled when messages are acknowledged
+
         size_t outgoing_buffer_size() const {
             size_t outgoing_buffer_size = 0;
             for (auto const& item: _send_buf) {
-                outgoing_buffer_size += item.size();
+                outgoing_buffer_size += item._data.size();
             }
             return outgoing_buffer_size;
         }
 
+        // the number of SRT packets carrying a message of the given size
+        uint64_t packets_for(size_t len) const {
+            size_t payload = _mss > SRT_HEADERS_SIZE ? _mss - SRT_HEADERS_SIZE : 1;
+            if (_payload_size > 0)
+                payload = std::min<size_t>(payload, _payload_size);
+            return len ? (len + payload - 1) / payload : 1;
+        }
+
         //fixme: for debug purposes only
         unsigned _read_count;
     };
 
-    using Srt_connection_id = int;
     using Srt_connecting_cb = std::function<void(Srt_connection_id, sockaddr_storage)>;
 
+    // SRT socket buffers in bytes, 0 keeps the SRT default
+    struct Srt_buffers {
+        int udp_rcvbuf;     // SRTO_UDP_RCVBUF, follows rcvbuf if 0
+        int udp_sndbuf;     // SRTO_UDP_SNDBUF, follows sndbuf if 0
+        int rcvbuf;         // SRTO_RCVBUF
+        int sndbuf;         // SRTO_SNDBUF
+    };
+
     class Srt_events
     {
     public:
@@ -123,8 +171,17 @@ namespace ant
         std::map<SRTSOCKET, Srt_connection::ptr> _peers;
         using Connection_map_value = std::map<SRTSOCKET, Srt_connection::ptr>::value_type;
         std::mutex _peers_mt;
+        // connections marked by on_link_change(), _peers_mt
+        std::vector<SRTSOCKET> _links_down;
 
         Network::ptr _ant_network;
+        uint64_t _link_listener;
+        Srt_buffers _buffers;
+        Latency_mode _latency;
+        std::shared_ptr<Stat_recorder> _recorder;
+        int _record_interval_ms;
+        std::chrono::steady_clock::time_point _next_record;
+        Loop_meter _meter;
 
 #if defined(USE_SRT_RECEIVE_LIMITER)
         std::unique_ptr<Traffic_limiter> _receive_limiter;
@@ -147,22 +204,76 @@ namespace ant
         Srt(Srt_events *events, Network::ptr a_net);
         ~Srt();
 
+        // if the network shares its port (Network::set_srt_demux()), the listener binds the loopback
+        // interface on any port instead and remotes are reached through the network relays
         void start(sockaddr_storage const& bind_addr);
         void stop();
         // set buffer parameters, size == -1 means no restriction
         void set_buffer(Srt_connection_id const& conn_id, int size, int hwm, int lwm);
+        // SRT applies buffers before binding, so they affect the listener if called before start()
+        // and connections made after the call
+        void set_buffers(Srt_buffers const& buffers) {
+            _buffers = buffers;
+        }
+        // samples every connection into the recorder each interval, see Stat_record; call before start()
+        void set_recorder(std::shared_ptr<Stat_recorder> const& recorder, int interval_ms = 100) {
+            _recorder = recorder;
+            _record_interval_ms = std::max(interval_ms, 1);
+        }
+        // pinning, real-time class and spinning of the SRT loop thread, call before start()
+        // busy_poll_us isn't used: the UDP socket belongs to the SRT library
+        void set_latency_mode(Latency_mode const& mode) {
+            _latency = mode;
+        }
         bool connect(sockaddr_storage const& to_addr, Srt_connection_id &conn_id, Srt_connecting_cb const& connecting_cb);
-        int send(Srt_connection_id const& conn_id, std::vector<uint8_t>&& data);
+        int send(Srt_connection_id const& conn_id, std::vector<uint8_t>&& data,
+                 Srt_delivered_cb const& delivered_cb = nullptr);
         void close(Srt_connection_id const& conn_id);
         sockaddr_storage getbindaddr() const { return _addr; }
         void set_stat_handler(Srt_connection_id const& conn_id, channel_statistics::ptr const& a_stats);
+        enum Latency_kind {
+            EDeliveryLatency = 1,   // enqueue-to-ack
+            ESendSojourn = 2,       // time in the send queue of the connection
+            ESrtRtt = 3             // RTT estimated by SRT
+        };
+        // copy of a latency histogram of the connection since the last reset, reset starts a new interval
+        // (collect_metrics() reports the totals and the quantiles of the recent values), false if connection is unknown
+        bool latency(Srt_connection_id const& conn_id, Latency_kind kind, Latency_histogram& histogram,
+                     bool reset = false);
+        // copy of the enqueue-to-ack latency histogram, false if connection is unknown
+        bool delivery_latency(Srt_connection_id const& conn_id, Latency_histogram& histogram) {
+            return latency(conn_id, EDeliveryLatency, histogram);
+        }
+        // CPU time, iterations and busy/idle split of the loop thread "ant-srt" since start()
+        // SRT's own sender and receiver threads aren't included
+        Thread_stats thread_stats() const {
+            return _meter.stats();
+        }
+        // adds the statistics of the connections and the loop thread to a collection,
+        // see Metrics_registry::add()
+        void collect_metrics(Metrics_sink& sink);
 
     private:
         void srt_connecting_from_addr(Srt_connecting_cb const& ext_connect_cb,
                                       const SRTSOCKET s, struct sockaddr const *addr, const socklen_t addr_len);
         bool listen(sockaddr_storage const &bind_addr);
+        // SRTO_MSS for the path MTU to the peer
+        int mss_for(sockaddr_storage const& to_addr);
+        void apply_buffers(SRTSOCKET sock, int mss);
         void thread_proc();
         void internal_send(Srt_connection::ptr peer);
+        // returns true if some messages are still waiting for ACK, _peers_mt is locked
+        // the delivery callbacks are appended to notifications, the caller notifies them after unlocking
+        bool check_delivery(std::vector<std::pair<SRTSOCKET, Task>>& notifications);
+        // a Stat_record of every connection, _peers_mt is locked
+        void record_stats();
+        // hands an event of the connection to the Network loop in order,
+        // waits for room if the application limited its queue
+        void notify(SRTSOCKET s, Task f);
+        // marks connections going through an interface which is down, runs on the Network loop thread
+        void on_link_change(Link_change const& change);
+        // breaks the marked connections on the SRT thread, _peers_mt is locked
+        void break_links_down();
 
         void connection_established();
         void connection_received(SRTSOCKET s);
@@ -0,0 +1,265 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include "link_monitor.h"
+#include "logger.h"
+#include "utils.hpp"
+#ifdef __linux__
+#    include <linux/netlink.h>
+#    include <linux/rtnetlink.h>
+#endif
+#if ! defined __ANDROID__ && ! defined _WINDOWS
+#    include <ifaddrs.h>
+#endif
+#ifdef ANT_UNIT_TESTS
+# include <arpa/inet.h>
+# include <gtest/gtest.h>
+#endif
+
+#if defined(ANT_UNIT_TESTS) && defined(__linux__)
+namespace ant {
+
+static void append_message(std::vector<uint8_t>& buf, uint16_t type, const void* body, size_t body_len,
+    uint16_t attr_type, const void* attr, size_t attr_len)
+{
+    size_t offset = buf.size();
+    size_t len = NLMSG_LENGTH(body_len) + (attr ? RTA_LENGTH(attr_len) : 0);
+    buf.resize(offset + NLMSG_ALIGN(len));
+    nlmsghdr* nlh = (nlmsghdr*) &buf[offset];
+    nlh->nlmsg_len = len;
+    nlh->nlmsg_type = type;
+    memcpy(NLMSG_DATA(nlh), body, body_len);
+    if (attr) {
+        rtattr* rta = (rtattr*) ((uint8_t*) NLMSG_DATA(nlh) + NLMSG_ALIGN(body_len));
+        rta->rta_type = attr_type;
+        rta->rta_len = RTA_LENGTH(attr_len);
+        memcpy(RTA_DATA(rta), attr, attr_len);
+    }
+}
+
+TEST(Link_monitor, parse)
+{
+    std::vector<uint8_t> buf;
+
+    ifaddrmsg ifa;
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = AF_INET;
+    ifa.ifa_index = 3;
+    in_addr v4;
+    inet_pton(AF_INET, "10.0.0.5", &v4);
+    append_message(buf, RTM_DELADDR, &ifa, sizeof(ifa), IFA_LOCAL, &v4, sizeof(v4));
+
+    ifinfomsg ifi;
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_index = 3;
+    ifi.ifi_flags = IFF_UP; // not running
+    append_message(buf, RTM_NEWLINK, &ifi, sizeof(ifi), 0, nullptr, 0);
+
+    ifa.ifa_family = AF_INET6;
+    ifa.ifa_index = 4;
+    in6_addr v6;
+    inet_pton(AF_INET6, "2001:db8::1", &v6);
+    append_message(buf, RTM_NEWADDR, &ifa, sizeof(ifa), IFA_ADDRESS, &v6, sizeof(v6));
+
+    std::vector<Link_change> changes;
+    Link_monitor::parse(buf.data(), buf.size(), changes);
+    ASSERT_EQ(changes.size(), 3u);
+
+    EXPECT_EQ(changes[0].kind, Link_change::EAddressRemoved);
+    EXPECT_EQ(changes[0].ifindex, 3);
+    ASSERT_EQ(changes[0].addrs.size(), 1u);
+    sockaddr_storage expected;
+    memset(&expected, 0, sizeof(expected));
+    expected.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&expected) = v4;
+    SOCK_ADDR_IN_PORT(&expected) = htons(6881);
+    EXPECT_TRUE(Link_monitor::same_ip(changes[0].addrs[0], expected));
+
+    EXPECT_EQ(changes[1].kind, Link_change::ELinkDown);
+    EXPECT_EQ(changes[1].ifindex, 3);
+
+    EXPECT_EQ(changes[2].kind, Link_change::EAddressAdded);
+    ASSERT_EQ(changes[2].addrs.size(), 1u);
+    EXPECT_EQ(changes[2].addrs[0].ss_family, AF_INET6);
+    EXPECT_FALSE(Link_monitor::same_ip(changes[2].addrs[0], expected));
+
+    Link_monitor monitor;
+    if (monitor.open() == 0) {
+        EXPECT_GT(monitor.fd(), 0);
+        // nothing is pending on a quiet host, the read doesn't block
+        changes.clear();
+        EXPECT_TRUE(monitor.read(changes));
+        monitor.close();
+    }
+}
+
+}
+#endif
+
+ant::Link_monitor::Link_monitor()
+    : _fd(-1)
+{
+}
+
+ant::Link_monitor::~Link_monitor()
+{
+    close();
+}
+
+int ant::Link_monitor::open()
+{
+#ifdef __linux__
+    if (_fd >= 0)
+        return 0;
+
+    _fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (_fd < 0) {
+        int error = errno;
+        LOG(Log::EWarning, Log::ENet, "netlink socket failed: %s(%d)\n", strerror(errno), errno)
+        return error;
+    }
+
+    sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (::bind(_fd, (sockaddr *) &sa, sizeof(sa)) != 0) {
+        int error = errno;
+        LOG(Log::EWarning, Log::ENet, "netlink bind failed: %s(%d)\n", strerror(errno), errno)
+        close();
+        return error;
+    }
+
+    _buf.resize(16384);
+    return 0;
+#else
+    return EOPNOTSUPP;
+#endif
+}
+
+void ant::Link_monitor::close()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+bool ant::Link_monitor::read(std::vector<Link_change>& changes)
+{
+#ifdef __linux__
+    bool complete = true;
+    size_t first = changes.size();
+    for (;;) {
+        ssize_t len = recv(_fd, _buf.data(), _buf.size(), 0);
+        if (len < 0) {
+            // the socket buffer overflowed, the caller has to assume anything changed
+            if (errno == ENOBUFS) {
+                complete = false;
+                continue;
+            }
+            break;
+        }
+        parse(_buf.data(), len, changes);
+    }
+
+    // link events carry the addresses which the interface has now
+    ifaddrs *ifaces = nullptr;
+    for (size_t i = first; i < changes.size(); ++i) {
+        Link_change &change = changes[i];
+        if (change.kind != Link_change::ELinkDown && change.kind != Link_change::ELinkUp)
+            continue;
+        if (!ifaces && getifaddrs(&ifaces))
+            break;
+        for (ifaddrs *iface = ifaces; iface; iface = iface->ifa_next) {
+            if (!iface->ifa_addr || (iface->ifa_addr->sa_family != AF_INET && iface->ifa_addr->sa_family != AF_INET6))
+                continue;
+            if ((int) if_nametoindex(iface->ifa_name) != change.ifindex)
+                continue;
+            sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            memcpy(&addr, iface->ifa_addr,
+                iface->ifa_addr->sa_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+            change.addrs.push_back(addr);
+        }
+    }
+    if (ifaces)
+        freeifaddrs(ifaces);
+    return complete;
+#else
+    return true;
+#endif
+}
+
+void ant::Link_monitor::parse(const uint8_t* buffer, size_t len, std::vector<Link_change>& changes)
+{
+#ifdef __linux__
+    int remaining = (int) len;
+    for (const nlmsghdr *nlh = (const nlmsghdr *) buffer; NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining)) {
+        switch (nlh->nlmsg_type) {
+            case RTM_NEWLINK:
+            case RTM_DELLINK: {
+                const ifinfomsg *ifi = (const ifinfomsg *) NLMSG_DATA(nlh);
+                Link_change change;
+                bool running = (ifi->ifi_flags & IFF_UP) && (ifi->ifi_flags & IFF_RUNNING);
+                change.kind = nlh->nlmsg_type == RTM_NEWLINK && running ? Link_change::ELinkUp : Link_change::ELinkDown;
+                change.ifindex = ifi->ifi_index;
+                changes.push_back(change);
+                break;
+            }
+
+            case RTM_NEWADDR:
+            case RTM_DELADDR: {
+                const ifaddrmsg *ifa = (const ifaddrmsg *) NLMSG_DATA(nlh);
+                if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+                    break;
+
+                // IFA_LOCAL is the own address of point-to-point interfaces, IFA_ADDRESS is the peer there
+                const rtattr *local = nullptr, *address = nullptr;
+                int attr_len = IFA_PAYLOAD(nlh);
+                for (const rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, attr_len); rta = RTA_NEXT(rta, attr_len)) {
+                    if (rta->rta_type == IFA_LOCAL)
+                        local = rta;
+                    else if (rta->rta_type == IFA_ADDRESS)
+                        address = rta;
+                }
+                const rtattr *rta = local ? local : address;
+                if (!rta)
+                    break;
+
+                sockaddr_storage addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.ss_family = ifa->ifa_family;
+                if (ifa->ifa_family == AF_INET && RTA_PAYLOAD(rta) >= sizeof(in_addr))
+                    memcpy(&SOCK_ADDR_IN_ADDR(&addr), RTA_DATA(rta), sizeof(in_addr));
+                else if (ifa->ifa_family == AF_INET6 && RTA_PAYLOAD(rta) >= sizeof(in6_addr))
+                    memcpy(&SOCK_ADDR_IN6_ADDR(&addr), RTA_DATA(rta), sizeof(in6_addr));
+                else
+                    break;
+
+                Link_change change;
+                change.kind = nlh->nlmsg_type == RTM_NEWADDR ? Link_change::EAddressAdded : Link_change::EAddressRemoved;
+                change.ifindex = ifa->ifa_index;
+                change.addrs.push_back(addr);
+                changes.push_back(change);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+#endif
+}
+
+bool ant::Link_monitor::same_ip(sockaddr_storage const& a, sockaddr_storage const& b)
+{
+    if (a.ss_family != b.ss_family)
+        return false;
+    if (a.ss_family == AF_INET)
+        return !memcmp(&SOCK_ADDR_IN_ADDR(&a), &SOCK_ADDR_IN_ADDR(&b), sizeof(in_addr));
+    if (a.ss_family == AF_INET6)
+        return !memcmp(&SOCK_ADDR_IN6_ADDR(&a), &SOCK_ADDR_IN6_ADDR(&b), sizeof(in6_addr));
+    return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+
+namespace ant {
+
+    struct Link_change {
+        enum Kind {
+            ELinkDown = 1,
+            ELinkUp = 2,
+            EAddressRemoved = 3,
+            EAddressAdded = 4
+        };
+        Kind kind;
+        int ifindex;
+        // the changed address, or all addresses of the interface for link events (ports are 0)
+        std::vector<sockaddr_storage> addrs;
+    };
+
+    // Interface and address notifications of the kernel (rtnetlink RTMGRP_LINK and RTMGRP_IPV4/6_IFADDR).
+    // The descriptor is registered in the loop reactor, read() drains it.
+    // Linux only, open() fails with EOPNOTSUPP on other platforms.
+    class Link_monitor
+    {
+    public:
+        Link_monitor();
+        ~Link_monitor();
+
+        // return 0 if success or system error code
+        int open();
+        void close();
+        int fd() const {
+            return _fd;
+        }
+
+        // appends the pending changes, return false if notifications were lost (ENOBUFS)
+        bool read(std::vector<Link_change>& changes);
+
+        // parses a buffer of netlink messages
+        static void parse(const uint8_t* buffer, size_t len, std::vector<Link_change>& changes);
+        // true if both addresses have the same IP, ports are ignored
+        static bool same_ip(sockaddr_storage const& a, sockaddr_storage const& b);
+
+    private:
+        int _fd;
+        std::vector<uint8_t> _buf;
+    };
+
+}
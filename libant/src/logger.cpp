@@ -1,9 +1,113 @@
 #include <sys/time.h>
+#include <errno.h>
 #include <memory>
 #include <algorithm>
+#include <chrono>
 #include <stdio.h>
 #include <string.h>
 #include "logger.h"
+#include "thread_util.h"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+static std::mutex s_test_mt;
+static std::vector<std::string> s_test_lines;
+
+static void test_log(char const *text)
+{
+    std::lock_guard<std::mutex> lock(s_test_mt);
+    s_test_lines.push_back(text);
+}
+
+static std::vector<std::string> test_lines()
+{
+    std::lock_guard<std::mutex> lock(s_test_mt);
+    std::vector<std::string> lines;
+    lines.swap(s_test_lines);
+    return lines;
+}
+
+// logs count messages "<thread> <i>" from each of threads threads
+static void log_from_threads(int threads, int count)
+{
+    std::vector<std::thread> loggers;
+    for (int t = 0; t < threads; ++t) {
+        loggers.emplace_back([t, count]() {
+            for (int i = 0; i < count; ++i)
+                LOG(Log::EError, Log::EAnt, "%d %d\n", t, i)
+        });
+    }
+    for (auto &logger: loggers)
+        logger.join();
+}
+
+TEST(Logger, async)
+{
+    Log::Log_level level = Logger::instance()->get_log_level(Log::EAnt);
+    Log::enable_log_name(Log::EAnt, Log::EError);
+    Log::set(test_log);
+    test_lines();
+
+    // every message arrives, the ones of a thread in order
+    Log::set_async(true, Log::EAsyncBlock, 1024);
+    log_from_threads(4, 2000);
+    Log::flush();
+    std::vector<std::string> lines = test_lines();
+    EXPECT_EQ(lines.size(), 8000u);
+    std::vector<int> next(4, 0);
+    for (auto const& line: lines) {
+        int t, i;
+        ASSERT_EQ(sscanf(line.c_str(), "[ERR] [ANT] %d %d", &t, &i), 2) << line;
+        ASSERT_TRUE(t >= 0 && t < 4);
+        EXPECT_EQ(i, next[t]++);
+    }
+
+    // turning it on again keeps what the rings have, a long message is formatted on the heap
+    for (int i = 0; i < 10; ++i)
+        LOG(Log::EError, Log::EAnt, "%d %d\n", 0, i)
+    Log::set_async(true);
+    std::string long_text(2 * Logger::EInlineSize, 'x');
+    LOG(Log::EError, Log::EAnt, "%s\n", long_text.c_str())
+    Log::set_async(false);
+    lines = test_lines();
+    ASSERT_EQ(lines.size(), 11u);
+    EXPECT_EQ(lines[0], "[ERR] [ANT] 0 0\n");
+    EXPECT_EQ(lines[10], "[ERR] [ANT] " + long_text + "\n");
+
+    // what doesn't fit a small ring is dropped and reported
+    unsigned long long dropped = Log::dropped();
+    Log::set_async(true, Log::EAsyncDrop, 1024);
+    log_from_threads(2, 5000);
+    Log::set_async(false);
+    lines = test_lines();
+    size_t delivered = 0;
+    unsigned long long reported = 0;
+    for (auto const& line: lines) {
+        unsigned long long n;
+        if (sscanf(line.c_str(), "[WRN] [LOG] %llu messages dropped", &n) == 1)
+            reported += n;
+        else
+            ++delivered;
+    }
+    EXPECT_EQ(delivered + Log::dropped() - dropped, 10000u);
+    EXPECT_EQ(reported, Log::dropped() - dropped);
+
+    // back in sync mode
+    LOGS(Log::EError, Log::EAnt, "sync\n")
+    lines = test_lines();
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_EQ(lines[0], "[ERR] [ANT] sync\n");
+
+    Log::set(nullptr);
+    Log::enable_log_name(Log::EAnt, level);
+}
+
+}
+#endif
 
 namespace ant {
 
@@ -26,6 +130,26 @@ namespace ant {
         Logger::instance()->set(func);
     }
 
+    void Log::set_async(bool enable, Async_policy policy, unsigned ring_bytes)
+    {
+        Logger::instance()->set_async(enable, policy, ring_bytes);
+    }
+
+    int Log::set_file(char const *path)
+    {
+        return Logger::instance()->set_file(path);
+    }
+
+    void Log::flush()
+    {
+        Logger::instance()->flush();
+    }
+
+    unsigned long long Log::dropped()
+    {
+        return Logger::instance()->dropped();
+    }
+
     void Log::enable_log_level(Log_level level)
     {
         Logger::instance()->enable_log_level(level);
@@ -36,8 +160,120 @@ namespace ant {
         Logger::instance()->enable_log_name(name, level);
     }
 
+    // Single-producer single-consumer ring of messages: the logging thread pushes, the background thread
+    // pops. A message is its length, its time stamp and the text, which can wrap around the end.
+    class Log_ring
+    {
+    public:
+        struct Message {
+            uint64_t stamp;
+            size_t offset;      // in the batch text
+            size_t len;
+        };
+
+        explicit Log_ring(size_t capacity)
+            : _capacity(capacity)
+            , _buf(new char[capacity])
+            , _head(0)
+            , _tail(0)
+            , orphaned(false)
+        {}
+
+        // return false if there is no room
+        bool push(char const *text, size_t len, uint64_t stamp) {
+            len = std::min(len, _capacity / 2);
+            size_t need = sizeof(uint32_t) + sizeof(stamp) + len;
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (_capacity - (head - _tail.load(std::memory_order_acquire)) < need)
+                return false;
+            uint32_t len32 = (uint32_t) len;
+            head = write(head, (char const *) &len32, sizeof(len32));
+            head = write(head, (char const *) &stamp, sizeof(stamp));
+            head = write(head, text, len);
+            _head.store(head, std::memory_order_release);
+            return true;
+        }
+
+        // appends the texts to batch
+        void pop_all(std::vector<Message>& messages, std::string& batch) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            size_t head = _head.load(std::memory_order_acquire);
+            while (tail != head) {
+                uint32_t len;
+                Message message;
+                tail = read(tail, (char *) &len, sizeof(len));
+                tail = read(tail, (char *) &message.stamp, sizeof(message.stamp));
+                message.offset = batch.size();
+                message.len = len;
+                batch.resize(batch.size() + len);
+                tail = read(tail, &batch[message.offset], len);
+                messages.push_back(message);
+            }
+            _tail.store(tail, std::memory_order_release);
+        }
+
+        bool empty() const {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_relaxed);
+        }
+        bool half_full() const {
+            return _head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_relaxed) > _capacity / 2;
+        }
+
+    private:
+        size_t write(size_t pos, char const *data, size_t len) {
+            size_t at = pos % _capacity;
+            size_t first = std::min(len, _capacity - at);
+            memcpy(_buf.get() + at, data, first);
+            memcpy(_buf.get(), data + first, len - first);
+            return pos + len;
+        }
+        size_t read(size_t pos, char *data, size_t len) const {
+            size_t at = pos % _capacity;
+            size_t first = std::min(len, _capacity - at);
+            memcpy(data, _buf.get() + at, first);
+            memcpy(data + first, _buf.get(), len - first);
+            return pos + len;
+        }
+
+        size_t _capacity;
+        std::unique_ptr<char[]> _buf;
+        std::atomic<size_t> _head;     // bytes pushed
+        std::atomic<size_t> _tail;     // bytes popped
+
+    public:
+        std::atomic<bool> orphaned;    // the thread has exited, the ring goes once it is empty
+    };
+
+    // the ring of the calling thread
+    struct Log_ring_holder {
+        std::shared_ptr<Log_ring> ring;
+        unsigned generation;
+        ~Log_ring_holder() {
+            if (ring)
+                ring->orphaned = true;
+        }
+    };
+    static thread_local Log_ring_holder t_ring;
+
+    static uint64_t log_stamp()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
     Logger::Logger()
         : log_level(Log::EWarning)
+        , log_func(nullptr)
+        , _async(false)
+        , _policy(Log::EAsyncDrop)
+        , _ring_bytes(64 * 1024)
+        , _stop(false)
+        , _flush_requests(0)
+        , _flushed(0)
+        , _generation(0)
+        , _dropped(0)
+        , _dropped_reported(0)
+        , _file(nullptr)
     {
         loggers.resize(Log::EEnd);
 
@@ -52,11 +288,203 @@ namespace ant {
             le.size = le.prefix.length() + strlen(log_level_to_string(le.level)); });
     }
 
+    Logger::~Logger()
+    {
+        set_async(false, _policy, _ring_bytes);
+        set_file(nullptr);
+    }
+
     void Logger::set(Log::log_function func)
     {
         log_func = func;
     }
 
+    int Logger::set_file(char const *path)
+    {
+        FILE *file = nullptr;
+        if (path && !(file = fopen(path, "a")))
+            return errno;
+        std::lock_guard<std::mutex> lock(_sink_mt);
+        FILE *prev = _file.exchange(file);
+        if (prev)
+            fclose(prev);
+        return 0;
+    }
+
+    void Logger::do_print(char const *text)
+    {
+        if (!text)
+            return;
+        // the log function is called without locks, only the file is shared
+        if (_file.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(_sink_mt);
+            FILE *file = _file.load(std::memory_order_relaxed);
+            if (file) {
+                fputs(text, file);
+                return;
+            }
+        }
+        if (log_func)
+            log_func(text);
+    }
+
+    void Logger::set_async(bool enable, Log::Async_policy policy, size_t ring_bytes)
+    {
+        // the thread delivers the rest before it exits
+        if (_thread.joinable()) {
+            _async = false;
+            {
+                std::lock_guard<std::mutex> lock(_mt);
+                _stop = true;
+            }
+            _wakeup.notify_all();
+            _thread.join();
+        }
+        // and what the threads pushed meanwhile
+        while (deliver())
+            ;
+        if (!enable)
+            return;
+        _policy = policy;
+        _ring_bytes = std::max<size_t>(ring_bytes, 2 * EInlineSize);
+        // the threads take new rings of the size, the old ones go once they are empty
+        _generation.fetch_add(1, std::memory_order_release);
+        _stop = false;
+        _thread = std::thread(&Logger::async_proc, this);
+        _async = true;
+    }
+
+    void Logger::flush()
+    {
+        std::unique_lock<std::mutex> lock(_mt);
+        if (!_thread.joinable())
+            return;
+        uint64_t request = ++_flush_requests;
+        _wakeup.notify_all();
+        _flushed_cv.wait(lock, [this, request]() { return _flushed >= request || _stop; });
+    }
+
+    void Logger::print_async(char const *text, size_t len)
+    {
+        Log_ring_holder &holder = t_ring;
+        unsigned generation = _generation.load(std::memory_order_acquire);
+        if (!holder.ring || holder.generation != generation) {
+            // the thread is the only producer of its ring, after this the old one is only emptied
+            if (holder.ring)
+                holder.ring->orphaned = true;
+            holder.ring = std::make_shared<Log_ring>(_ring_bytes);
+            holder.generation = generation;
+            std::lock_guard<std::mutex> lock(_rings_mt);
+            _rings.push_back(holder.ring);
+        }
+        Log_ring &ring = *holder.ring;
+        uint64_t stamp = log_stamp();
+        while (!ring.push(text, len, stamp)) {
+            if (_policy == Log::EAsyncDrop) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (!_async.load()) {
+                // turned off while waiting, nobody empties the ring
+                while (deliver())
+                    ;
+                do_print(std::string(text, len).c_str());
+                return;
+            }
+            _wakeup.notify_one();
+            std::this_thread::yield();
+        }
+        // set_async(false) delivers after it has cleared _async and stopped the thread,
+        // a message pushed after that is delivered here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!_async.load()) {
+            while (deliver())
+                ;
+            return;
+        }
+        // the background thread polls, it is woken up only if the ring fills
+        if (ring.half_full())
+            _wakeup.notify_one();
+    }
+
+    bool Logger::deliver()
+    {
+        std::lock_guard<std::mutex> deliver_lock(_deliver_mt);
+        std::vector<std::shared_ptr<Log_ring>> rings;
+        {
+            std::lock_guard<std::mutex> lock(_rings_mt);
+            // a ring which its thread has left is dropped after the last messages are taken
+            for (auto itr = _rings.begin(); itr != _rings.end();) {
+                rings.push_back(*itr);
+                if ((*itr)->orphaned && (*itr)->empty())
+                    itr = _rings.erase(itr);
+                else
+                    ++itr;
+            }
+        }
+
+        std::vector<Log_ring::Message> messages;
+        std::string batch;
+        for (auto &ring: rings)
+            ring->pop_all(messages, batch);
+        uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (messages.empty() && dropped == _dropped_reported)
+            return false;
+        std::stable_sort(messages.begin(), messages.end(),
+            [](Log_ring::Message const& a, Log_ring::Message const& b) { return a.stamp < b.stamp; });
+
+        char notice[64];
+        notice[0] = 0;
+        if (dropped != _dropped_reported) {
+            snprintf(notice, sizeof(notice), "%s[LOG] %llu messages dropped\n", log_level_to_string(Log::EWarning),
+                (unsigned long long) (dropped - _dropped_reported));
+            _dropped_reported = dropped;
+        }
+
+        if (_file.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(_sink_mt);
+            FILE *file = _file.load(std::memory_order_relaxed);
+            if (file) {
+                fputs(notice, file);
+                for (auto const& message: messages)
+                    fwrite(batch.data() + message.offset, 1, message.len, file);
+                fflush(file);
+                return true;
+            }
+        }
+        Log::log_function func = log_func;
+        if (!func)
+            return true;
+        if (notice[0])
+            func(notice);
+        std::string text;
+        for (auto const& message: messages) {
+            text.assign(batch, message.offset, message.len);
+            func(text.c_str());
+        }
+        return true;
+    }
+
+    void Logger::async_proc()
+    {
+        set_thread_name("ant-log");
+        std::unique_lock<std::mutex> lock(_mt);
+        for (;;) {
+            bool stop = _stop;
+            uint64_t requests = _flush_requests;
+            lock.unlock();
+            while (deliver())
+                ;
+            lock.lock();
+            _flushed = requests;
+            _flushed_cv.notify_all();
+            if (stop)
+                break;
+            _wakeup.wait_for(lock, std::chrono::milliseconds(10),
+                [this, requests]() { return _stop || _flush_requests != requests; });
+        }
+    }
+
     void Logger::enable_log_level(Log::Log_level level)
     {
         log_level = level;
@@ -2,10 +2,16 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
 #include <vector>
 #include <stdarg.h>
 #include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "libant/log.h"
 
@@ -13,6 +19,8 @@ namespace ant {
 
     const char *log_level_to_string(Log::Log_level ll);
 
+    class Log_ring;
+
     class Logger
     {
     public:
@@ -28,7 +36,19 @@ namespace ant {
 		};
 		std::vector<Log_entity> loggers;
 
+		enum {
+			EInlineSize = 512	// async messages up to this size are formatted on the stack
+		};
+
+		~Logger();
+
 		void set(Log::log_function func);
+		void set_async(bool enable, Log::Async_policy policy, size_t ring_bytes);
+		int set_file(char const *path);
+		void flush();
+		uint64_t dropped() const {
+			return _dropped.load(std::memory_order_relaxed);
+		}
         void enable_log_level(Log::Log_level level);
         void enable_log_name(Log::Log_name name, Log::Log_level level);
         inline bool is_enabled(Logger::Log_entity const &le, Log::Log_level level) {
@@ -44,6 +64,20 @@ namespace ant {
         template<typename ... Args>
         void formatted_print(Log::Log_level level, Logger::Log_entity const &le, const std::string& format, Args ... args)
         {
+            if (_async.load(std::memory_order_relaxed)) {
+                char buf[EInlineSize];
+                int prefix = snprintf(buf, sizeof(buf), "%s%s", log_level_to_string(level), le.prefix.c_str());
+                int size = prefix + snprintf(buf + prefix, sizeof(buf) - prefix, format.c_str(), args ...);
+                if (size < (int) sizeof(buf)) {
+                    print_async(buf, size);
+                } else {
+                    std::unique_ptr<char[]> big(new char[size + 1]);
+                    memcpy(big.get(), buf, prefix);
+                    snprintf(big.get() + prefix, size + 1 - prefix, format.c_str(), args ...);
+                    print_async(big.get(), size);
+                }
+                return;
+            }
 			size_t size = snprintf(nullptr, 0, format.c_str(), args ...) + le.size + 1; // Extra space for '\0'
             std::unique_ptr<char[]> buf(new char[size]);
 
@@ -60,15 +94,36 @@ namespace ant {
     private:
         Logger();
 
-        void do_print(char const *text)
-        {
-            if (log_func && text)
-                log_func(text);
-        }
+        void do_print(char const *text);
+        // queues the message in the ring of the calling thread
+        void print_async(char const *text, size_t len);
+        void async_proc();
+        // moves the messages of all rings to the sink in time order, return false if there were none
+        bool deliver();
 
     private:
         Log::Log_level log_level;
         Log::log_function log_func;
+
+        // async mode
+        std::atomic<bool> _async;
+        Log::Async_policy _policy;
+        size_t _ring_bytes;
+        std::thread _thread;
+        std::mutex _mt;
+        std::condition_variable _wakeup;
+        std::condition_variable _flushed_cv;
+        bool _stop;
+        uint64_t _flush_requests;
+        uint64_t _flushed;
+        std::mutex _rings_mt;
+        std::vector<std::shared_ptr<Log_ring>> _rings;
+        std::atomic<unsigned> _generation;     // of the rings, bumped by set_async
+        std::atomic<uint64_t> _dropped;
+        uint64_t _dropped_reported;     // background thread only
+        std::mutex _deliver_mt;     // the rings have one consumer
+        std::mutex _sink_mt;        // the file only, the log function isn't serialized
+        std::atomic<FILE*> _file;
     };
 
 #	define LOG(level, logger_name, format_pattern, ...) { \
@@ -0,0 +1,505 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "metrics.h"
+#include "logger.h"
+#include "utils.hpp"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+static sockaddr_storage loopback_addr(uint16_t port)
+{
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    SOCK_ADDR_IN_PORT(&sa) = htons(port);
+    return sa;
+}
+
+static void collect_test(Metrics_sink& sink, uint64_t& sent)
+{
+    Latency_histogram rtt;
+    for (uint64_t us = 1000; us <= 100000; us += 1000)
+        rtt.record(us);
+    sink.counter("ant_test_sent_total", "Packets sent", {{"conn", "7"}, {"peer", "10.0.0.1:\"5\""}}, sent);
+    sink.gauge("ant_test_queue_bytes", "Send queue", {{"conn", "7"}}, 1500);
+    sink.histogram("ant_test_rtt_seconds", "RTT", {{"conn", "7"}}, rtt);
+}
+
+TEST(Metrics, formats)
+{
+    Metrics_registry registry;
+    uint64_t sent = 10;
+    int id = registry.add(std::bind(collect_test, std::placeholders::_1, std::ref(sent)));
+    std::vector<Metric> metrics = registry.collect();
+    ASSERT_EQ(metrics.size(), 3u);
+
+    std::string text = Metrics_registry::prometheus_text(metrics);
+    EXPECT_NE(text.find("# TYPE ant_test_sent_total counter\n"
+        "ant_test_sent_total{conn=\"7\",peer=\"10.0.0.1:\\\"5\\\"\"} 10\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE ant_test_queue_bytes gauge\nant_test_queue_bytes{conn=\"7\"} 1500\n"),
+        std::string::npos);
+    EXPECT_NE(text.find("# TYPE ant_test_rtt_seconds summary\n"), std::string::npos);
+    EXPECT_NE(text.find("ant_test_rtt_seconds{conn=\"7\",quantile=\"1\"} 0.1\n"), std::string::npos);
+    EXPECT_NE(text.find("ant_test_rtt_seconds_sum{conn=\"7\"} 5.05\n"), std::string::npos);
+    EXPECT_NE(text.find("ant_test_rtt_seconds_count{conn=\"7\"} 100\n"), std::string::npos);
+
+    Statsd_exporter statsd(registry, "app");
+    std::vector<std::string> lines = statsd.format(metrics);
+    EXPECT_NE(std::find(lines.begin(), lines.end(), "app.ant_test_sent_total.7.10_0_0_1__5_:10|c"), lines.end());
+    EXPECT_NE(std::find(lines.begin(), lines.end(), "app.ant_test_queue_bytes.7:1500|g"), lines.end());
+    EXPECT_NE(std::find(lines.begin(), lines.end(), "app.ant_test_rtt_seconds.7.max:100|g"), lines.end());
+    // counters go as increments
+    sent = 25;
+    lines = statsd.format(registry.collect());
+    EXPECT_NE(std::find(lines.begin(), lines.end(), "app.ant_test_sent_total.7.10_0_0_1__5_:15|c"), lines.end());
+    // a name which isn't reported is forgotten, it starts from 0 if it comes back
+    statsd.format(std::vector<Metric>());
+    lines = statsd.format(registry.collect());
+    EXPECT_NE(std::find(lines.begin(), lines.end(), "app.ant_test_sent_total.7.10_0_0_1__5_:25|c"), lines.end());
+
+    // quantiles of a recorder follow the recent values, the count and sum are cumulative
+    Latency_recorder recorder;
+    recorder.record(1000);
+    Metrics_sink sink;
+    sink.histogram("ant_test_delay_seconds", "Delay", {}, recorder);
+    recorder.window(std::chrono::steady_clock::now() + std::chrono::milliseconds(Latency_recorder::EWindowMs));
+    recorder.window(std::chrono::steady_clock::now() + std::chrono::milliseconds(2 * Latency_recorder::EWindowMs));
+    sink.histogram("ant_test_delay_seconds", "Delay", {}, recorder);
+    ASSERT_EQ(sink.metrics().size(), 2u);
+    EXPECT_EQ(sink.metrics()[0].quantile_us[0], 1000u);
+    EXPECT_EQ(sink.metrics()[1].count, 1u);
+    EXPECT_EQ(sink.metrics()[1].sum_us, 1000u);
+    EXPECT_EQ(sink.metrics()[1].quantile_us[0], 0u);
+
+    registry.remove(id);
+    EXPECT_TRUE(registry.collect().empty());
+}
+
+TEST(Metrics, exporters)
+{
+    Metrics_registry registry;
+    uint64_t sent = 3;
+    registry.add(std::bind(collect_test, std::placeholders::_1, std::ref(sent)));
+
+    Prometheus_exporter http(registry);
+    ASSERT_EQ(http.start(loopback_addr(0)), 0);
+    sockaddr_storage addr = http.address();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, (sockaddr *) &addr, sizeof(sockaddr_in)), 0);
+    const char request[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    ASSERT_EQ(send(fd, request, sizeof(request) - 1, 0), (ssize_t) sizeof(request) - 1);
+    std::string response;
+    char buf[4096];
+    ssize_t rc;
+    while ((rc = recv(fd, buf, sizeof(buf), 0)) > 0)
+        response.append(buf, rc);
+    close(fd);
+    EXPECT_EQ(response.compare(0, 15, "HTTP/1.1 200 OK"), 0);
+    EXPECT_NE(response.find("ant_test_queue_bytes{conn=\"7\"} 1500\n"), std::string::npos);
+    http.stop();
+
+    int daemon = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_storage daemon_addr = loopback_addr(0);
+    ASSERT_EQ(bind(daemon, (sockaddr *) &daemon_addr, sizeof(sockaddr_in)), 0);
+    socklen_t len = sizeof(daemon_addr);
+    getsockname(daemon, (sockaddr *) &daemon_addr, &len);
+    Statsd_exporter statsd(registry);
+    ASSERT_EQ(statsd.start(daemon_addr, 20), 0);
+    rc = recv(daemon, buf, sizeof(buf) - 1, 0);
+    ASSERT_GT(rc, 0);
+    buf[rc] = 0;
+    EXPECT_NE(strstr(buf, "ant.ant_test_queue_bytes.7:1500|g"), nullptr);
+    statsd.stop();
+    close(daemon);
+}
+
+}
+#endif
+
+const double ant::Metric::quantiles[ant::Metric::EQuantiles] = {0.5, 0.99, 0.999, 1};
+
+ant::Metric& ant::Metrics_sink::add(Metric::Type type, const char *name, const char *help,
+                                    Metric_labels const& labels)
+{
+    _metrics.push_back(Metric());
+    Metric &metric = _metrics.back();
+    metric.type = type;
+    metric.name = name;
+    metric.help = help;
+    metric.labels = labels;
+    metric.value = 0;
+    metric.count = 0;
+    metric.sum_us = 0;
+    memset(metric.quantile_us, 0, sizeof(metric.quantile_us));
+    return metric;
+}
+
+void ant::Metrics_sink::counter(const char *name, const char *help, Metric_labels const& labels, double value)
+{
+    add(Metric::ECounter, name, help, labels).value = value;
+}
+
+void ant::Metrics_sink::gauge(const char *name, const char *help, Metric_labels const& labels, double value)
+{
+    add(Metric::EGauge, name, help, labels).value = value;
+}
+
+void ant::Metrics_sink::histogram(const char *name, const char *help, Metric_labels const& labels,
+                                  Latency_histogram const& histogram)
+{
+    Metric &metric = add(Metric::EHistogram, name, help, labels);
+    metric.count = histogram.count();
+    metric.sum_us = histogram.sum();
+    for (int i = 0; i < Metric::EQuantiles; ++i)
+        metric.quantile_us[i] = Metric::quantiles[i] < 1 ? histogram.percentile(Metric::quantiles[i] * 100)
+            : histogram.max();
+}
+
+void ant::Metrics_sink::histogram(const char *name, const char *help, Metric_labels const& labels,
+                                  Latency_recorder& recorder)
+{
+    histogram(name, help, labels, recorder.window(std::chrono::steady_clock::now()));
+    Metric &metric = _metrics.back();
+    metric.count = recorder.total().count();
+    metric.sum_us = recorder.total().sum();
+}
+
+void ant::Metrics_sink::thread(Thread_stats const& stats)
+{
+    Metric_labels labels = {{"thread", stats.name ? stats.name : ""}};
+    counter("ant_thread_cpu_seconds_total", "CPU time of the loop thread", labels, stats.cpu_ns / 1e9);
+    counter("ant_thread_iterations_total", "Loop iterations", labels, stats.iterations);
+    gauge("ant_thread_busy_ratio", "Share of the wall time the loop spent outside its wait", labels,
+          stats.busy_ratio());
+}
+
+int ant::Metrics_registry::add(Collector const& collector)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    _collectors[_next_id] = collector;
+    return _next_id++;
+}
+
+void ant::Metrics_registry::remove(int id)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    _collectors.erase(id);
+}
+
+std::vector<ant::Metric> ant::Metrics_registry::collect() const
+{
+    Metrics_sink sink;
+    std::lock_guard<std::mutex> lock(_mt);
+    for (auto &itr: _collectors)
+        itr.second(sink);
+    return std::move(sink.metrics());
+}
+
+static std::string format_value(double value)
+{
+    char buf[32];
+    if (std::isnan(value))
+        return "NaN";
+    if (value == std::floor(value) && std::fabs(value) < 1e15)
+        snprintf(buf, sizeof(buf), "%.0f", value);
+    else
+        snprintf(buf, sizeof(buf), "%.9g", value);
+    return buf;
+}
+
+static std::string escape(std::string const& value, bool quotes)
+{
+    std::string out;
+    for (char c: value) {
+        if (c == '\\')
+            out += "\\\\";
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '"' && quotes)
+            out += "\\\"";
+        else
+            out += c;
+    }
+    return out;
+}
+
+static std::string prometheus_labels(ant::Metric_labels const& labels, const char *quantile = nullptr)
+{
+    if (labels.empty() && !quantile)
+        return std::string();
+    std::string out = "{";
+    for (auto const& label: labels) {
+        if (out.size() > 1)
+            out += ',';
+        out += label.first + "=\"" + escape(label.second, true) + '"';
+    }
+    if (quantile)
+        out += std::string(out.size() > 1 ? "," : "") + "quantile=\"" + quantile + '"';
+    return out + '}';
+}
+
+std::string ant::Metrics_registry::prometheus_text(std::vector<Metric> const& metrics)
+{
+    // the metrics of a name make a family, in the order of the first one
+    std::vector<std::string> names;
+    std::map<std::string, std::vector<Metric const*>> families;
+    for (auto const& metric: metrics) {
+        auto &family = families[metric.name];
+        if (family.empty())
+            names.push_back(metric.name);
+        family.push_back(&metric);
+    }
+
+    std::string out;
+    for (auto const& name: names) {
+        auto const& family = families[name];
+        static const char *types[] = {"untyped", "counter", "gauge", "summary"};
+        out += "# HELP " + name + ' ' + escape(family.front()->help, false) + '\n';
+        out += "# TYPE " + name + ' ' + types[family.front()->type] + '\n';
+        for (Metric const* metric: family) {
+            if (metric->type != Metric::EHistogram) {
+                out += name + prometheus_labels(metric->labels) + ' ' + format_value(metric->value) + '\n';
+                continue;
+            }
+            for (int i = 0; i < Metric::EQuantiles; ++i) {
+                std::string quantile = format_value(Metric::quantiles[i]);
+                out += name + prometheus_labels(metric->labels, quantile.c_str()) + ' '
+                    + format_value(metric->quantile_us[i] / 1e6) + '\n';
+            }
+            out += name + "_sum" + prometheus_labels(metric->labels) + ' ' + format_value(metric->sum_us / 1e6) + '\n';
+            out += name + "_count" + prometheus_labels(metric->labels) + ' ' + format_value(metric->count) + '\n';
+        }
+    }
+    return out;
+}
+
+ant::Prometheus_exporter::Prometheus_exporter(Metrics_registry& registry)
+    : _registry(registry)
+    , _fd(-1)
+    , _stop(false)
+{
+    memset(&_addr, 0, sizeof(_addr));
+}
+
+ant::Prometheus_exporter::~Prometheus_exporter()
+{
+    stop();
+}
+
+int ant::Prometheus_exporter::start(sockaddr_storage const& addr)
+{
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return errno;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    _addr = addr;
+    socklen_t len = addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    if (::bind(fd, (sockaddr *) &_addr, len) || listen(fd, 16) || getsockname(fd, (sockaddr *) &_addr, &len)) {
+        int error = errno;
+        LOG(Log::EError, Log::ENet, "metrics endpoint %s: %s(%d)\n", print_sockaddr(addr).c_str(), strerror(error),
+            error)
+        ::close(fd);
+        return error;
+    }
+    _fd = fd;
+    _stop = false;
+    _thread = std::thread(&Prometheus_exporter::thread_proc, this);
+    LOG(Log::EInfo, Log::ENet, "metrics endpoint http://%s/metrics\n", print_sockaddr(_addr).c_str())
+    return 0;
+}
+
+void ant::Prometheus_exporter::stop()
+{
+    if (!_thread.joinable())
+        return;
+    _stop = true;
+    _thread.join();
+    ::close(_fd);
+    _fd = -1;
+}
+
+void ant::Prometheus_exporter::thread_proc()
+{
+    set_thread_name("ant-metrics");
+    while (!_stop) {
+        pollfd pfd = {_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        int fd = accept(_fd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        serve(fd);
+        ::close(fd);
+    }
+}
+
+void ant::Prometheus_exporter::serve(int fd)
+{
+    timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // the request line and headers, a body isn't expected
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t rc = recv(fd, buf, sizeof(buf), 0);
+        if (rc <= 0)
+            return;
+        request.append(buf, rc);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if (request.compare(0, 4, "GET ") && request.compare(0, 5, "HEAD "))
+        status = "405 Method Not Allowed";
+    else if (request.find(" /metrics ") == std::string::npos && request.find(" / ") == std::string::npos)
+        status = "404 Not Found";
+    else if (!request.compare(0, 4, "GET "))
+        body = Metrics_registry::prometheus_text(_registry.collect());
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+    for (size_t sent = 0; sent < response.size();) {
+        ssize_t rc = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (rc <= 0)
+            break;
+        sent += rc;
+    }
+}
+
+ant::Statsd_exporter::Statsd_exporter(Metrics_registry& registry, std::string const& prefix)
+    : _registry(registry)
+    , _prefix(prefix)
+    , _fd(-1)
+    , _stop(false)
+{
+}
+
+ant::Statsd_exporter::~Statsd_exporter()
+{
+    stop();
+}
+
+int ant::Statsd_exporter::start(sockaddr_storage const& to, int interval_ms)
+{
+    int fd = socket(to.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0)
+        return errno;
+    socklen_t len = to.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    if (connect(fd, (sockaddr const *) &to, len)) {
+        int error = errno;
+        ::close(fd);
+        return error;
+    }
+    _fd = fd;
+    _stop = false;
+    _thread = std::thread(&Statsd_exporter::thread_proc, this, std::max(interval_ms, 1));
+    return 0;
+}
+
+void ant::Statsd_exporter::stop()
+{
+    if (!_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(_mt);
+        _stop = true;
+    }
+    _wakeup.notify_all();
+    _thread.join();
+    ::close(_fd);
+    _fd = -1;
+}
+
+void ant::Statsd_exporter::thread_proc(int interval_ms)
+{
+    set_thread_name("ant-statsd");
+    std::unique_lock<std::mutex> lock(_mt);
+    while (!_wakeup.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]() { return _stop; })) {
+        lock.unlock();
+        push();
+        lock.lock();
+    }
+}
+
+std::string ant::Statsd_exporter::key(Metric const& metric) const
+{
+    std::string out = _prefix.empty() ? metric.name : _prefix + '.' + metric.name;
+    for (auto const& label: metric.labels) {
+        out += '.';
+        for (char c: label.second)
+            out += isalnum((unsigned char) c) || c == '_' || c == '-' ? c : '_';
+    }
+    return out;
+}
+
+std::vector<std::string> ant::Statsd_exporter::format(std::vector<Metric> const& metrics)
+{
+    static const char *suffixes[Metric::EQuantiles] = {".p50", ".p99", ".p999", ".max"};
+    std::vector<std::string> lines;
+    // the counters of the names which aren't reported anymore, like those of closed connections, are dropped
+    std::map<std::string, double> counters;
+    std::lock_guard<std::mutex> lock(_counters_mt);
+    for (auto const& metric: metrics) {
+        std::string name = key(metric);
+        double count = metric.type == Metric::EHistogram ? metric.count : metric.value;
+        if (metric.type == Metric::EGauge) {
+            lines.push_back(name + ':' + format_value(metric.value) + "|g");
+            continue;
+        }
+        if (metric.type == Metric::EHistogram) {
+            for (int i = 0; i < Metric::EQuantiles; ++i)
+                lines.push_back(name + suffixes[i] + ':' + format_value(metric.quantile_us[i] / 1e3) + "|g");
+            name += ".count";
+        }
+        // a counter going back has been reset
+        auto itr = _counters.find(name);
+        double last = itr != _counters.end() ? itr->second : 0;
+        double delta = count >= last ? count - last : count;
+        counters[name] = count;
+        lines.push_back(name + ':' + format_value(delta) + "|c");
+    }
+    _counters.swap(counters);
+    return lines;
+}
+
+int ant::Statsd_exporter::push()
+{
+    std::vector<std::string> lines = format(_registry.collect());
+    int datagrams = 0;
+    std::string datagram;
+    for (size_t i = 0; i <= lines.size(); ++i) {
+        if (i < lines.size() && (datagram.empty() || datagram.size() + 1 + lines[i].size() <= EDatagramSize)) {
+            if (!datagram.empty())
+                datagram += '\n';
+            datagram += lines[i];
+            continue;
+        }
+        if (!datagram.empty()) {
+            // nobody listening is an ICMP error on the next send, the daemon may come later
+            if (send(_fd, datagram.data(), datagram.size(), MSG_DONTWAIT) < 0)
+                LOG(Log::EDebug, Log::ENet, "statsd: %s(%d)\n", strerror(errno), errno)
+            else
+                ++datagrams;
+        }
+        datagram.clear();
+        if (i < lines.size())
+            datagram = lines[i];
+    }
+    return datagrams;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include "histogram.h"
+#include "thread_util.h"
+
+namespace ant {
+
+    typedef std::vector<std::pair<std::string, std::string>> Metric_labels;
+
+    // A metric of one label set at the moment of collection.
+    struct Metric {
+        enum Type {
+            ECounter = 1,
+            EGauge = 2,
+            EHistogram = 3      // microseconds, exported as quantiles
+        };
+        enum {
+            EQuantiles = 4
+        };
+        static const double quantiles[EQuantiles];     // 0.5, 0.99, 0.999 and 1 for max
+
+        Type type;
+        std::string name;
+        std::string help;
+        Metric_labels labels;
+        double value;           // counters and gauges
+        uint64_t count;         // histograms, count and sum are cumulative
+        uint64_t sum_us;
+        uint64_t quantile_us[EQuantiles];   // of the recent values if the histogram comes from a Latency_recorder
+    };
+
+    // Receives the metrics of a collection.
+    class Metrics_sink
+    {
+    public:
+        void counter(const char *name, const char *help, Metric_labels const& labels, double value);
+        void gauge(const char *name, const char *help, Metric_labels const& labels, double value);
+        void histogram(const char *name, const char *help, Metric_labels const& labels,
+                       Latency_histogram const& histogram);
+        // the count and sum since the start, the quantiles of Latency_recorder::window()
+        void histogram(const char *name, const char *help, Metric_labels const& labels, Latency_recorder& recorder);
+        // CPU time, iterations and busy ratio of a loop thread, labelled by its name
+        void thread(Thread_stats const& stats);
+
+        std::vector<Metric>& metrics() { return _metrics; }
+
+    private:
+        Metric& add(Metric::Type type, const char *name, const char *help, Metric_labels const& labels);
+
+        std::vector<Metric> _metrics;
+    };
+
+    // Metrics are pulled: collectors read the statistics libant keeps anyway, and run only when an exporter
+    // scrapes or pushes, so there is no cost without exporters. Thread safe, a collector is removed after
+    // a running collection.
+    class Metrics_registry
+    {
+    public:
+        typedef std::function<void(Metrics_sink&)> Collector;
+
+        Metrics_registry() : _next_id(1) {}
+
+        // return the id for remove()
+        int add(Collector const& collector);
+        void remove(int id);
+        std::vector<Metric> collect() const;
+
+        // text exposition format 0.0.4, histograms are summaries in seconds
+        static std::string prometheus_text(std::vector<Metric> const& metrics);
+
+    private:
+        mutable std::mutex _mt;
+        std::map<int, Collector> _collectors;
+        int _next_id;
+    };
+
+    // Serves GET /metrics in the Prometheus text format from the thread "ant-metrics".
+    class Prometheus_exporter
+    {
+    public:
+        explicit Prometheus_exporter(Metrics_registry& registry);
+        ~Prometheus_exporter();
+
+        Prometheus_exporter(Prometheus_exporter const&) = delete;
+        Prometheus_exporter& operator=(Prometheus_exporter const&) = delete;
+
+        // listens on the address, port 0 picks one
+        // return 0 if success or system error code
+        int start(sockaddr_storage const& addr);
+        void stop();
+        sockaddr_storage address() const { return _addr; }
+
+    private:
+        void thread_proc();
+        void serve(int fd);
+
+        Metrics_registry& _registry;
+        int _fd;
+        sockaddr_storage _addr;
+        std::thread _thread;
+        std::atomic<bool> _stop;
+    };
+
+    // Pushes the metrics to a StatsD daemon over UDP from the thread "ant-statsd".
+    // Counters go as increments since the previous push, gauges and histogram quantiles (in ms) as gauges.
+    class Statsd_exporter
+    {
+    public:
+        enum {
+            EDatagramSize = 1400    // lines are packed up to this size
+        };
+
+        explicit Statsd_exporter(Metrics_registry& registry, std::string const& prefix = "ant");
+        ~Statsd_exporter();
+
+        Statsd_exporter(Statsd_exporter const&) = delete;
+        Statsd_exporter& operator=(Statsd_exporter const&) = delete;
+
+        // return 0 if success or system error code
+        int start(sockaddr_storage const& to, int interval_ms = 10000);
+        void stop();
+        // collects and sends now, return the number of datagrams sent
+        int push();
+        // the lines of a collection, keeps the counter values for the next increments
+        std::vector<std::string> format(std::vector<Metric> const& metrics);
+
+    private:
+        void thread_proc(int interval_ms);
+        std::string key(Metric const& metric) const;
+
+        Metrics_registry& _registry;
+        std::string _prefix;
+        int _fd;
+        std::thread _thread;
+        std::mutex _mt;
+        std::condition_variable _wakeup;
+        bool _stop;
+        std::mutex _counters_mt;
+        std::map<std::string, double> _counters;    // the last pushed values of the last collection
+    };
+
+}
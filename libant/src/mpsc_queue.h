@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+// Lock-free multi-producer single-consumer queue (D. Vyukov's node based algorithm).
+// push() can be called from any thread; try_pop(), drain(), clear() and empty() from the consumer thread only.
+// Item must be default constructible and movable.
+// Nodes are recycled: the consumer puts the nodes it is done with on a free stack, a producer takes the whole
+// stack at once into a cache of its thread, so a steady flow of items doesn't allocate.
+template<typename Item>
+class mpsc_queue
+{
+private:
+  struct node
+  {
+    std::atomic<node*> next;    // the link of the queue, of the free stack or of a thread cache
+    Item item;
+
+    node() : next(nullptr) {}
+  };
+
+  // free nodes of the producer thread, they can come from any queue of Item
+  struct node_cache
+  {
+    node* head;
+
+    node_cache() : head(nullptr) {}
+    ~node_cache()
+    {
+      while (head) {
+        node* n = head;
+        head = n->next.load(std::memory_order_relaxed);
+        delete_node(n);
+      }
+    }
+  };
+  static thread_local node_cache _cache;
+  static std::atomic<size_t> _allocated;
+
+  // producers append to the head, the consumer takes from the tail
+  std::atomic<node*> _head;
+  node* _tail;
+  // pushed by the consumer only, taken by producers with exchange(), so it has no ABA problem
+  std::atomic<node*> _free;
+
+  static node* new_node()
+  {
+    _allocated.fetch_add(1, std::memory_order_relaxed);
+    return new node();
+  }
+
+  static void delete_node(node* n)
+  {
+    _allocated.fetch_sub(1, std::memory_order_relaxed);
+    delete n;
+  }
+
+  node* acquire_node()
+  {
+    node* n = _cache.head;
+    if (!n)
+      n = _free.exchange(nullptr, std::memory_order_acquire);
+    if (!n)
+      return new_node();
+    _cache.head = n->next.load(std::memory_order_relaxed);
+    n->next.store(nullptr, std::memory_order_relaxed);
+    return n;
+  }
+
+  // the item of n is empty
+  void release_node(node* n)
+  {
+    node* head = _free.load(std::memory_order_relaxed);
+    do {
+      n->next.store(head, std::memory_order_relaxed);
+    } while (!_free.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+public:
+  mpsc_queue()
+    : _free(nullptr)
+  {
+    node* stub = new_node();
+    _head.store(stub, std::memory_order_relaxed);
+    _tail = stub;
+  }
+
+  ~mpsc_queue()
+  {
+    clear();
+    delete_node(_tail);
+    node* n = _free.exchange(nullptr, std::memory_order_acquire);
+    while (n) {
+      node* next = n->next.load(std::memory_order_relaxed);
+      delete_node(n);
+      n = next;
+    }
+  }
+
+  mpsc_queue(mpsc_queue const&) = delete;
+  mpsc_queue& operator=(mpsc_queue const&) = delete;
+
+  void push(Item item)
+  {
+    node* n = acquire_node();
+    n->item = std::move(item);
+    node* prev = _head.exchange(n, std::memory_order_acq_rel);
+    // a consumer doesn't see the item until the link is stored
+    prev->next.store(n, std::memory_order_release);
+  }
+
+  bool empty() const
+  {
+    return _tail->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+  bool try_pop(Item& item)
+  {
+    node* tail = _tail;
+    node* next = tail->next.load(std::memory_order_acquire);
+    if (!next)
+      return false;
+
+    // next becomes the new stub
+    item = std::move(next->item);
+    next->item = Item();
+    _tail = next;
+    release_node(tail);
+    return true;
+  }
+
+  // moves all available items to the end of batch, returns the number of moved items
+  size_t drain(std::vector<Item>& batch)
+  {
+    size_t count = 0;
+    Item item;
+    while (try_pop(item)) {
+      batch.push_back(std::move(item));
+      ++count;
+    }
+    return count;
+  }
+
+  void clear()
+  {
+    Item item;
+    while (try_pop(item))
+      item = Item();
+  }
+
+  // nodes of all queues of Item, in queues, free stacks and thread caches
+  static size_t allocated()
+  {
+    return _allocated.load(std::memory_order_relaxed);
+  }
+};
+
+template<typename Item>
+thread_local typename mpsc_queue<Item>::node_cache mpsc_queue<Item>::_cache;
+
+template<typename Item>
+std::atomic<size_t> mpsc_queue<Item>::_allocated(0);
@@ -6,7 +6,14 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <netinet/udp.h>
+#ifdef __linux__
+#    include <sys/eventfd.h>
+#    include <linux/errqueue.h>
+#    include <linux/net_tstamp.h>
+#endif
 #include <functional>
+#include <future>
 #include "network.h"
 #include "logger.h"
 #include "utils.hpp"
@@ -14,6 +21,9 @@
 #include <random>
 #include <ctime>
 #ifdef ANT_UNIT_TESTS
+# include <atomic>
+# include <sys/resource.h>
+# include "multithread_queue.h"
 # include <gtest/gtest.h>
 #endif
 
@@ -21,6 +31,22 @@
 #    include <ifaddrs.h>
 #endif
 
+#ifdef __linux__
+#    ifndef SOL_UDP
+#        define SOL_UDP 17
+#    endif
+#    ifndef UDP_SEGMENT
+#        define UDP_SEGMENT 103
+#    endif
+#    ifndef UDP_GRO
+#        define UDP_GRO 104
+#    endif
+#    include <linux/filter.h>
+#    ifndef SO_ATTACH_REUSEPORT_CBPF
+#        define SO_ATTACH_REUSEPORT_CBPF 51
+#    endif
+#endif
+
 #ifdef ANT_UNIT_TESTS
 namespace ant {
 
@@ -206,17 +232,792 @@ TEST(Network, ipAddrChecking)
     close(s2);
 }
 
+struct Loopback_events : public Net_events
+{
+    std::atomic<int> ticks{0};
+    std::atomic<int> received{0};
+    std::atomic<int> batches{0};
+    std::atomic<int> stamped{0};
+    std::atomic<bool> started{false};
+
+    void on_network_lost() override {}
+    void tick() override { ++ticks; }
+    void network_start() override { started = true; }
+    void network_stop() override {}
+    void recvfrom(Protocol proto, const uint8_t *buffer, size_t buffer_len, const sockaddr_storage *from,
+                  socklen_t addr_len, int recv_socket, int ant_socket) override {
+        if (buffer_len == 5 && !memcmp(buffer, "hello", 5))
+            ++received;
+    }
+    void recvfrom_batch(Protocol proto, const Datagram *datagrams, size_t count, int recv_socket, int ant_socket) override {
+        ++batches;
+        for (size_t i = 0; i < count; ++i)
+            if (datagrams[i].rx_time_ns)
+                ++stamped;
+        Net_events::recvfrom_batch(proto, datagrams, count, recv_socket, ant_socket);
+    }
+    void on_network_error(const sockaddr_storage *from, int errcode) override {}
+    void handle_icmp(int sock) override {}
+};
+
+TEST(Network, loopback)
+{
+    Loopback_events events;
+    Network net(&events);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+
+    std::atomic<int> calls{0};
+    for (int i = 0; i < 100; ++i)
+        net.do_asynch([&calls]() { ++calls; });
+
+    for (int i = 0; i < 100 && !events.started; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_TRUE(events.started);
+    sockaddr_storage bound = net.getbindaddr();
+    ASSERT_NE(get_port(bound), 0);
+
+    int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    for (int i = 0; i < 10; ++i)
+        ::sendto(s, "hello", 5, 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    close(s);
+
+    // send to itself
+    std::vector<Datagram> out(200, Datagram{(const uint8_t *) "hello", 5, bound, 0, 0, 0});
+    EXPECT_EQ(net.send_batch(out.data(), out.size()), 200);
+    EXPECT_EQ(net.sendto((const uint8_t *) "hello", 5, bound), 1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    EXPECT_EQ(calls, 100);
+    Network::Async_stats stats = net.async_stats();
+    EXPECT_EQ(stats.tasks, 100u);
+    EXPECT_GE(stats.signals, 1u);
+    EXPECT_LE(stats.signals, stats.tasks);
+    EXPECT_EQ(events.received, 211);
+    EXPECT_LT(events.batches, 211);
+#ifdef __linux__
+    // every datagram carries its kernel arrival time
+    EXPECT_EQ(events.stamped, 211);
+    Latency_histogram delay = net.rx_delay();
+    EXPECT_EQ(delay.count(), 211u);
+    EXPECT_LT(delay.min(), 1000000u);
+    net.clear_rx_delay();
+    EXPECT_EQ(net.rx_delay().count(), 0u);
+#endif
+    EXPECT_GE(events.ticks, 1);
+    EXPECT_LE(events.ticks, 3);
+
+    net.stop();
+}
+
+TEST(Network, io_uring)
+{
+    Loopback_events events;
+    Network net(&events);
+    net.set_io_uring(true);
+    net.set_socket_buffers(1 << 20, 0);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+    // either backend keeps the Net_events contract
+    if (!net.io_uring_enabled())
+        std::cerr << "io_uring is unavailable, epoll is tested" << std::endl;
+
+    std::atomic<int> calls{0};
+    for (int i = 0; i < 100; ++i)
+        net.do_asynch([&calls]() { ++calls; });
+
+    sockaddr_storage bound = net.getbindaddr();
+    int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    for (int i = 0; i < 10; ++i)
+        ::sendto(s, "hello", 5, 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    close(s);
+    // more than the ring holds
+    std::vector<Datagram> out(300, Datagram{(const uint8_t *) "hello", 5, bound, 0, 0, 0});
+    EXPECT_EQ(net.send_batch(out.data(), out.size()), 300);
+
+    for (int i = 0; i < 100 && (events.received < 310 || calls < 100); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(calls, 100);
+    EXPECT_EQ(events.received, 310);
+    EXPECT_LT(events.batches, 310);
+#ifdef __linux__
+    EXPECT_EQ(events.stamped, 310);
+#endif
+
+    net.stop();
+}
+
+struct Demux_events : public Loopback_events
+{
+    std::atomic<int> kademlia{0};
+    std::atomic<int> utp{0};
+    std::atomic<int> other{0};
+
+    void recvfrom_batch(Protocol proto, const Datagram *datagrams, size_t count, int recv_socket, int ant_socket) override {
+        for (size_t i = 0; i < count; ++i) {
+            EXPECT_EQ(proto, Network::classify(datagrams[i].buffer, datagrams[i].buffer_len));
+            if (proto == EKademlia)
+                ++kademlia;
+            else if (proto == EUtp)
+                ++utp;
+            else
+                ++other;
+        }
+    }
+};
+
+static void check_srt_demux(bool uring)
+{
+    Demux_events events;
+    Network net(&events);
+    net.set_srt_demux(true);
+    net.set_io_uring(uring);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+    sockaddr_storage bound = net.getbindaddr();
+
+    // plays the SRT listener
+    int srt = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_storage srt_addr = sa;
+    ASSERT_EQ(::bind(srt, (sockaddr *) &srt_addr, sizeof(sockaddr_in)), 0);
+    socklen_t len = sizeof(srt_addr);
+    getsockname(srt, (sockaddr *) &srt_addr, &len);
+    net.set_srt_listener(srt_addr);
+    timeval tv = {1, 0};
+    setsockopt(srt, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    int remote = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ::bind(remote, (sockaddr *) &sa, sizeof(sockaddr_in));
+    sockaddr_storage remote_addr;
+    len = sizeof(remote_addr);
+    getsockname(remote, (sockaddr *) &remote_addr, &len);
+    setsockopt(remote, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint8_t induction[64];
+    memset(induction, 0, sizeof(induction));
+    induction[0] = 0x80;
+    const char ping[] = "d1:ad2:id20:abcdefghij0123456789e1:q4:ping1:t2:aa1:y1:qe";
+    uint8_t utp[20];
+    memset(utp, 0, sizeof(utp));
+    utp[0] = 0x41;  // ST_SYN
+    ::sendto(remote, ping, strlen(ping), 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    ::sendto(remote, induction, sizeof(induction), 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    ::sendto(remote, utp, sizeof(utp), 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    ::sendto(remote, "hello", 5, 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+
+    uint8_t buf[256];
+    sockaddr_storage relay;
+    len = sizeof(relay);
+    ASSERT_EQ(::recvfrom(srt, buf, sizeof(buf), 0, (sockaddr *) &relay, &len), (ssize_t) sizeof(induction));
+    EXPECT_EQ(buf[0], 0x80);
+    sockaddr_storage peer;
+    ASSERT_TRUE(net.srt_remote(relay, peer));
+    EXPECT_TRUE(sock_addr_cmp(&peer, &remote_addr));
+
+    // SRT answers with its socket id, the remote gets it from the shared port
+    uint8_t conclusion[64];
+    memset(conclusion, 0, sizeof(conclusion));
+    conclusion[0] = 0x80;
+    conclusion[43] = 42;
+    ::sendto(srt, conclusion, sizeof(conclusion), 0, (sockaddr *) &relay, sizeof(sockaddr_in));
+    sockaddr_storage from;
+    len = sizeof(from);
+    ASSERT_EQ(::recvfrom(remote, buf, sizeof(buf), 0, (sockaddr *) &from, &len), (ssize_t) sizeof(conclusion));
+    EXPECT_TRUE(sock_addr_cmp(&from, &bound));
+
+    // data packets for socket 42 go to SRT even if they look like Kademlia
+    uint8_t data[100];
+    memset(data, 0, sizeof(data));
+    data[0] = 'd';
+    data[15] = 42;
+    ::sendto(remote, data, sizeof(data), 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    ASSERT_EQ(::recvfrom(srt, buf, sizeof(buf), 0, nullptr, nullptr), (ssize_t) sizeof(data));
+
+    // SRT connecting to a remote talks to the relay of the remote
+    sockaddr_storage local;
+    ASSERT_EQ(net.srt_relay(remote_addr, local), 0);
+    EXPECT_TRUE(sock_addr_cmp(&local, &relay));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(events.kademlia, 1);
+    EXPECT_EQ(events.utp, 1);
+    EXPECT_EQ(events.other, 1);
+
+    net.stop();
+    close(srt);
+    close(remote);
+}
+
+TEST(Network, srt_demux)
+{
+    check_srt_demux(false);
+    check_srt_demux(true);
+}
+
+TEST(Network, bounded_async)
+{
+    Loopback_events events;
+    Network net(&events);
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+
+    // the loop is held until the gate opens
+    std::promise<void> open;
+    std::shared_future<void> gate = open.get_future().share();
+    std::promise<void> held;
+    net.do_asynch([gate, &held]() { held.set_value(); gate.wait(); });
+    held.get_future().wait();
+
+    net.set_async_limit(4, Network::EAsyncFailFast);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 4; ++i)
+        results.push_back(net.call([i]() { return i; }));
+    std::future<int> refused = net.call([]() { return -1; });
+    EXPECT_EQ(net.post([]() {}), EAGAIN);
+    Network::Async_stats stats = net.async_stats();
+    EXPECT_EQ(stats.rejected, 2u);
+    EXPECT_GE(stats.depth, 4u);
+
+    // the first call is pushed out
+    net.set_async_limit(4, Network::EAsyncDropOldest);
+    results.push_back(net.call([]() { return 4; }));
+    EXPECT_EQ(net.async_stats().dropped, 1u);
+
+    net.set_async_limit(4, Network::EAsyncBlock);
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(net.post([]() {}, 50), EAGAIN);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    std::future<int> waiting = std::async(std::launch::async, [&net]() { return net.post([]() {}); });
+    EXPECT_EQ(waiting.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+
+    // events aren't dropped, they wait for room in their own lane and keep their order
+    net.set_async_limit(4, Network::EAsyncDropOldest);
+    std::vector<int> events_run;
+    for (int i = 0; i < 4; ++i) {
+        Task event([&events_run, i]() { events_run.push_back(i); });
+        EXPECT_EQ(net.post_event(7, event, 0), 0);
+    }
+    Task data([&events_run]() { events_run.push_back(4); });
+    EXPECT_EQ(net.post_event(7, data, 20), EAGAIN);
+    EXPECT_TRUE(bool(data));
+    std::future<int> waiting_data = std::async(std::launch::async, [&net, &data]() { return net.post_event(7, data, -1); });
+    EXPECT_EQ(waiting_data.wait_for(std::chrono::milliseconds(20)), std::future_status::timeout);
+    EXPECT_EQ(net.async_stats().dropped, 1u);
+    open.set_value();
+    EXPECT_EQ(waiting.get(), 0);
+    EXPECT_EQ(waiting_data.get(), 0);
+    EXPECT_GE(net.async_stats().event_waits, 2u);
+
+    EXPECT_THROW(refused.get(), std::future_error);
+    EXPECT_THROW(results[0].get(), std::future_error);
+    for (int i = 1; i < 5; ++i)
+        EXPECT_EQ(results[i].get(), i);
+    std::future<int> failed = net.call([]() -> int { throw std::runtime_error("failed"); });
+    EXPECT_THROW(failed.get(), std::runtime_error);
+
+    EXPECT_EQ(net.call([]() { return 0; }).get(), 0);
+    EXPECT_EQ(events_run, std::vector<int>({0, 1, 2, 3, 4}));
+    stats = net.async_stats();
+    EXPECT_EQ(stats.depth, 0u);
+    Latency_histogram delay = net.async_delay();
+    EXPECT_GE(delay.count(), 8u);
+    // queued behind the gate for 70 ms at least
+    EXPECT_GE(delay.max(), 70000u);
+
+    // a new interval doesn't take the samples of the exporters
+    net.clear_async_delay();
+    EXPECT_EQ(net.async_delay().count(), 0u);
+    Metrics_sink sink;
+    net.collect_metrics(sink);
+    bool rejected = false, thread = false, delays = false;
+    for (Metric const& metric: sink.metrics()) {
+        if (metric.name == "ant_net_async_delay_seconds")
+            delays = metric.count == delay.count();
+        if (metric.name == "ant_net_async_rejected_total")
+            rejected = metric.value == 3;   // and the timed out post()
+        if (metric.name == "ant_thread_iterations_total")
+            thread = metric.labels[0].second == "ant-net" && metric.value > 0;
+    }
+    EXPECT_TRUE(rejected);
+    EXPECT_TRUE(thread);
+    EXPECT_TRUE(delays);
+
+    net.stop();
+    EXPECT_EQ(net.post([]() {}), ECANCELED);
+
+    // the queues take tasks again after a restart
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+    EXPECT_EQ(net.call([]() { return 5; }).get(), 5);
+    Task event([]() {});
+    EXPECT_EQ(net.post_event(7, event, -1), 0);
+    net.stop();
+}
+
+TEST(Network, latency_mode)
+{
+    Loopback_events events;
+    Network net(&events);
+    Latency_mode mode;
+    mode.spin_us = 100000;
+    mode.busy_poll_us = 50;
+    net.set_latency_mode(mode);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+
+    // the loop is spinning after the task, then it blocks again
+    std::atomic<int> calls{0};
+    net.do_asynch([&calls]() { ++calls; });
+    while (!calls)
+        std::this_thread::yield();
+    uint64_t iterations = net.thread_stats().iterations;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_GT(net.thread_stats().iterations - iterations, 100u);
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    iterations = net.thread_stats().iterations;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_LT(net.thread_stats().iterations - iterations, 3u);
+
+    sockaddr_storage bound = net.getbindaddr();
+    int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    for (int i = 0; i < 10; ++i) {
+        ::sendto(s, "hello", 5, 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+        std::this_thread::sleep_for(std::chrono::milliseconds(i < 5 ? 1 : 150));
+    }
+    close(s);
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(events.received, 10);
+    // spinning keeps the thread on the CPU between the datagrams
+    Thread_stats loop = net.thread_stats();
+    EXPECT_STREQ(loop.name, "ant-net");
+    EXPECT_GT(loop.iterations, 100u);
+    EXPECT_GT(loop.cpu_ns, 0u);
+    EXPECT_GT(loop.busy_ratio(), 0);
+
+    net.stop();
+}
+
+#ifdef __linux__
+// compares the loop backends, run with --gtest_also_run_disabled_tests
+TEST(Network, DISABLED_backend_benchmark)
+{
+    struct Counting_events : public Loopback_events {
+        std::atomic<uint64_t> datagrams{0};
+        void recvfrom_batch(Protocol proto, const Datagram *datagrams_, size_t count, int recv_socket, int ant_socket) override {
+            datagrams += count;
+        }
+    };
+
+    enum { EDatagrams = 1000000, EBatch = 64 };
+    for (bool uring: {false, true}) {
+        Counting_events events;
+        Network net(&events);
+        net.set_io_uring(uring);
+        net.set_socket_buffers(8 << 20, 0);
+
+        sockaddr_storage sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.ss_family = AF_INET;
+        SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(net.start(sa), 0);
+        ASSERT_EQ(net.wait_started(1000), 0);
+        sockaddr_storage bound = net.getbindaddr();
+
+        uint8_t payload[64] = {0};
+        std::vector<mmsghdr> msgs(EBatch);
+        std::vector<iovec> iov(EBatch);
+        for (int i = 0; i < EBatch; ++i) {
+            iov[i] = {payload, sizeof(payload)};
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &bound;
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        rusage usage_start, usage_stop;
+        getrusage(RUSAGE_SELF, &usage_start);
+        auto start = std::chrono::steady_clock::now();
+
+        int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        for (int sent = 0; sent < EDatagrams; ) {
+            int rc = sendmmsg(s, msgs.data(), EBatch, 0);
+            if (rc > 0)
+                sent += rc;
+        }
+        close(s);
+        uint64_t last = 0;
+        do {
+            last = events.datagrams;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        } while (events.datagrams != last);
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        getrusage(RUSAGE_SELF, &usage_stop);
+        double cpu_us = (usage_stop.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) * 1e6
+            + (usage_stop.ru_utime.tv_usec - usage_start.ru_utime.tv_usec)
+            + (usage_stop.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) * 1e6
+            + (usage_stop.ru_stime.tv_usec - usage_start.ru_stime.tv_usec);
+        uint64_t received = events.datagrams;
+        bool uring_enabled = net.io_uring_enabled();
+        net.stop();
+        printf("%s: received %llu of %d datagrams, %.0f kpps, CPU %.3f us per datagram (sender included), "
+            "%.4f waits and %.4f io_uring_enter() per datagram\n",
+            uring_enabled ? "io_uring" : "epoll", (unsigned long long) received, (int) EDatagrams,
+            received / (elapsed.count() / 1e6) / 1000, received ? cpu_us / received : 0,
+            received ? (double) net.loop_waits() / received : 0, received ? (double) net.loop_enters() / received : 0);
+    }
+}
+#endif
+
+TEST(Network, timers)
+{
+    Loopback_events events;
+    Network net(&events);
+
+    std::atomic<int> once{0}, every{0}, cancelled{0};
+    // scheduled before the loop is running
+    net.schedule_after(20, [&once]() { ++once; });
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+
+    Timer_id periodic = net.schedule_every(50, [&every]() { ++every; });
+    Timer_id never = net.schedule_after(100, [&cancelled]() { ++cancelled; });
+    net.cancel(never);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(280));
+    net.cancel(periodic);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(once, 1);
+    EXPECT_GE(every, 4);
+    EXPECT_LE(every, 6);
+    EXPECT_EQ(cancelled, 0);
+
+    net.stop();
+}
+
+TEST(Network, socket_buffers)
+{
+    Loopback_events events;
+    Network net(&events);
+    net.set_socket_buffers(8192, 0, 1 << 20);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+    Network::Socket_stats before = net.socket_stats();
+    EXPECT_GT(before.rcvbuf, 0);
+    EXPECT_LT(before.rcvbuf, 65536);
+
+    // the loop is busy while a burst overflows the receive buffer
+    net.do_asynch([]() { std::this_thread::sleep_for(std::chrono::milliseconds(200)); });
+    sockaddr_storage bound = net.getbindaddr();
+    int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    char payload[1000] = "hello";
+    for (int i = 0; i < 200; ++i)
+        ::sendto(s, payload, sizeof(payload), 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    // the drop counter arrives with the next datagram queued after the drops
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    ::sendto(s, payload, sizeof(payload), 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+    close(s);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(700));
+    Network::Socket_stats after = net.socket_stats();
+#ifdef SO_RXQ_OVFL
+    EXPECT_GT(after.rx_dropped, 0u);
+    EXPECT_GT(after.rcvbuf, before.rcvbuf);
+#endif
+
+    net.stop();
+}
+
+TEST(Network, find_interface_async)
+{
+    Loopback_events events;
+    Network net(&events);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(net.start(sa), 0);
+    ASSERT_EQ(net.wait_started(1000), 0);
+
+    std::promise<int> result;
+    std::thread::id cb_thread;
+    net.find_interface_async("localhost", 6881, [&](int error, sockaddr_storage const& local_addr) {
+        cb_thread = std::this_thread::get_id();
+        result.set_value(error ? -1 : local_addr.ss_family);
+    });
+    std::future<int> family = result.get_future();
+    ASSERT_EQ(family.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    int f = family.get();
+    EXPECT_TRUE(f == AF_INET || f == AF_INET6);
+    EXPECT_NE(cb_thread, std::this_thread::get_id());
+
+    net.stop();
+}
+
+struct Counting_events : public Loopback_events
+{
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> datagrams{0};
+
+    void recvfrom_batch(Protocol proto, const Datagram *dgrams, size_t count, int recv_socket, int ant_socket) override {
+        for (size_t i = 0; i < count; ++i)
+            bytes += dgrams[i].buffer_len;
+        datagrams += count;
+    }
+};
+
+static double cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+TEST(Mpsc_queue, producers)
+{
+    const int producers = 4;
+    const int items = 10000;
+    mpsc_queue<std::unique_ptr<int>> queue;
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < items; ++i)
+                queue.push(std::unique_ptr<int>(new int(p * items + i)));
+        });
+
+    // items of one producer keep their order
+    std::vector<int> last(producers, -1);
+    std::vector<std::unique_ptr<int>> batch;
+    int received = 0;
+    while (received < producers * items) {
+        received += queue.drain(batch);
+        for (auto const& item: batch) {
+            int p = *item / items;
+            ASSERT_LT(last[p], *item);
+            last[p] = *item;
+        }
+        batch.clear();
+    }
+    for (auto &t: threads)
+        t.join();
+    EXPECT_TRUE(queue.empty());
+
+    queue.push(std::unique_ptr<int>(new int(1)));
+    queue.clear();
+    std::unique_ptr<int> item;
+    EXPECT_FALSE(queue.try_pop(item));
+}
+
+TEST(Mpsc_queue, recycling)
+{
+    mpsc_queue<std::unique_ptr<int>> queue;
+    std::vector<std::unique_ptr<int>> batch;
+    for (int i = 0; i < 100; ++i)
+        queue.push(std::unique_ptr<int>(new int(i)));
+    EXPECT_EQ(queue.drain(batch), 100u);
+    size_t nodes = mpsc_queue<std::unique_ptr<int>>::allocated();
+
+    // the drained nodes are reused
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 100; ++i)
+            queue.push(std::unique_ptr<int>(new int(i)));
+        batch.clear();
+        EXPECT_EQ(queue.drain(batch), 100u);
+    }
+    EXPECT_EQ(mpsc_queue<std::unique_ptr<int>>::allocated(), nodes);
+}
+
+template<typename Queue>
+static double queue_benchmark(Queue& queue, int producers, int items)
+{
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p)
+        threads.emplace_back([&]() {
+            while (!go);
+            for (int i = 0; i < items; ++i)
+                queue.push(std::function<void()>([]() {}));
+        });
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    int received = 0;
+    std::function<void()> f;
+    while (received < producers * items) {
+        if (queue.try_pop(f)) {
+            f();
+            ++received;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto &t: threads)
+        t.join();
+    return received / seconds;
+}
+
+// run with --gtest_also_run_disabled_tests
+TEST(Mpsc_queue, DISABLED_contention_benchmark)
+{
+    for (int producers: {1, 2, 4, 8}) {
+        multithread_queue<std::function<void()>> locked;
+        mpsc_queue<std::function<void()>> lock_free;
+        double locked_rate = queue_benchmark(locked, producers, 200000);
+        double lock_free_rate = queue_benchmark(lock_free, producers, 200000);
+        printf("%d producers: multithread_queue %.2f M/s, mpsc_queue %.2f M/s\n",
+               producers, locked_rate / 1e6, lock_free_rate / 1e6);
+    }
+}
+
+// mode: 0 - sendto() per datagram, 1 - send_batch(), 2 - send_segmented()
+static void offload_benchmark(const char *name, int mode, bool offload)
+{
+    const size_t segment_size = 1400;
+    const size_t segments = 44;
+    const uint64_t total_bytes = 256 * 1024 * 1024;
+
+    Counting_events rx_events;
+    Network rx(&rx_events);
+    Network tx(nullptr);
+    rx.set_offload(false, offload);
+    tx.set_offload(offload, false);
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(rx.start(sa), 0);
+    ASSERT_EQ(tx.start(sa), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    sockaddr_storage to = rx.getbindaddr();
+
+    std::vector<uint8_t> buffer(segment_size * segments, 'x');
+    std::vector<Datagram> batch;
+    for (size_t i = 0; i < segments; ++i)
+        batch.push_back({buffer.data() + i * segment_size, segment_size, to, 0});
+
+    double cpu = cpu_seconds();
+    auto wall = std::chrono::steady_clock::now();
+    uint64_t sent_bytes = 0;
+    while (sent_bytes < total_bytes) {
+        int rc = 0;
+        if (mode == 0) {
+            for (auto const& dgram: batch)
+                rc += std::max(0, tx.sendto(dgram.buffer, dgram.buffer_len, to));
+        } else if (mode == 1) {
+            rc = tx.send_batch(batch.data(), batch.size());
+        } else {
+            rc = tx.send_segmented(buffer.data(), buffer.size(), segment_size, to);
+        }
+        if (rc <= 0)
+            std::this_thread::yield();
+        else
+            sent_bytes += rc * segment_size;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count() - 0.1;
+    cpu = cpu_seconds() - cpu;
+
+    double gbits = sent_bytes * 8 / 1e9;
+    printf("%-16s gso:%d gro:%d sent %6.1f MB, received %6.1f MB, %7.0f Mbps, CPU %.3f s per Gbit\n",
+           name, tx.gso_enabled(), rx.gro_enabled(), sent_bytes / 1e6, rx_events.bytes / 1e6,
+           gbits * 1000 / wall_s, cpu / gbits);
+    EXPECT_GT(rx_events.datagrams, 0u);
+
+    tx.stop();
+    rx.stop();
+}
+
+// run with --gtest_also_run_disabled_tests
+TEST(Network, DISABLED_offload_benchmark)
+{
+    offload_benchmark("sendto", 0, false);
+    offload_benchmark("sendmmsg", 1, false);
+    offload_benchmark("sendmmsg+GRO", 1, true);
+    offload_benchmark("GSO+GRO", 2, true);
+}
+
 }
 #endif
 
+// counts a sender while it uses the socket
+struct Send_scope {
+	std::atomic<int>& senders;
+
+	explicit Send_scope(std::atomic<int>& a_senders) : senders(a_senders) { ++senders; }
+	~Send_scope() { --senders; }
+};
+
 ant::Network::Network(Net_events* a_events)
     : is_break_loop(false)
 	, net_thread(nullptr)
 	, _events(a_events)
     , _net_error(0)
+    , _wakeup_pending(false)
+    , _tasks_posted(0)
+    , _wakeup_signals(0)
+    , _tasks_run(0)
     , _sock(-1)
+    , _senders(0)
+    , _batch_size(EBatchSize)
+    , _slot_size(EBatchSlotSize)
+    , _use_gso(false)
+    , _use_gro(false)
+    , _gso(false)
+    , _gro(false)
+    , _use_uring(false)
+    , _uring(false)
+    , _reuseport(false)
+    , _srt_demux(false)
+    , _steering_shards(0)
+    , _rcvbuf_req(0)
+    , _sndbuf_req(0)
+    , _buf_max(0)
+    , _rcvbuf(0)
+    , _sndbuf(0)
+    , _rx_dropped(0)
+    , _tx_blocked(0)
+    , _rx_dropped_seen(0)
+    , _tx_blocked_seen(0)
+    , _next_timer_id(1)
+    , _next_link_listener(1)
 {
     net_thread_pipe = {-1, -1};
+    memset(&_failover_target, 0, sizeof(_failover_target));
 }
 
 ant::Network::~Network()
@@ -236,6 +1037,22 @@ int ant::Network::start(sockaddr_storage const& net_interface) noexcept
 
     _net_error = 0;
 
+    is_break_loop = false;
+    _wakeup_pending = false;
+    // closed by the last stop()
+    _limited_queue.open();
+    _event_queue.open();
+
+#ifdef __linux__
+    // eventfd is used as both ends of the pipe
+    net_thread_pipe.rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (net_thread_pipe.rfd < 0) {
+        _net_error = errno;
+        LOG(Log::EError, Log::ENet, "syscall eventfd failed: %s(%d)\n", strerror(errno), errno);
+        return _net_error;
+    }
+    net_thread_pipe.wfd = net_thread_pipe.rfd;
+#else
     assert(sizeof(int) == 4);
     if (pipe(reinterpret_cast<int *>(&net_thread_pipe))) {
         _net_error = errno;
@@ -243,7 +1060,6 @@ int ant::Network::start(sockaddr_storage const& net_interface) noexcept
         return _net_error;
     }
 
-#ifndef __linux__
     int flags = fcntl(net_thread_pipe.wfd, F_GETFL, 0);
     if (fcntl(net_thread_pipe.wfd, F_SETFL, flags | F_SETNOSIGPIPE)) {
         _net_error = errno;
@@ -259,7 +1075,10 @@ int ant::Network::start(sockaddr_storage const& net_interface) noexcept
 
 void ant::Network::do_listen(int socket)
 {
-	_srt_proxies.insert(socket);
+	if (!_srt_proxies.insert(socket).second)
+		return;
+	_reactor.add(socket, Reactor::ERead, std::bind(&Network::on_srt_proxy_event, this,
+		std::placeholders::_1, std::placeholders::_2));
 }
 
 void ant::Network::asynch_start()
@@ -277,7 +1096,48 @@ void ant::Network::asynch_start()
 		return;
 	}
 
-    bind(_bind_addr);
+    if (bind(_bind_addr) == 0) {
+		if (_steering_shards > 1)
+			attach_steering();
+		// with epoll the socket is polled and on_socket_event() reads it
+		_reactor.add_receiver(_sock, _slot_size, EControlSize, 2 * _batch_size,
+			std::bind(&Network::on_socket_messages, this, std::placeholders::_1, std::placeholders::_2,
+				std::placeholders::_3),
+			std::bind(&Network::on_socket_event, this, std::placeholders::_1, std::placeholders::_2));
+	}
+}
+
+int ant::Network::attach_steering()
+{
+#ifdef __linux__
+	// the program sees the datagram payload, so headers are loaded by SKF_NET_OFF (no IPv4 options expected)
+	uint32_t saddr_off, sport_off;
+	if (_bind_addr.ss_family == AF_INET) {
+		saddr_off = 12;
+		sport_off = 20;
+	} else {
+		saddr_off = 20; // the last word of the IPv6 source address
+		sport_off = 40;
+	}
+	sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) SKF_NET_OFF + saddr_off },
+		{ BPF_MISC | BPF_TAX, 0, 0, 0 },
+		{ BPF_LD | BPF_H | BPF_ABS, 0, 0, (uint32_t) SKF_NET_OFF + sport_off },
+		{ BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0 },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t) _steering_shards },
+		{ BPF_RET | BPF_A, 0, 0, 0 }
+	};
+	sock_fprog prog = { (unsigned short) (sizeof(code) / sizeof(code[0])), code };
+	if (setsockopt(_sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+		int net_error = errno;
+		LOG(Log::EWarning, Log::ENet, "reuseport steering isn't available: %s(%d)\n", strerror(errno), errno)
+		return net_error;
+	}
+	LOG(Log::EInfo, Log::ENet, "socket(%d) steers flows to %d shards\n", _sock.load(), _steering_shards)
+	return 0;
+#else
+	return EOPNOTSUPP;
+#endif
 }
 
 int ant::Network::set_sock_opt()
@@ -304,6 +1164,12 @@ int ant::Network::set_sock_opt()
 		return _net_error;
 	}
 
+	if (_reuseport && setsockopt(_sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+		_net_error = errno;
+		LOG(Log::EError, Log::ENet, "syscall setsockopt failed: %s(%d)\n", strerror(errno), errno);
+		return _net_error;
+	}
+
 #ifdef __linux__
 	if (setsockopt(_sock, SOL_IP, IP_RECVERR, &opt, sizeof(opt)) != 0) {
         int net_error = errno;
@@ -312,18 +1178,193 @@ int ant::Network::set_sock_opt()
     }
 #endif
 
-	opt = 4096;
-	socklen_t opt_size = sizeof(opt);
-	::getsockopt(_sock, SOL_SOCKET, SO_RCVBUF, &opt, &opt_size);
-	LOG(Log::EInfo, Log::ENet, "socket(%d) RCVBUF is %d bytes\n", _sock, opt)
-	in_buf.reserve(opt);
+#ifdef SO_BUSY_POLL
+	if (_latency.busy_poll_us > 0) {
+		int usec = _latency.busy_poll_us;
+		if (setsockopt(_sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0)
+			LOG(Log::EWarning, Log::ENet, "syscall setsockopt(SO_BUSY_POLL) failed: %s(%d)\n", strerror(errno), errno)
+		// the loop reads after epoll without blocking, only epoll busy polls and it needs the sysctl
+		FILE *sysctl = fopen("/proc/sys/net/core/busy_poll", "r");
+		int busy_poll = 0;
+		if (sysctl) {
+			if (fscanf(sysctl, "%d", &busy_poll) != 1)
+				busy_poll = 0;
+			fclose(sysctl);
+		}
+		if (!busy_poll)
+			LOGS(Log::EWarning, Log::ENet, "SO_BUSY_POLL has no effect on the loop while net.core.busy_poll is 0\n")
+#ifdef SO_PREFER_BUSY_POLL
+		// the device interrupts stay masked while the loop keeps polling
+		setsockopt(_sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt, sizeof(opt));
+#endif
+	}
+#endif
 
-	::getsockopt(_sock, SOL_SOCKET, SO_SNDBUF, &opt, &opt_size);
-	LOG(Log::EInfo, Log::ENet, "socket(%d) SNDBUF is %d bytes\n", _sock, opt)
+#ifdef SO_RXQ_OVFL
+	// every received datagram carries the counter of drops
+	if (setsockopt(_sock, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt)) != 0)
+		LOG(Log::EWarning, Log::ENet, "syscall setsockopt(SO_RXQ_OVFL) failed: %s(%d)\n", strerror(errno), errno)
+#endif
+
+	_rcvbuf = set_buffer(SO_RCVBUF, _rcvbuf_req);
+	LOG(Log::EInfo, Log::ENet, "socket(%d) RCVBUF is %d bytes\n", _sock.load(), _rcvbuf.load())
+	_sndbuf = set_buffer(SO_SNDBUF, _sndbuf_req);
+	LOG(Log::EInfo, Log::ENet, "socket(%d) SNDBUF is %d bytes\n", _sock.load(), _sndbuf.load())
+	_rx_dropped = 0;
+	_rx_dropped_seen = 0;
 
+	set_offload_opt();
+	set_timestamp_opt();
 	return 0;
 }
 
+int ant::Network::set_buffer(int opt, int bytes)
+{
+	if (bytes > 0) {
+		int rc = -1;
+#if defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+		// the privileged option ignores net.core.rmem_max/wmem_max
+		rc = setsockopt(_sock, SOL_SOCKET, opt == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, &bytes, sizeof(bytes));
+#endif
+		if (rc != 0 && setsockopt(_sock, SOL_SOCKET, opt, &bytes, sizeof(bytes)) != 0)
+			LOG(Log::EWarning, Log::ENet, "socket(%d) buffer of %d bytes failed: %s(%d)\n", _sock.load(), bytes,
+				strerror(errno), errno)
+	}
+
+	int size = -1;
+	socklen_t size_len = sizeof(size);
+	::getsockopt(_sock, SOL_SOCKET, opt, &size, &size_len);
+	return size;
+}
+
+void ant::Network::autoscale_buffers()
+{
+	if (!_buf_max || _sock < 0)
+		return;
+
+	// Linux reports the doubled size, so the requested one is tracked separately
+	uint64_t dropped = _rx_dropped;
+	if (dropped > _rx_dropped_seen && _rcvbuf < _buf_max) {
+		_rcvbuf_req = std::min(std::max(_rcvbuf_req, 65536) * 2, _buf_max);
+		_rcvbuf = set_buffer(SO_RCVBUF, _rcvbuf_req);
+		LOG(Log::EInfo, Log::ENet, "socket(%d) dropped %llu datagrams, RCVBUF is %d bytes\n", _sock.load(),
+			(unsigned long long) (dropped - _rx_dropped_seen), _rcvbuf.load())
+	}
+	_rx_dropped_seen = dropped;
+
+	uint64_t blocked = _tx_blocked;
+	if (blocked > _tx_blocked_seen && _sndbuf < _buf_max) {
+		_sndbuf_req = std::min(std::max(_sndbuf_req, 65536) * 2, _buf_max);
+		_sndbuf = set_buffer(SO_SNDBUF, _sndbuf_req);
+		LOG(Log::EInfo, Log::ENet, "socket(%d) send queue was full %llu times, SNDBUF is %d bytes\n", _sock.load(),
+			(unsigned long long) (blocked - _tx_blocked_seen), _sndbuf.load())
+	}
+	_tx_blocked_seen = blocked;
+}
+
+void ant::Network::count_blocked_send()
+{
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+		_tx_blocked.fetch_add(1, std::memory_order_relaxed);
+}
+
+ant::Network::Socket_stats ant::Network::socket_stats() const
+{
+	Socket_stats stats;
+	stats.rx_dropped = _rx_dropped.load(std::memory_order_relaxed);
+	stats.tx_blocked = _tx_blocked.load(std::memory_order_relaxed);
+	stats.rcvbuf = _rcvbuf.load(std::memory_order_relaxed);
+	stats.sndbuf = _sndbuf.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void ant::Network::collect_metrics(Metrics_sink& sink) const
+{
+	Metric_labels labels;
+	Async_stats async = async_stats();
+	sink.counter("ant_net_async_tasks_total", "Tasks queued to the network loop", labels, async.tasks);
+	sink.counter("ant_net_async_signals_total", "Wakeups written to the network loop", labels, async.signals);
+	sink.gauge("ant_net_async_depth", "Queued tasks which haven't run yet", labels, async.depth);
+	sink.counter("ant_net_async_rejected_total", "Tasks refused by a full queue", labels, async.rejected);
+	sink.counter("ant_net_async_dropped_total", "Tasks pushed out of a full queue", labels, async.dropped);
+	sink.counter("ant_net_async_event_waits_total", "Connection events which waited for room", labels,
+		async.event_waits);
+	{
+		std::lock_guard<std::mutex> lock(_async_delay_mt);
+		sink.histogram("ant_net_async_delay_seconds", "Delay from queueing a task to its run", labels,
+			_async_delay);
+	}
+
+	Socket_stats socket = socket_stats();
+	sink.counter("ant_net_rx_dropped_total", "Datagrams dropped by the kernel for the lack of receive buffer",
+		labels, socket.rx_dropped);
+	sink.counter("ant_net_tx_blocked_total", "Sends failed with a full send queue", labels, socket.tx_blocked);
+	sink.gauge("ant_net_rcvbuf_bytes", "Receive buffer of the socket", labels, socket.rcvbuf);
+	sink.gauge("ant_net_sndbuf_bytes", "Send buffer of the socket", labels, socket.sndbuf);
+	{
+		std::lock_guard<std::mutex> lock(_rx_delay_mt);
+		sink.histogram("ant_net_rx_delay_seconds", "Delay from the kernel arrival of a datagram to its callback",
+			labels, _rx_delay);
+	}
+	sink.gauge("ant_net_srt_relays", "Relay sockets of the SRT demultiplexer", labels, _relay.size());
+	sink.counter("ant_net_srt_relay_refused_total", "SRT datagrams of unknown remotes which didn't open a relay",
+		labels, _relay.refused());
+
+	sink.thread(thread_stats());
+}
+
+void ant::Network::set_timestamp_opt()
+{
+#ifdef __linux__
+	int opt = 1;
+	if (setsockopt(_sock, SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof(opt)) != 0)
+		LOG(Log::EWarning, Log::ENet, "syscall setsockopt(SO_TIMESTAMPNS) failed: %s(%d)\n", strerror(errno), errno)
+
+	// hardware stamps are reported only if the NIC was configured for them (SIOCSHWTSTAMP)
+	int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	if (setsockopt(_sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+		LOG(Log::EDebug, Log::ENet, "syscall setsockopt(SO_TIMESTAMPING) failed: %s(%d)\n", strerror(errno), errno)
+#endif
+}
+
+void ant::Network::set_offload_opt()
+{
+	_gso = false;
+	_gro = false;
+#ifdef __linux__
+	if (_use_gso) {
+		// zero segment size keeps sending unchanged, the option fails on kernels without GSO
+		int opt = 0;
+		_gso = setsockopt(_sock, SOL_UDP, UDP_SEGMENT, &opt, sizeof(opt)) == 0;
+		LOG(Log::EInfo, Log::ENet, "socket(%d) UDP GSO is %s\n", _sock.load(), _gso ? "on" : "not supported")
+	}
+	if (_use_gro) {
+		int opt = 1;
+		_gro = setsockopt(_sock, SOL_UDP, UDP_GRO, &opt, sizeof(opt)) == 0;
+		LOG(Log::EInfo, Log::ENet, "socket(%d) UDP GRO is %s\n", _sock.load(), _gro ? "on" : "not supported")
+	}
+#endif
+	if (_gro)
+		reserve_arena(EGroBatchSize, EGroSlotSize);
+	else
+		reserve_arena(EBatchSize, EBatchSlotSize);
+}
+
+void ant::Network::reserve_arena(int batch_size, int slot_size)
+{
+	_batch_size = batch_size;
+	_slot_size = slot_size;
+	in_buf.resize(batch_size * slot_size);
+	in_addrs.resize(batch_size);
+	in_control.resize(batch_size * EControlSize);
+	// a coalesced datagram is split into at most EGsoMaxSegments datagrams
+	in_datagrams.reserve(_gro ? batch_size * EGsoMaxSegments : batch_size);
+#ifdef __linux__
+	in_msgs.resize(batch_size);
+	in_iov.resize(batch_size);
+#endif
+}
+
 
 /*
  * local port logic
@@ -339,7 +1380,7 @@ int ant::Network::bind(sockaddr_storage& bind_ip_port)
 {
 	socklen_t addrlen = 0;
 
-	LOG(Log::EInfo, Log::ENet, "libant(%d) try bind to %s\n", _sock, print_sockaddr(bind_ip_port).c_str());
+	LOG(Log::EInfo, Log::ENet, "libant(%d) try bind to %s\n", _sock.load(), print_sockaddr(bind_ip_port).c_str());
 
 	if (bind_ip_port.ss_family == AF_INET) {
 		LOG(Log::EInfo, Log::ENet, "IPv4 network detected\n")
@@ -370,7 +1411,7 @@ int ant::Network::bind(sockaddr_storage& bind_ip_port)
 				return 1;
 			}
 
-			LOG(Log::EInfo, Log::ENet, "libant(%d) bound to local %s\n", _sock, print_sockaddr(_bind_addr).c_str());
+			LOG(Log::EInfo, Log::ENet, "libant(%d) bound to local %s\n", _sock.load(), print_sockaddr(_bind_addr).c_str());
 			return 0;
 		}
 
@@ -390,29 +1431,266 @@ int ant::Network::bind(sockaddr_storage& bind_ip_port)
 	return _net_error;
 }
 
-void ant::Network::do_asynch(std::function<void()> f) noexcept
+void ant::Network::do_asynch(Task f) noexcept
+{
+	if (is_break_loop)
+		return;
+    net_queue.push({std::move(f), std::chrono::steady_clock::now()});
+	notify_loop();
+}
+
+int ant::Network::post(Task f, int timeout_ms) noexcept
+{
+	if (is_break_loop)
+		return ECANCELED;
+	// the loop can't wait for itself
+	if (_loop_thread_id.load() == std::this_thread::get_id())
+		timeout_ms = 0;
+	int rc = _limited_queue.push({std::move(f), std::chrono::steady_clock::now()}, timeout_ms);
+	if (!rc)
+		notify_loop();
+	return rc;
+}
+
+int ant::Network::post_event(int key, Task& f, int timeout_ms) noexcept
 {
 	if (is_break_loop)
+		return ECANCELED;
+	Async_task task{std::move(f), std::chrono::steady_clock::now()};
+	// the loop can't wait for itself
+	int rc = _loop_thread_id.load() == std::this_thread::get_id() ? _event_queue.push_over(key, task)
+		: _event_queue.push(key, task, timeout_ms);
+	if (rc)
+		f = std::move(task.f);
+	else
+		notify_loop();
+	return rc;
+}
+
+void ant::Network::notify_loop() noexcept
+{
+	_tasks_posted.fetch_add(1, std::memory_order_relaxed);
+	// the loop clears the flag before it drains the queue, so a signal is needed
+	// only for the first task posted since then
+	if (!_wakeup_pending.exchange(true))
+		wakeup();
+}
+
+void ant::Network::wakeup() noexcept
+{
+	// the loop isn't running, start() makes the pipe and the loop drains what was queued before
+	int wfd = net_thread_pipe.wfd;
+	if (wfd == -1)
 		return;
-    net_queue.push(f);
-	ssize_t	rc = write(net_thread_pipe.wfd, "f", 1);
+	_wakeup_signals.fetch_add(1, std::memory_order_relaxed);
+#ifdef __linux__
+	uint64_t one = 1;
+	ssize_t	rc = write(wfd, &one, sizeof(one));
+#else
+	ssize_t	rc = write(wfd, "f", 1);
+#endif
 	// On error, -1 is returned, and errno is set appropriately.
 	if (rc == -1)
 		LOG(Log::EError, Log::ENet, "syscall write to pipe failed: %s(%d)\n", strerror(errno), errno);
 }
 
+int ant::Network::wait_started(int timeout_ms)
+{
+	if (!net_thread)
+		return _net_error ? _net_error : ENOTCONN;
+
+	// tasks run after the socket is bound
+	std::promise<int> started;
+	std::future<int> result = started.get_future();
+	do_asynch(std::bind([this](std::promise<int>& p) { p.set_value(_net_error); }, std::move(started)));
+	if (result.wait_for(std::chrono::milliseconds(timeout_ms)) != std::future_status::ready)
+		return ETIMEDOUT;
+	try {
+		return result.get();
+	} catch (std::future_error const&) {
+		return ECANCELED; // the loop stopped before the task run
+	}
+}
+
+ant::Network::Async_stats ant::Network::async_stats() const
+{
+	Async_stats stats;
+	stats.tasks = _tasks_posted.load(std::memory_order_relaxed);
+	stats.signals = _wakeup_signals.load(std::memory_order_relaxed);
+	stats.rejected = _limited_queue.rejected();
+	stats.dropped = _limited_queue.dropped();
+	stats.event_waits = _event_queue.waits();
+	uint64_t done = _tasks_run.load(std::memory_order_relaxed) + stats.dropped;
+	stats.depth = stats.tasks > done ? stats.tasks - done : 0;
+	return stats;
+}
+
+ant::Latency_histogram ant::Network::async_delay() const
+{
+	std::lock_guard<std::mutex> lock(_async_delay_mt);
+	return _async_delay.interval();
+}
+
+void ant::Network::clear_async_delay()
+{
+	std::lock_guard<std::mutex> lock(_async_delay_mt);
+	_async_delay.reset();
+}
+
+ant::Timer_id ant::Network::schedule_after(uint32_t delay_ms, Task f)
+{
+	return add_timer(delay_ms, 0, std::move(f));
+}
+
+ant::Timer_id ant::Network::schedule_every(uint32_t period_ms, Task f)
+{
+	return add_timer(period_ms, period_ms, std::move(f));
+}
+
+ant::Timer_id ant::Network::add_timer(uint32_t delay_ms, uint32_t period_ms, Task f)
+{
+	Timer_id id = _next_timer_id.fetch_add(1, std::memory_order_relaxed);
+	// the deadline is counted from the call, not from the moment the loop takes the timer
+	Timer_wheel::clock::time_point deadline = Timer_wheel::clock::now() + std::chrono::milliseconds(delay_ms);
+	if (_loop_thread_id.load() == std::this_thread::get_id())
+		insert_timer(id, deadline, period_ms, f);
+	else
+		do_asynch(std::bind(&Network::insert_timer, this, id, deadline, period_ms, std::move(f)));
+	return id;
+}
+
+void ant::Network::insert_timer(Timer_id id, Timer_wheel::clock::time_point deadline, uint32_t period_ms, Task& f)
+{
+	_timers.add(id, deadline, std::chrono::milliseconds(period_ms), std::move(f));
+}
+
+void ant::Network::cancel(Timer_id id)
+{
+	if (_loop_thread_id.load() == std::this_thread::get_id())
+		_timers.cancel(id);
+	else
+		do_asynch(std::bind(&Network::cancel, this, id));
+}
+
+void ant::Network::on_tick()
+{
+	Async_stats stats = async_stats();
+	LOG(Log::EDebug, Log::ENet, "async tasks: %llu, signals per task: %.3f, depth: %llu, rejected: %llu, "
+		"dropped: %llu, kernel drops: %llu\n", (unsigned long long) stats.tasks, stats.signals_per_task(),
+		(unsigned long long) stats.depth, (unsigned long long) stats.rejected, (unsigned long long) stats.dropped,
+		(unsigned long long) _rx_dropped.load())
+	Latency_histogram async = async_delay();
+	if (async.count())
+		LOG(Log::EDebug, Log::ENet, "task dispatch delay: p50 %llu us, p99 %llu us, p99.9 %llu us, max %llu us\n",
+			(unsigned long long) async.percentile(50), (unsigned long long) async.percentile(99),
+			(unsigned long long) async.percentile(99.9), (unsigned long long) async.max())
+	Latency_histogram delay = rx_delay();
+	if (delay.count())
+		LOG(Log::EDebug, Log::ENet, "kernel-to-callback delay: p50 %llu us, p99 %llu us, p99.9 %llu us, max %llu us\n",
+			(unsigned long long) delay.percentile(50), (unsigned long long) delay.percentile(99),
+			(unsigned long long) delay.percentile(99.9), (unsigned long long) delay.max())
+	Thread_stats loop = thread_stats();
+	LOG(Log::EDebug, Log::ENet, "loop: %llu iterations, cpu %.1f%%, busy %.1f%%\n",
+		(unsigned long long) loop.iterations, 100 * loop.cpu_utilization(), 100 * loop.busy_ratio())
+	autoscale_buffers();
+	if (_srt_demux) {
+		std::vector<int> closed;
+		_relay.expire(Srt_relay::clock::now(), closed);
+		for (int fd: closed) {
+			_reactor.remove(fd);
+			close(fd);
+		}
+	}
+
+	if (_events) {
+		LOGS(Log::EDebug, Log::ENet, "tick\n")
+		_events->tick();
+	}
+}
+
 void ant::Network::stop() noexcept
 {
 	is_break_loop = true;
+	// producers waiting for room
+	_limited_queue.close();
+	_event_queue.close();
     if (net_thread && net_thread->joinable()) {
         if (net_thread_pipe.wfd != -1)
-            write(net_thread_pipe.wfd, "s", 1);
+            wakeup();
         net_thread->join();
         delete net_thread;
         net_thread = nullptr;
     }
 }
 
+int ant::Network::send_segmented(const uint8_t *buffer, size_t buffer_len, size_t segment_size,
+	sockaddr_storage const& to)
+{
+	if (!segment_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t sent = 0;
+	size_t offset = 0;
+#ifdef __linux__
+	Send_scope scope(_senders);
+	int sock = _sock;
+	// one send is limited by the UDP datagram size and by the number of segments
+	size_t chunk_max = std::min<size_t>(EGsoMaxSegments, 65507 / segment_size) * segment_size;
+	while (_gso && sock >= 0 && chunk_max && offset < buffer_len) {
+		size_t chunk = std::min(chunk_max, buffer_len - offset);
+
+		iovec iov = { (void *) (buffer + offset), chunk };
+		char control[CMSG_SPACE(sizeof(uint16_t))];
+		memset(control, 0, sizeof(control));
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = (void *) &to;
+		msg.msg_namelen = to.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		if (chunk > segment_size) {
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t gso_size = segment_size;
+			memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+		}
+
+		if (sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			if (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP) {
+				// i.e. the route or the device can't segment, use the plain path from now on
+				int err = errno;
+				if (_gso.exchange(false))
+					LOG(Log::EWarning, Log::ENet, "socket(%d) UDP GSO failed: %s(%d), turned off\n",
+						sock, strerror(err), err)
+				break;
+			}
+			count_blocked_send();
+			return sent ? sent : -1;
+		}
+		sent += (chunk + segment_size - 1) / segment_size;
+		offset += chunk;
+	}
+#endif
+
+	if (offset < buffer_len) {
+		std::vector<Datagram> datagrams;
+		datagrams.reserve((buffer_len - offset + segment_size - 1) / segment_size);
+		for (; offset < buffer_len; offset += segment_size)
+			datagrams.push_back({buffer + offset, std::min(segment_size, buffer_len - offset), to, 0});
+		int rc = send_batch(datagrams.data(), datagrams.size());
+		if (rc < 0)
+			return sent ? sent : -1;
+		sent += rc;
+	}
+	return sent;
+}
+
 int ant::Network::find_interface(std::string target_fqdn, uint16_t target_port, sockaddr_storage& src_addr)
 {
     int error = 0;
@@ -429,47 +1707,37 @@ int ant::Network::find_interface(std::string target_fqdn, uint16_t target_port,
         LOG(Log::EInfo, Log::ENet, "%s%s: %s\n",
             iface->ifa_addr->sa_family==AF_INET ? "ipv4/" : "ipv6/", iface->ifa_name, addr.c_str());
     }
-    
-    int test_sock;
-
-    struct addrinfo hints, *res0 = nullptr;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = PF_UNSPEC;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_protocol = IPPROTO_UDP;
-    hints.ai_flags = AI_PASSIVE;
-
-    Chronometer<std::chrono::milliseconds> time_meter;
-    error = getaddrinfo(target_fqdn.c_str(), std::to_string(target_port).c_str(), &hints, &res0);
-    time_meter.stop();
-    LOG(Log::EInfo, Log::ENet, "resolve \"%s\" for %u ms\n", target_fqdn.c_str(), time_meter.count());
-    if (error) {
+    freeifaddrs(ifaces);
+
+    Resolve_result res = Resolver::shared().resolve(target_fqdn, target_port).get();
+    if (res.error) {
         LOG(Log::EError, Log::ENet, "find_interface: syscall getaddrinfo failed: %s(%d) %s\n",
-            gai_strerror(error), error, target_fqdn.c_str());
+            gai_strerror(res.error), res.error, target_fqdn.c_str());
+        return res.error;
+    }
+    return local_interface(res.addrs.front(), src_addr);
+}
+
+int ant::Network::local_interface(sockaddr_storage const& target, sockaddr_storage& src_addr)
+{
+    int error = 0;
+    socklen_t len = target.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+
+    // connect() of UDP socket only chooses the route
+    int test_sock = socket(target.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (test_sock < 0) {
+        error = errno;
+        LOG(Log::EError, Log::ENet, "syscall socket failed: %s(%d)\n", strerror(errno), errno);
         return error;
     }
 
     do {
-        test_sock = socket(res0->ai_family, SOCK_DGRAM, IPPROTO_UDP);
-        if (test_sock < 0) {
-            error = errno;
-            LOG(Log::EError, Log::ENet, "syscall socket failed: %s\n", strerror(errno), errno);
-            break;
-        }
-
-        if (connect(test_sock, res0->ai_addr, res0->ai_addrlen)) {
+        if (connect(test_sock, (sockaddr const *) &target, len)) {
             error = errno;
             LOG(Log::EError, Log::ENet, "syscall connect failed: %s(%d)\n", strerror(errno), errno);
             break;
         }
 
-        socklen_t len = 0;
-        if (res0->ai_family == AF_INET) {
-            len = sizeof(sockaddr_in);
-        } else if (res0->ai_family == AF_INET6) {
-            len = sizeof(sockaddr_in6);
-        }
-
         if (getsockname(test_sock, (struct sockaddr *) &src_addr, &len)) {
             error = errno;
             LOG(Log::EError, Log::ENet, "syscall getsockname failed: %s(%d)\n", strerror(errno), errno);
@@ -477,9 +1745,7 @@ int ant::Network::find_interface(std::string target_fqdn, uint16_t target_port,
         }
     } while (false);
 
-    freeaddrinfo(res0);
     close(test_sock);
-
     return error;
 }
 
@@ -489,34 +1755,19 @@ bool ant::Network::resolve_to_ipv4(std::string target_fqdn, unsigned short targe
 
 	std::vector<sockaddr_storage> list_peers;
 
-	struct addrinfo hints, *res0 = nullptr;
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = PF_UNSPEC; // AF_INET
-	hints.ai_socktype = SOCK_DGRAM;
-	hints.ai_protocol = IPPROTO_UDP;
-    hints.ai_flags = AI_PASSIVE;  // Если node не равно NULL, то флаг AI_PASSIVE игнорируется.
-
-	Chronometer<std::chrono::milliseconds> time_meter;
-	int error = getaddrinfo(target_fqdn.c_str(), 0, &hints, &res0);
-	time_meter.stop();
-	LOG(Log::EDebug, Log::ENet, "resolve \"%s\" for %u ms\n", target_fqdn.c_str(), time_meter.count());
-
-	if (error) {
+	Resolve_result res = Resolver::shared().resolve(target_fqdn, target_port).get();
+	if (res.error) {
 		LOG(Log::EError, Log::ENet, "resolve_to_ipv4: syscall getaddrinfo failed: %s(%d) fqdn:%s\n",
-		    gai_strerror(error), error, target_fqdn.c_str());
+		    gai_strerror(res.error), res.error, target_fqdn.c_str());
 		return false;
 	}
-	for (struct addrinfo *i = res0; i != nullptr; i = i->ai_next) {
-		if (i->ai_family == AF_INET) {
-			sockaddr_in *v4 = (sockaddr_in *) i->ai_addr;
-			v4->sin_port = htons(target_port);
-			sockaddr_storage ipv4_peer;
-			ipv4_peer = *((sockaddr_storage*)v4);
-			list_peers.push_back(ipv4_peer);
+	for (auto &peer: res.addrs) {
+		if (peer.ss_family == AF_INET) {
+			list_peers.push_back(peer);
             LOG(Log::EInfo, Log::EAnt, "resolving ipv4 %s:%d candidate %s\n"
                 , target_fqdn.c_str()
                 , target_port
-                , print_sockaddr(ipv4_peer).c_str());
+                , print_sockaddr(peer).c_str());
 		}
 	}
 
@@ -534,23 +1785,546 @@ bool ant::Network::resolve_to_ipv4(std::string target_fqdn, unsigned short targe
 	return true;
 }
 
-int ant::Network::check_srt(fd_set const& sd_set)
+void ant::Network::resolve_async(std::string const& target_fqdn, uint16_t target_port, Resolve_cb cb)
+{
+	_resolver.resolve(target_fqdn, target_port, std::move(cb), [this](Task f) { do_asynch(std::move(f)); });
+}
+
+void ant::Network::find_interface_async(std::string const& target_fqdn, uint16_t target_port, Interface_cb cb)
 {
-	for(const auto &srt_proxy_socket: _srt_proxies) {
-		if(FD_ISSET(srt_proxy_socket, &sd_set))
-			return srt_proxy_socket;
+	resolve_async(target_fqdn, target_port, [cb](Resolve_result const& res) {
+		sockaddr_storage local_addr;
+		memset(&local_addr, 0, sizeof(local_addr));
+		int error = res.error;
+		if (!error)
+			error = local_interface(res.addrs.front(), local_addr);
+		cb(error, local_addr);
+	});
+}
+
+uint64_t ant::Network::add_link_listener(Link_listener listener)
+{
+	std::lock_guard<std::mutex> lock(_links_mt);
+	uint64_t id = _next_link_listener++;
+	_link_listeners[id] = std::move(listener);
+	return id;
+}
+
+void ant::Network::remove_link_listener(uint64_t id)
+{
+	std::lock_guard<std::mutex> lock(_links_mt);
+	_link_listeners.erase(id);
+}
+
+void ant::Network::set_failover_target(sockaddr_storage const& target)
+{
+	std::lock_guard<std::mutex> lock(_links_mt);
+	_failover_target = target;
+}
+
+void ant::Network::on_link_event(int fd, int events)
+{
+	std::vector<Link_change> changes;
+	bool complete = _links.read(changes);
+	bool lost = false;
+	bool appeared = false;
+	for (auto &change: changes) {
+		LOG(Log::EInfo, Log::ENet, "interface %d: %s\n", change.ifindex,
+			change.kind == Link_change::ELinkDown ? "link down" :
+			change.kind == Link_change::ELinkUp ? "link up" :
+			change.kind == Link_change::EAddressRemoved ? "address removed" : "address added")
+		if (change.kind == Link_change::ELinkDown || change.kind == Link_change::EAddressRemoved) {
+			for (auto &addr: change.addrs)
+				lost |= Link_monitor::same_ip(addr, _bind_addr);
+		} else {
+			appeared = true;
+		}
+	}
+	// a wildcard socket survives interface changes
+	if (is_any_ip(_bind_addr))
+		lost = false;
+	else if (!complete)
+		lost = true; // notifications were dropped, the route is checked again
+
+	if (lost || (appeared && _sock < 0))
+		failover();
+
+	std::lock_guard<std::mutex> lock(_links_mt);
+	for (auto &change: changes) {
+		for (auto &itr: _link_listeners)
+			itr.second(change);
+	}
+}
+
+void ant::Network::failover()
+{
+	sockaddr_storage target;
+	{
+		std::lock_guard<std::mutex> lock(_links_mt);
+		target = _failover_target;
+	}
+
+	sockaddr_storage old_addr = _bind_addr;
+	sockaddr_storage new_addr;
+	memset(&new_addr, 0, sizeof(new_addr));
+	bool routed = target.ss_family && !local_interface(target, new_addr);
+	if (routed && _sock > 0 && Link_monitor::same_ip(new_addr, old_addr))
+		return; // the address is still in use
+
+	if (_sock > 0)
+		_reactor.remove(_sock);
+	close_socket();
+
+	if (routed) {
+		set_port(new_addr, get_port(old_addr));
+		_bind_addr = new_addr;
+		LOG(Log::EInfo, Log::ENet, "rebinding from %s to %s\n", print_sockaddr(old_addr).c_str(),
+			print_sockaddr(new_addr).c_str())
+		asynch_start();
+		if (!_net_error && _sock > 0) {
+			if (_events)
+				_events->on_interface_changed(old_addr, _bind_addr);
+			return;
+		}
+		_sock = -1;
+		_bind_addr = old_addr;
+	}
+
+	LOG(Log::EWarning, Log::ENet, "local address %s is gone\n", print_sockaddr(old_addr).c_str())
+	if (_events)
+		_events->on_network_lost();
+}
+
+int ant::Network::check_srt(int fd) const
+{
+	return _srt_proxies.count(fd) ? fd : 0;
+}
+
+void ant::Network::on_pipe_event(int fd, int events)
+{
+	LOGS(Log::EDebug, Log::ENet, "command read\n")
+	_wakeup_pending = false;
+#ifndef __linux__
+	char cmd[255]; ::read(fd, &cmd, sizeof(cmd)); // clear pipe
+#endif
+	to_call_async_commands();
+}
+
+void ant::Network::on_socket_event(int fd, int events)
+{
+	if (events & Reactor::EError) {
+		LOGS(Log::EError, Log::ENet, "error on socket\n")
+		if (_events)
+			_events->handle_icmp(fd);
+		// the rest of the queue is read for MTU reports
+		drain_error_queue(fd);
+	}
+
+	if (events & Reactor::ERead) {
+		LOGS(Log::EDebug, Log::ENet, "socket read\n")
+		receive(fd, EUndefined);
+	}
+}
+
+void ant::Network::on_srt_proxy_event(int fd, int events)
+{
+	LOGS(Log::EDebug, Log::ENet, "SRT socket read\n")
+	receive(fd, ESrt);
+}
+
+int ant::Network::srt_relay(sockaddr_storage const& remote, sockaddr_storage& local)
+{
+	bool created = false;
+	int fd = _relay.open(remote, local, created);
+	if (fd < 0)
+		return errno;
+	if (created) {
+		if (_loop_thread_id.load() == std::this_thread::get_id())
+			register_relay(fd);
+		else
+			do_asynch(std::bind(&Network::register_relay, this, fd));
 	}
 	return 0;
 }
 
-void ant::Network::thread_proc()
+ant::Protocol ant::Network::classify(const uint8_t *buffer, size_t len)
 {
-    fd_set rd_fds, err_fds;
-    std::chrono::steady_clock::time_point last_now = std::chrono::steady_clock::now();
+	if (!len)
+		return EUnrecognized;
+	// bencoded dictionary
+	if (buffer[0] == 'd')
+		return EKademlia;
+	// type ST_DATA..ST_SYN and version 1 in the first byte of the 20 bytes header
+	if (len >= 20 && (buffer[0] & 0x0f) == 1 && (buffer[0] >> 4) <= 4)
+		return EUtp;
+	return EUnrecognized;
+}
 
+void ant::Network::deliver(int fd, Protocol proto)
+{
+	if (!_srt_demux || fd != _sock) {
+		if (_events)
+			_events->recvfrom_batch(proto, in_datagrams.data(), in_datagrams.size(), fd, _sock);
+		return;
+	}
+
+	// runs of datagrams of one protocol go to Net_events in one call
+	size_t first = 0;
+	Protocol run = EUndefined;
+	for (size_t i = 0; i <= in_datagrams.size(); ++i) {
+		Protocol p = EUndefined;
+		if (i < in_datagrams.size()) {
+			Datagram const& dgram = in_datagrams[i];
+			p = _relay.is_srt(dgram.buffer, dgram.buffer_len) ? ESrt : classify(dgram.buffer, dgram.buffer_len);
+			if (p == ESrt) {
+				bool created = false;
+				int relay = _relay.inbound(dgram.buffer, dgram.buffer_len, dgram.addr, created);
+				// datagrams of unknown remotes and beyond the limit aren't worth a warning each
+				if (relay < 0 && errno != ENOENT && errno != ENOBUFS)
+					LOG(Log::EWarning, Log::ENet, "srt relay for %s failed: %s(%d)\n",
+						print_sockaddr(dgram.addr).c_str(), strerror(errno), errno)
+				else if (created)
+					register_relay(relay);
+			}
+		}
+		if (p == run)
+			continue;
+		if (run != ESrt && i > first && _events)
+			_events->recvfrom_batch(run, in_datagrams.data() + first, i - first, fd, _sock);
+		first = i;
+		run = p;
+	}
+}
+
+void ant::Network::register_relay(int fd)
+{
+	// the relay can be gone if the loop was stopped meanwhile
+	if (!is_break_loop)
+		_reactor.add(fd, Reactor::ERead, std::bind(&Network::on_srt_relay_event, this,
+			std::placeholders::_1, std::placeholders::_2));
+}
+
+void ant::Network::on_srt_relay_event(int fd, int events)
+{
+	while (!is_break_loop) {
+		int count = receive_batch(fd);
+		if (count < 0)
+			break;
+		// SRT talks to the relay as if it were the remote
+		size_t out = 0;
+		for (auto &dgram: in_datagrams) {
+			sockaddr_storage remote;
+			if (!_relay.outbound(fd, dgram.buffer, dgram.buffer_len, dgram.addr, remote))
+				continue;
+			dgram.addr = remote;
+			dgram.addr_len = 0;
+			in_datagrams[out++] = dgram;
+		}
+		if (out)
+			send_batch(in_datagrams.data(), out);
+		if (count < _batch_size)
+			break;
+	}
+}
+
+void ant::Network::receive(int fd, Protocol proto)
+{
+	while (!is_break_loop) {
+		int count = receive_batch(fd);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				LOG(Log::EError, Log::ENet, "receiving from socket(%d) failed: %s(%d)\n", fd, strerror(errno), errno);
+			break;
+		}
+		if (!in_datagrams.empty())
+			record_rx_delay();
+		if (!in_datagrams.empty())
+			deliver(fd, proto);
+		if (count < _batch_size)
+			break;
+	}
+}
+
+void ant::Network::push_datagram(Datagram const& dgram, size_t segment_size)
+{
+	if (!segment_size || segment_size >= dgram.buffer_len) {
+		in_datagrams.push_back(dgram);
+		return;
+	}
+	// segments of a coalesced datagram share its timestamps
+	for (size_t offset = 0; offset < dgram.buffer_len; offset += segment_size) {
+		Datagram segment = dgram;
+		segment.buffer = dgram.buffer + offset;
+		segment.buffer_len = std::min(segment_size, dgram.buffer_len - offset);
+		in_datagrams.push_back(segment);
+	}
+}
+
+void ant::Network::record_rx_delay()
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	int64_t now_ns = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	std::lock_guard<std::mutex> lock(_rx_delay_mt);
+	for (auto &dgram: in_datagrams) {
+		// the realtime clock can step back between the stamp and now
+		if (dgram.rx_time_ns)
+			_rx_delay.record(now_ns > dgram.rx_time_ns ? (now_ns - dgram.rx_time_ns) / 1000 : 0);
+	}
+}
+
+ant::Latency_histogram ant::Network::rx_delay() const
+{
+	std::lock_guard<std::mutex> lock(_rx_delay_mt);
+	return _rx_delay.interval();
+}
+
+void ant::Network::clear_rx_delay()
+{
+	std::lock_guard<std::mutex> lock(_rx_delay_mt);
+	_rx_delay.reset();
+}
+
+int ant::Network::receive_batch(int fd)
+{
+	in_datagrams.clear();
+#ifdef __linux__
+	for (int i = 0; i < _batch_size; ++i) {
+		in_iov[i].iov_base = in_buf.data() + i * _slot_size;
+		in_iov[i].iov_len = _slot_size;
+		msghdr &hdr = in_msgs[i].msg_hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = &in_addrs[i];
+		hdr.msg_namelen = sizeof(sockaddr_storage);
+		hdr.msg_iov = &in_iov[i];
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = in_control.data() + i * EControlSize;
+		hdr.msg_controllen = EControlSize;
+	}
+
+	int rc = recvmmsg(fd, in_msgs.data(), _batch_size, MSG_DONTWAIT, nullptr);
+	if (rc < 0)
+		return -1;
+
+	for (int i = 0; i < rc; ++i) {
+		msghdr &hdr = in_msgs[i].msg_hdr;
+		if (hdr.msg_flags & MSG_TRUNC) {
+			LOG(Log::EWarning, Log::ENet, "socket(%d): datagram from %s is bigger than %d bytes, dropped\n",
+				fd, print_sockaddr(in_addrs[i]).c_str(), _slot_size);
+			continue;
+		}
+		int segment_size = 0;
+		Datagram dgram = { (const uint8_t *) in_iov[i].iov_base, in_msgs[i].msg_len, in_addrs[i], hdr.msg_namelen, 0, 0 };
+		parse_control(hdr.msg_control, hdr.msg_controllen, dgram, segment_size);
+		push_datagram(dgram, segment_size);
+	}
+	return rc;
+#else
+	int count = 0;
+	for (; count < _batch_size; ++count) {
+		uint8_t *slot = in_buf.data() + count * _slot_size;
+		socklen_t from_len = sizeof(sockaddr_storage);
+		ssize_t rc = ::recvfrom(fd, slot, _slot_size, MSG_DONTWAIT, (sockaddr *) &in_addrs[count], &from_len);
+		if (rc < 0) {
+			if (!count)
+				return -1;
+			break;
+		}
+		push_datagram({slot, (size_t) rc, in_addrs[count], from_len, 0, 0}, 0);
+	}
+	return count;
+#endif
+}
+
+void ant::Network::parse_control(const void *control, size_t control_len, Datagram& dgram, int& segment_size)
+{
+#ifdef __linux__
+	msghdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_control = const_cast<void *>(control);
+	hdr.msg_controllen = control_len;
+	for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+			memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			dgram.rx_time_ns = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+		}
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			// software, deprecated and raw hardware stamps
+			timespec ts[3];
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+			dgram.rx_hw_time_ns = (int64_t) ts[2].tv_sec * 1000000000 + ts[2].tv_nsec;
+		}
+#ifdef SO_RXQ_OVFL
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+			// the socket's total, it wraps at 2^32
+			uint32_t dropped;
+			memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+			uint64_t total = _rx_dropped.load(std::memory_order_relaxed);
+			if (dropped != (uint32_t) total)
+				_rx_dropped.store(total + (uint32_t) (dropped - (uint32_t) total), std::memory_order_relaxed);
+		}
+#endif
+	}
+#endif
+}
+
+void ant::Network::on_socket_messages(int fd, const Reactor::Message *msgs, size_t count)
+{
+	in_datagrams.clear();
+	for (size_t i = 0; i < count; ++i) {
+		Reactor::Message const& msg = msgs[i];
+		if (msg.flags & MSG_TRUNC) {
+			LOG(Log::EWarning, Log::ENet, "socket(%d): datagram from %s is bigger than %d bytes, dropped\n",
+				fd, print_sockaddr(*msg.name).c_str(), _slot_size);
+			continue;
+		}
+		int segment_size = 0;
+		Datagram dgram = { msg.payload, msg.payload_len, *msg.name, msg.name_len, 0, 0 };
+		parse_control(msg.control, msg.control_len, dgram, segment_size);
+		push_datagram(dgram, segment_size);
+	}
+	if (in_datagrams.empty())
+		return;
+	record_rx_delay();
+	deliver(fd, EUndefined);
+}
+
+int ant::Network::sendto(const uint8_t *buffer, size_t buffer_len, sockaddr_storage const& to)
+{
+	Datagram dgram = { buffer, buffer_len, to, 0, 0, 0 };
+	return send_batch(&dgram, 1);
+}
+
+int ant::Network::send_batch(const Datagram *datagrams, size_t count)
+{
+	Send_scope scope(_senders);
+	int sock = _sock;
+	if (sock < 0) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	auto addr_len = [](Datagram const& dgram) -> socklen_t {
+		if (dgram.addr_len)
+			return dgram.addr_len;
+		return dgram.addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+	};
+
+	size_t sent = 0;
+#ifdef __linux__
+	while (sent < count) {
+		size_t n = std::min<size_t>(count - sent, EBatchSize);
+		mmsghdr msgs[EBatchSize];
+		iovec iov[EBatchSize];
+		memset(msgs, 0, n * sizeof(mmsghdr));
+		for (size_t i = 0; i < n; ++i) {
+			Datagram const& dgram = datagrams[sent + i];
+			iov[i].iov_base = (void *) dgram.buffer;
+			iov[i].iov_len = dgram.buffer_len;
+			msgs[i].msg_hdr.msg_name = (void *) &dgram.addr;
+			msgs[i].msg_hdr.msg_namelen = addr_len(dgram);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int rc = sendmmsg(sock, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc <= 0) {
+			count_blocked_send();
+			break;
+		}
+		sent += rc;
+	}
+#else
+	for (; sent < count; ++sent) {
+		Datagram const& dgram = datagrams[sent];
+		if (::sendto(sock, dgram.buffer, dgram.buffer_len, 0, (sockaddr const *) &dgram.addr, addr_len(dgram)) < 0) {
+			count_blocked_send();
+			break;
+		}
+	}
+#endif
+	if (!sent && count) {
+		LOG(Log::EDebug, Log::ENet, "sending to socket(%d) failed: %s(%d)\n", sock, strerror(errno), errno);
+		return -1;
+	}
+	return sent;
+}
+
+void ant::Network::close_socket()
+{
+	int sock = _sock.exchange(-1);
+	// a sender counts itself before it loads the socket
+	while (_senders.load())
+		std::this_thread::yield();
+	if (sock > 0)
+		close(sock);
+}
+
+void ant::Network::drain_error_queue(int fd)
+{
+#ifdef __linux__
+	char buf[512];
+	char control[512];
+	for (;;) {
+		sockaddr_storage to;
+		iovec iov = { buf, sizeof(buf) };
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		memset(&to, 0, sizeof(to));
+		msg.msg_name = &to;
+		msg.msg_namelen = sizeof(to);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+			break;
+
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+				&& !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+			sock_extended_err err;
+			memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+			// msg_name is the destination of the datagram which caused the error
+			if (err.ee_errno == EMSGSIZE && err.ee_info)
+				_path_mtu.update(to, err.ee_info);
+			else
+				LOG(Log::EDebug, Log::ENet, "socket(%d) error from %s: %s(%d)\n", fd,
+					print_sockaddr(to).c_str(), strerror(err.ee_errno), err.ee_errno)
+		}
+	}
+#endif
+}
+
+void ant::Network::thread_proc()
+{
     LOGS(Log::EInfo, Log::ENet, "NET thread is running\n")
 
-	asynch_start();
+	_loop_thread_id = std::this_thread::get_id();
+	_meter.start("ant-net");
+	apply_latency_mode(_latency, "NET");
+	_spin.set(_latency.spin_us);
+	reserve_arena(EBatchSize, EBatchSlotSize);
+	_net_error = _reactor.open(_use_uring ? Reactor::EUring : Reactor::EEpoll);
+	_uring = _reactor.backend() == Reactor::EUring;
+#ifdef __linux__
+	if (!_net_error)
+		_net_error = _reactor.add_eventfd(net_thread_pipe.rfd, std::bind(&Network::on_pipe_event, this,
+			std::placeholders::_1, std::placeholders::_2));
+#else
+	if (!_net_error)
+		_net_error = _reactor.add(net_thread_pipe.rfd, Reactor::ERead, std::bind(&Network::on_pipe_event, this,
+			std::placeholders::_1, std::placeholders::_2));
+#endif
+	if (!_net_error && !_links.open())
+		_reactor.add(_links.fd(), Reactor::ERead, std::bind(&Network::on_link_event, this,
+			std::placeholders::_1, std::placeholders::_2));
+	if (!_net_error)
+		asynch_start();
 
 	if (_events) {
         if (!_net_error)
@@ -559,95 +2333,58 @@ void ant::Network::thread_proc()
             _events->on_network_lost();
     }
 
-	auto start_handling_time = std::chrono::steady_clock::now();
+	schedule_every(ETickPeriodMs, std::bind(&Network::on_tick, this));
+	// timers and tasks posted before the loop was running
+	to_call_async_commands();
 
     while (!is_break_loop) {
-        FD_ZERO(&rd_fds);
-        FD_ZERO(&err_fds);
-        
-        FD_SET(net_thread_pipe.rfd, &rd_fds);
-        int nfds = net_thread_pipe.rfd;
-        if (_sock > 0) {
-            FD_SET(_sock, &rd_fds);
-            FD_SET(_sock, &err_fds);
-            nfds = std::max(nfds, _sock);
-        }
-        for(const auto &srt_proxy_socket: _srt_proxies) {
-			FD_SET(srt_proxy_socket, &rd_fds);
-			FD_SET(srt_proxy_socket, &err_fds);
-			nfds = std::max(nfds, srt_proxy_socket);
-		}
-
-		//auto stop_handling_time = std::chrono::steady_clock::now();
-		//int select_handling = std::chrono::duration_cast<std::chrono::milliseconds>(stop_handling_time - start_handling_time).count();
-		//LOG(Log::EDebug, Log::ENet, "handling select delay: %d ms\n", select_handling);
-        struct timeval tv = { .tv_sec = 0, .tv_usec = 250000 };
-        int rc = select(nfds+1, &rd_fds, nullptr, &err_fds, &tv);
-        start_handling_time = std::chrono::steady_clock::now();
-        int delay = std::chrono::duration_cast<std::chrono::milliseconds>(start_handling_time - last_now).count();
+        int timeout = _spin.timeout(_timers.next_timeout(Timer_wheel::clock::now(), EMaxPollMs));
+        _meter.begin_wait();
+        int rc = _reactor.poll(timeout);
+        _meter.end_wait();
+        _spin.on_poll(rc > 0);
 
 		if (is_break_loop)
 			continue;
 
-        if (rc > 0) {
-			LOG(Log::EDebug, Log::ENet, "handling read\n")
-
-			int srt_sock = check_srt(rd_fds);
-			if (srt_sock) {
-				LOGS(Log::EDebug, Log::ENet, "SRT socket read\n")
-			}
-
-			if (_sock > 0 && FD_ISSET(_sock, &rd_fds)) {
-				LOGS(Log::EDebug, Log::ENet, "socket read\n")
-			}
-
-            if (_sock > 0 && FD_ISSET(_sock, &err_fds)) {
-                LOGS(Log::EError, Log::ENet, "error on socket\n")
-                if (_events)
-                	_events->handle_icmp(_sock);
-            }
-
-			if (FD_ISSET(net_thread_pipe.rfd, &rd_fds)) {
-				LOGS(Log::EDebug, Log::ENet, "command read\n")
-				char cmd[255]; ::read(net_thread_pipe.rfd, &cmd, sizeof(cmd)); // clear pipe
-				to_call_async_commands();
-			}
-
-        } else if (rc < 0) { // select returns -1
+        if (rc < 0 && errno != EINTR) { // poll returns -1
             _net_error = errno;
 
-            LOG(Log::EError, Log::ENet, "syscall select failed: %s(%d)\n", strerror(errno), errno)
+            LOG(Log::EError, Log::ENet, "syscall poll failed: %s(%d)\n", strerror(errno), errno)
             LOGS(Log::EError, Log::ENet, "network failed and requires a restart!\n")
 
-            close(_sock);
-			_sock = -1;
+            if (_sock > 0)
+                _reactor.remove(_sock);
+            close_socket();
             if (_events)
             	_events->on_network_lost();
         }
 
-        if (delay >= 500) {
-            last_now = start_handling_time;
-
-            if (_events) {
-				LOGS(Log::EDebug, Log::ENet, "tick\n")
-				_events->tick();
-			}
-        }
+        _timers.expire(Timer_wheel::clock::now());
 
     } //  while(!is_break_loop)
 
     if (_events)
         _events->network_stop();
 
-	if (_sock > 0)
-		close(_sock);
-	_sock = 0;
+	_reactor.close();
+	_links.close();
+	_srt_proxies.clear();
+	_relay.clear();
+	_timers.clear();
+	_loop_thread_id = std::thread::id();
+	_meter.stop();
 
-	close(net_thread_pipe.wfd);
+	close_socket();
+
+	if (net_thread_pipe.wfd != net_thread_pipe.rfd)
+		close(net_thread_pipe.wfd);
     close(net_thread_pipe.rfd);
     net_thread_pipe = {-1, -1};
 
 	net_queue.clear(); // queue parameters can hold smart pointers
+	_limited_queue.close();
+	_event_queue.close();
 	_events = nullptr;
 
     LOGS(Log::EInfo, Log::ENet, "thread stopped\n")
@@ -656,12 +2393,32 @@ void ant::Network::thread_proc()
 
 void ant::Network::to_call_async_commands()
 {
-	std::function<void()> f;
-	while (!is_break_loop && net_queue.try_pop(f)) {
-		try {
-			f();
-		} catch (std::exception const &e) {
-			LOG(Log::EError, Log::ENet, "catch exception into function call: %s\n", e.what());
+	while (!is_break_loop) {
+		net_queue.drain(_async_batch);
+		_event_queue.drain(_async_batch);
+		_limited_queue.drain(_async_batch);
+		if (_async_batch.empty())
+			break;
+		for (auto &task: _async_batch) {
+			if (is_break_loop)
+				break;
+			_async_delays.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - task.enqueued).count());
+			// off the queue before the task can signal its caller
+			_tasks_run.fetch_add(1, std::memory_order_relaxed);
+			try {
+				task.f();
+			} catch (std::exception const &e) {
+				LOG(Log::EError, Log::ENet, "catch exception into function call: %s\n", e.what());
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(_async_delay_mt);
+			for (uint64_t delay: _async_delays)
+				_async_delay.record(delay);
 		}
+		_async_delays.clear();
+		_async_batch.clear();
 	}
+	_async_batch.clear();
 }
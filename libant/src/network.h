@@ -4,11 +4,30 @@
 #include <utility>
 #include <cstdint>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <type_traits>
 #include <sys/socket.h>
-#include "multithread_queue.h"
+#include <sys/uio.h>
+#include "mpsc_queue.h"
+#include "bounded_queue.h"
+#include "keyed_queue.h"
+#include "task.h"
+#include "timer_wheel.h"
+#include "path_mtu.h"
+#include "resolver.h"
+#include "link_monitor.h"
+#include "histogram.h"
+#include "thread_util.h"
+#include "srt_relay.h"
+#include "metrics.h"
+#include <map>
+#include <mutex>
 #include <functional>
-#include <set>
+#include <unordered_set>
 #include <srt.h>
+#include "reactor.h"
 
 namespace ant {
 
@@ -27,6 +46,17 @@ namespace ant {
         virtual sockaddr_storage const& getbindaddr() const = 0;
     };
 
+	struct Datagram {
+		const uint8_t *buffer;
+		size_t buffer_len;
+		sockaddr_storage addr;  // source of received or destination of sent datagram
+		socklen_t addr_len;
+		// kernel arrival time of a received datagram (CLOCK_REALTIME, SO_TIMESTAMPNS), 0 if unknown
+		int64_t rx_time_ns;
+		// arrival time stamped by the NIC in its own clock, 0 if the hardware doesn't stamp
+		int64_t rx_hw_time_ns;
+	};
+
 	class Net_events
 	{
 	public:
@@ -35,8 +65,16 @@ namespace ant {
 		virtual void network_start() = 0;
 		virtual void network_stop() = 0;
 		virtual void recvfrom(Protocol proto, const uint8_t *buffer, size_t buffer_len, const sockaddr_storage *from, socklen_t addr_len, int recv_socket, int ant_socket) = 0;
+		// datagrams read by one syscall, buffers are valid during the call only
+		virtual void recvfrom_batch(Protocol proto, const Datagram *datagrams, size_t count, int recv_socket, int ant_socket) {
+			for (size_t i = 0; i < count; ++i)
+				recvfrom(proto, datagrams[i].buffer, datagrams[i].buffer_len, &datagrams[i].addr, datagrams[i].addr_len,
+					recv_socket, ant_socket);
+		}
 		virtual void on_network_error(const sockaddr_storage *from, int errcode) = 0;
 		virtual void handle_icmp(int sock) = 0;
+		// the socket was rebound after the local address had gone, see Network::set_failover_target()
+		virtual void on_interface_changed(sockaddr_storage const& old_addr, sockaddr_storage const& new_addr) {}
 	};
 
     class Network : public Udp_sender
@@ -44,20 +82,205 @@ namespace ant {
     public:
         typedef std::shared_ptr<Network> ptr;
 
+        enum {
+            EBatchSize = 64,        // datagrams per receiving syscall
+            EBatchSlotSize = 9216,  // the biggest datagram accepted (jumbo frame)
+            EGroBatchSize = 16,     // coalesced datagrams per receiving syscall with GRO
+            EGroSlotSize = 65535,   // the biggest coalesced datagram
+            EGsoMaxSegments = 64,   // kernel limit of segments per GSO send
+            EControlSize = 192,     // ancillary data per received datagram
+            ETickPeriodMs = 500,    // period of Net_events::tick()
+            EMaxPollMs = 2000       // the longest sleep of the loop without due timers
+        };
+
         Network(Net_events* an_events);
         virtual ~Network();
 
         int start(sockaddr_storage const& net_interface) noexcept;
         void stop() noexcept;
 
-        void do_asynch(std::function<void()> f) noexcept;
+        void do_asynch(Task f) noexcept;
+
+        // what post() and call() do if the queue is full
+        enum Async_policy {
+            EAsyncBlock = bounded_queue<int>::EBlock,           // wait up to timeout_ms for room
+            EAsyncFailFast = bounded_queue<int>::EFailFast,     // return EAGAIN
+            EAsyncDropOldest = bounded_queue<int>::EDropOldest  // the oldest queued task isn't run
+        };
+        // the number of tasks post() and call() can queue, 0 is unbounded (default)
+        // do_asynch() isn't limited: the library posts its own tasks with it, except the Srt events
+        // which wait for room in a lane of the same capacity to slow the receiving down
+        void set_async_limit(size_t capacity, Async_policy policy) {
+            _limited_queue.set_limit(capacity, (bounded_queue<Async_task>::Policy) policy);
+            _event_queue.set_limit(capacity);
+        }
+        // do_asynch() with backpressure, on the loop thread a full queue isn't waited for
+        // return 0 if the task is queued, EAGAIN if the queue is full or ECANCELED if the loop is stopped
+        int post(Task f, int timeout_ms = -1) noexcept;
+        // queues an event of the connection key which can't be dropped, waits up to timeout_ms for room
+        // events of a key run in order, on the loop thread a full lane isn't waited for
+        // return 0 if the event is queued, EAGAIN if the lane is full or ECANCELED if the loop is stopped,
+        // f is left to the caller unless it returns 0
+        int post_event(int key, Task& f, int timeout_ms) noexcept;
+        // runs f on the loop thread and makes its result or exception available through the future
+        // if the task is refused, dropped or the loop stops before it runs, get() throws std::future_error
+        template<typename F>
+        std::future<typename std::result_of<F()>::type> call(F f, int timeout_ms = -1) {
+            std::packaged_task<typename std::result_of<F()>::type()> task(std::move(f));
+            std::future<typename std::result_of<F()>::type> result = task.get_future();
+            post(std::move(task), timeout_ms);
+            return result;
+        }
+
+        struct Async_stats {
+            uint64_t tasks;     // queued by do_asynch(), post() and call()
+            uint64_t signals;   // wakeups written to the loop
+            uint64_t depth;     // queued tasks which haven't run yet
+            uint64_t rejected;  // refused by a full queue
+            uint64_t dropped;   // pushed out by EAsyncDropOldest
+            uint64_t event_waits;   // events which waited for room
+            double signals_per_task() const { return tasks ? (double) signals / tasks : 0; }
+        };
+        Async_stats async_stats() const;
+        // delay from queueing a task to its run (microseconds) since the last clear
+        // collect_metrics() reports the count since start() and the quantiles of the recent delays
+        Latency_histogram async_delay() const;
+        void clear_async_delay();
+
+        // timers run on the loop thread, they can be scheduled and cancelled from any thread
+        // return the timer id which can be passed to cancel()
+        Timer_id schedule_after(uint32_t delay_ms, Task f);
+        Timer_id schedule_every(uint32_t period_ms, Task f);
+        void cancel(Timer_id id);
+
+        // can be called from any thread
+        // return the number of sent datagrams or -1 (errno is set)
+        int sendto(const uint8_t *buffer, size_t buffer_len, sockaddr_storage const& to);
+        int send_batch(const Datagram *datagrams, size_t count);
+        // sends the buffer as a sequence of datagrams of segment_size bytes (the last one can be shorter)
+        // the kernel splits the buffer if UDP GSO is available, otherwise it is sent by send_batch()
+        // return the number of sent datagrams or -1 (errno is set)
+        int send_segmented(const uint8_t *buffer, size_t buffer_len, size_t segment_size, sockaddr_storage const& to);
+
+        // UDP segmentation offload (GSO) on send and receive offload (GRO), call before start()
+        // both fall back silently to the plain datagram path if the kernel doesn't support them
+        void set_offload(bool gso, bool gro) {
+            _use_gso = gso;
+            _use_gro = gro;
+        }
+        bool gso_enabled() const { return _gso; }
+        bool gro_enabled() const { return _gro; }
+
+        // io_uring loop: the socket is received by a multishot recvmsg over a ring of provided buffers and
+        // wakeups are read by a request posted with the wait, call before start()
+        // falls back to epoll if the kernel doesn't support it; sends keep sendmmsg() since they come from any thread
+        void set_io_uring(bool enable) {
+            _use_uring = enable;
+        }
+        bool io_uring_enabled() const { return _uring; }
+        // waiting syscalls and io_uring_enter() calls of the loop, see Reactor; read them after stop()
+        uint64_t loop_waits() const { return _reactor.waits(); }
+        uint64_t loop_enters() const { return _reactor.enters(); }
+
+        // SO_REUSEPORT lets several Networks receive on the same address, call before start()
+        // steering_shards > 1 attaches a CBPF program to the reuseport group which maps every flow
+        // (source address and port) to socket (saddr ^ sport) % steering_shards, Linux only
+        void set_reuseport(bool reuseport, int steering_shards = 0) {
+            _reuseport = reuseport;
+            _steering_shards = steering_shards;
+        }
+        // pinning, real-time class and spinning of the loop thread, SO_BUSY_POLL of the socket, call before start()
+        void set_latency_mode(Latency_mode const& mode) {
+            _latency = mode;
+        }
+        // single port: SRT shares the socket with the other protocols, call before start()
+        // every datagram is classified by its header, SRT ones are passed to the SRT library through relay
+        // sockets on the loopback interface (see Srt_relay), the rest goes to Net_events with the protocol
+        // recognized (EKademlia, EUtp or EUnrecognized)
+        void set_srt_demux(bool enable) {
+            _srt_demux = enable;
+        }
+        bool srt_demux() const { return _srt_demux; }
+        // the SRT listener on the loopback interface which gets datagrams of new remotes
+        void set_srt_listener(sockaddr_storage const& addr) {
+            _relay.set_listener(addr);
+        }
+        // the loopback address through which SRT reaches the remote, can be called from any thread
+        // return 0 if success or system error code
+        int srt_relay(sockaddr_storage const& remote, sockaddr_storage& local);
+        // the remote of a relay address SRT reports as its peer
+        bool srt_remote(sockaddr_storage const& local, sockaddr_storage& remote) const {
+            return _relay.remote_of(local, remote);
+        }
+        // the protocol of a datagram by its first byte: bencoded Kademlia message or uTP header
+        static Protocol classify(const uint8_t *buffer, size_t len);
+
+        // socket buffers in bytes, 0 keeps the kernel default, call before start()
+        // with max_bytes > 0 a buffer doubles on the next tick after the kernel dropped received datagrams
+        // or the send queue was full, up to max_bytes
+        void set_socket_buffers(int rcvbuf, int sndbuf, int max_bytes = 0) {
+            _rcvbuf_req = rcvbuf;
+            _sndbuf_req = sndbuf;
+            _buf_max = max_bytes;
+        }
+        struct Socket_stats {
+            uint64_t rx_dropped;    // datagrams dropped by the kernel for the lack of receive buffer (SO_RXQ_OVFL)
+            uint64_t tx_blocked;    // sends failed with a full send queue
+            int rcvbuf;             // effective sizes reported by the kernel
+            int sndbuf;
+        };
+        Socket_stats socket_stats() const;
+
+        // delay from the kernel arrival of received datagrams to Net_events::recvfrom_batch() (microseconds)
+        // it is the time spent in the socket queue and the loop, the network isn't included
+        // since the last clear, collect_metrics() reports the count since start() and the quantiles of the recent delays
+        Latency_histogram rx_delay() const;
+        void clear_rx_delay();
+
+        // CPU time, iterations and busy/idle split of the loop thread "ant-net" since start()
+        Thread_stats thread_stats() const {
+            return _meter.stats();
+        }
+        // adds the statistics above to a collection, see Metrics_registry::add()
+        void collect_metrics(Metrics_sink& sink) const;
+
+        // waits until the loop thread has bound the socket
+        // return 0 if success, system error code or ETIMEDOUT
+        int wait_started(int timeout_ms);
+
+        // return the MTU of the route to the destination or 0 if it is unknown, can be called from any thread
+        // the path can be narrower, the value is lowered by ICMP "fragmentation needed" reports
+        // read from the socket error queue
+        int path_mtu(sockaddr_storage const& to) {
+            return _path_mtu.get(to);
+        }
 
         sockaddr_storage const& getbindaddr() const override {
             return _bind_addr;
 		}
         // it finds appropriate local interface for target interaction
+        // blocking helpers, names are cached by Resolver::shared()
         static int find_interface(std::string target_fqdn, uint16_t target_port, sockaddr_storage& local_addr);
 		static bool resolve_to_ipv4(std::string target_fqdn, uint16_t target_port, sockaddr_storage& ipv4_addr);
+		// return 0 if success or system error code
+		static int local_interface(sockaddr_storage const& target, sockaddr_storage& local_addr);
+
+		// non-blocking versions, callbacks run on the loop thread
+		typedef std::function<void(int error, sockaddr_storage const& local_addr)> Interface_cb;
+		void resolve_async(std::string const& target_fqdn, uint16_t target_port, Resolve_cb cb);
+		std::future<Resolve_result> resolve_async(std::string const& target_fqdn, uint16_t target_port) {
+			return _resolver.resolve(target_fqdn, target_port);
+		}
+		void find_interface_async(std::string const& target_fqdn, uint16_t target_port, Interface_cb cb);
+
+		// interface and address changes reported by the kernel, listeners run on the loop thread
+		// remove_link_listener() waits until a running call of the listener returns
+		typedef std::function<void(Link_change const&)> Link_listener;
+		uint64_t add_link_listener(Link_listener listener);
+		void remove_link_listener(uint64_t id);
+		// if the bound address goes away, the socket is rebound to the interface which routes to the target
+		// (same port), otherwise on_network_lost() is emitted
+		void set_failover_target(sockaddr_storage const& target);
 
 		void listen(int socket) {
 			do_asynch(std::bind(&ant::Network::do_listen, this, socket));
@@ -67,36 +290,148 @@ namespace ant {
 		void do_listen(int socket);
 		void asynch_start();
         void thread_proc();
-		int check_srt(fd_set const& sd_set);
+		// return socket if it is a registered SRT proxy or 0
+		int check_srt(int fd) const;
         // return 0 if success or system error code
         int bind(sockaddr_storage& bind_ip_port);
 		int set_sock_opt();
 
 	protected:
         bool is_break_loop;
-        multithread_queue<std::function<void()>> net_queue;
+        struct Async_task {
+            Task f;
+            std::chrono::steady_clock::time_point enqueued;
+        };
+        mpsc_queue<Async_task> net_queue;
+        // tasks of post() and call()
+        bounded_queue<Async_task> _limited_queue;
+        // events of post_event() by connection
+        keyed_queue<int, Async_task> _event_queue;
         std::thread *net_thread;
 		Net_events* _events;
         int _net_error;
 
 	private:
 		void to_call_async_commands();
+		Timer_id add_timer(uint32_t delay_ms, uint32_t period_ms, Task f);
+		void insert_timer(Timer_id id, Timer_wheel::clock::time_point deadline, uint32_t period_ms, Task& f);
+		void on_tick();
+		// tasks taken from the queues by one drain
+		std::vector<Async_task> _async_batch;
+		std::vector<uint64_t> _async_delays;
+		// counts a queued task and wakes the loop if needed
+		void notify_loop() noexcept;
+		void wakeup() noexcept;
+		void on_pipe_event(int fd, int events);
+		void on_socket_event(int fd, int events);
+		void on_srt_proxy_event(int fd, int events);
+		// reads datagrams into in_buf until the socket is drained
+		void receive(int fd, Protocol proto);
+		// fills in_datagrams, GRO-coalesced datagrams are split back into segments
+		// return the number of messages read by one syscall or -1 (errno is set)
+		int receive_batch(int fd);
+		// the datagrams received by io_uring
+		void on_socket_messages(int fd, const Reactor::Message *msgs, size_t count);
+		// reads GRO segment size, drop counter and timestamps
+		void parse_control(const void *control, size_t control_len, Datagram& dgram, int& segment_size);
+		void push_datagram(Datagram const& dgram, size_t segment_size);
+		// passes in_datagrams to Net_events or to the SRT relays
+		void deliver(int fd, Protocol proto);
+		void register_relay(int fd);
+		void on_srt_relay_event(int fd, int events);
+		void set_offload_opt();
+		void set_timestamp_opt();
+		void record_rx_delay();
+		int attach_steering();
+		void on_link_event(int fd, int events);
+		void autoscale_buffers();
+		// return the effective size or -1
+		int set_buffer(int opt, int bytes);
+		void count_blocked_send();
+		void failover();
+		void reserve_arena(int batch_size, int slot_size);
+		void drain_error_queue(int fd);
+		// closes _sock after the senders which loaded it are done
+		void close_socket();
 
     private:
         // pipe is used for internal communications with loop thread
+        // on Linux both ends are the same eventfd
         struct Pipe {
             int rfd;
             int wfd;
         } __attribute__ ((aligned (4))) net_thread_pipe;
+        // set by the first do_asynch() after the loop drained the queue
+        std::atomic<bool> _wakeup_pending;
+        std::atomic<uint64_t> _tasks_posted;
+        std::atomic<uint64_t> _wakeup_signals;
+        std::atomic<uint64_t> _tasks_run;
+        // collect_metrics() advances its window
+        mutable Latency_recorder _async_delay;
+        mutable std::mutex _async_delay_mt;
 
-        // external IP socket
-        int _sock;
+        // external IP socket, it is written by the loop thread and read by senders on any thread
+        std::atomic<int> _sock;
+        // senders using the socket, it isn't closed under them
+        std::atomic<int> _senders;
         // external IP address
         sockaddr_storage _bind_addr;
-        // receiving buffer
+        // receiving arena: _batch_size slots of _slot_size bytes
         std::vector<uint8_t> in_buf;
+        std::vector<Datagram> in_datagrams;
+        std::vector<sockaddr_storage> in_addrs;
+        std::vector<uint8_t> in_control;
+        int _batch_size;
+        int _slot_size;
+#ifdef __linux__
+        std::vector<mmsghdr> in_msgs;
+        std::vector<iovec> in_iov;
+#endif
+        // requested and available offloads
+        bool _use_gso;
+        bool _use_gro;
+        // turned off by any sender when the route can't segment
+        std::atomic<bool> _gso;
+        bool _gro;
+        bool _use_uring;
+        std::atomic<bool> _uring;
+        bool _reuseport;
+        Latency_mode _latency;
+        Spin_budget _spin;
+        Loop_meter _meter;
+        bool _srt_demux;
+        Srt_relay _relay;
+        int _steering_shards;
+        // socket buffers, requested and effective sizes
+        int _rcvbuf_req;
+        int _sndbuf_req;
+        int _buf_max;
+        std::atomic<int> _rcvbuf;
+        std::atomic<int> _sndbuf;
+        std::atomic<uint64_t> _rx_dropped;
+        std::atomic<uint64_t> _tx_blocked;
+        uint64_t _rx_dropped_seen;
+        uint64_t _tx_blocked_seen;
+        // kernel-to-callback delay of received datagrams
+        mutable Latency_recorder _rx_delay;
+        mutable std::mutex _rx_delay_mt;
 		//
-        std::set<int> _srt_proxies;
+        std::unordered_set<int> _srt_proxies;
+        // descriptors polled by the loop thread
+        Reactor _reactor;
+        // timers owned by the loop thread
+        Timer_wheel _timers;
+        Path_mtu _path_mtu;
+        std::atomic<Timer_id> _next_timer_id;
+        std::atomic<std::thread::id> _loop_thread_id;
+        // interface changes
+        Link_monitor _links;
+        std::mutex _links_mt;
+        std::map<uint64_t, Link_listener> _link_listeners;
+        uint64_t _next_link_listener;
+        sockaddr_storage _failover_target;
+        // the last member: it joins its workers before the rest of Network is released
+        Resolver _resolver;
     };
 
 } // namespace ant
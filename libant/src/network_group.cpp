@@ -0,0 +1,121 @@
+#include <cstring>
+#include <unistd.h>
+#include "network_group.h"
+#include "logger.h"
+#include "utils.hpp"
+#ifdef ANT_UNIT_TESTS
+# include <atomic>
+# include <thread>
+# include <gtest/gtest.h>
+#endif
+
+#if defined(ANT_UNIT_TESTS) && defined(__linux__)
+namespace ant {
+
+struct Shard_events : public Net_events
+{
+    std::atomic<int> received{0};
+
+    void on_network_lost() override {}
+    void tick() override {}
+    void network_start() override {}
+    void network_stop() override {}
+    void recvfrom(Protocol proto, const uint8_t *buffer, size_t buffer_len, const sockaddr_storage *from,
+                  socklen_t addr_len, int recv_socket, int ant_socket) override {
+        ++received;
+    }
+    void on_network_error(const sockaddr_storage *from, int errcode) override {}
+    void handle_icmp(int sock) override {}
+};
+
+TEST(Network_group, steering)
+{
+    Shard_events events[2];
+    Network_group group({&events[0], &events[1]});
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(group.start(sa), 0);
+    sockaddr_storage bound = group.getbindaddr();
+    ASSERT_NE(SOCK_ADDR_IN_PORT(&bound), 0);
+    EXPECT_EQ(SOCK_ADDR_IN_PORT(&group.shard(1)->getbindaddr()), SOCK_ADDR_IN_PORT(&bound));
+
+    // every source lands on shard (saddr ^ sport) % 2
+    int expected[2] = {0, 0};
+    for (int i = 0; i < 8; ++i) {
+        int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        for (int j = 0; j < 5; ++j)
+            ::sendto(s, "hello", 5, 0, (sockaddr *) &bound, sizeof(sockaddr_in));
+        sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        getsockname(s, (sockaddr *) &from, &from_len);
+        uint32_t hash = INADDR_LOOPBACK ^ ntohs(SOCK_ADDR_IN_PORT(&from));
+        expected[hash % 2] += 5;
+        close(s);
+    }
+
+    for (int i = 0; i < 100 && events[0].received + events[1].received < 40; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(events[0].received + events[1].received, 40);
+    EXPECT_EQ(events[0].received, expected[0]);
+    EXPECT_EQ(events[1].received, expected[1]);
+
+    group.stop();
+}
+
+}
+#endif
+
+ant::Network_group::Network_group(std::vector<Net_events*> const& shard_events, bool steering)
+{
+    int count = (int) shard_events.size();
+    for (int i = 0; i < count; ++i) {
+        Network::ptr net = std::make_shared<Network>(shard_events[i]);
+        // the group program is attached once, by the first socket
+        net->set_reuseport(true, steering && i == 0 ? count : 0);
+        _shards.push_back(net);
+    }
+}
+
+ant::Network_group::~Network_group()
+{
+    stop();
+}
+
+int ant::Network_group::start(sockaddr_storage const& net_interface) noexcept
+{
+    if (_shards.empty())
+        return EINVAL;
+#ifndef __linux__
+    // BSD and macOS deliver all datagrams of a SO_REUSEPORT group to the last bound socket
+    if (_shards.size() > 1)
+        return EOPNOTSUPP;
+#endif
+
+    // shards join the reuseport group in order, so a shard index is its socket index for the program
+    sockaddr_storage addr = net_interface;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        int rc = _shards[i]->start(addr);
+        if (!rc)
+            rc = _shards[i]->wait_started(EStartTimeoutMs);
+        if (rc) {
+            LOG(Log::EError, Log::ENet, "network shard %d failed: %s(%d)\n", (int) i, strerror(rc), rc)
+            stop();
+            return rc;
+        }
+        if (!i)
+            addr = _shards[0]->getbindaddr();
+    }
+
+    LOG(Log::EInfo, Log::ENet, "%d network shards bound to %s\n", (int) _shards.size(),
+        print_sockaddr(addr).c_str())
+    return 0;
+}
+
+void ant::Network_group::stop() noexcept
+{
+    for (auto &net: _shards)
+        net->stop();
+}
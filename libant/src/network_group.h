@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include "network.h"
+
+namespace ant {
+
+    // K Networks bound to the same address with SO_REUSEPORT, every shard runs its own loop thread
+    // and delivers to its own Net_events, so datagram ingress scales with cores.
+    // With steering a flow always lands on the same shard (see Network::set_reuseport),
+    // otherwise the kernel spreads flows by its 4-tuple hash.
+    // Linux only: elsewhere SO_REUSEPORT doesn't balance (FreeBSD needs SO_REUSEPORT_LB),
+    // start() of more than one shard fails with EOPNOTSUPP.
+    class Network_group
+    {
+    public:
+        enum { EStartTimeoutMs = 5000 };
+
+        // one shard per events object, events are owned by the caller
+        Network_group(std::vector<Net_events*> const& shard_events, bool steering = true);
+        ~Network_group();
+
+        // shard 0 binds first, the others join its port (it matters if the requested port is 0)
+        // return 0 if all shards started or system error code
+        int start(sockaddr_storage const& net_interface) noexcept;
+        void stop() noexcept;
+
+        size_t size() const {
+            return _shards.size();
+        }
+        Network::ptr const& shard(size_t i) const {
+            return _shards[i];
+        }
+        sockaddr_storage const& getbindaddr() const {
+            return _shards.front()->getbindaddr();
+        }
+
+    private:
+        std::vector<Network::ptr> _shards;
+    };
+
+}
@@ -0,0 +1,170 @@
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "path_mtu.h"
+#include "logger.h"
+#include "utils.hpp"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Path_mtu, cache)
+{
+    Path_mtu pmtu;
+
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    SOCK_ADDR_IN_PORT(&sa) = htons(9);
+
+    int mtu = pmtu.get(sa);
+#ifdef __linux__
+    EXPECT_GE(mtu, 1500); // loopback is 64K usually
+#else
+    EXPECT_EQ(mtu, 0);
+#endif
+    if (!mtu)
+        return;
+    EXPECT_EQ(pmtu.size(), 1u);
+
+    // the port is not a part of the path
+    SOCK_ADDR_IN_PORT(&sa) = htons(10);
+    EXPECT_EQ(pmtu.get(sa), mtu);
+    EXPECT_EQ(pmtu.size(), 1u);
+
+    pmtu.update(sa, 1400);
+    EXPECT_EQ(pmtu.get(sa), 1400);
+    // a report can't raise the MTU
+    pmtu.update(sa, 9000);
+    EXPECT_EQ(pmtu.get(sa), 1400);
+    // nor bring it below the minimum
+    pmtu.update(sa, 100);
+    EXPECT_EQ(pmtu.get(sa), (int) Path_mtu::EMinMtu);
+
+    pmtu.clear();
+    EXPECT_EQ(pmtu.get(sa), mtu);
+}
+
+}
+#endif
+
+ant::Path_mtu::Path_mtu()
+{
+}
+
+std::string ant::Path_mtu::key(sockaddr_storage const& to)
+{
+    if (to.ss_family == AF_INET)
+        return std::string((const char *) &SOCK_ADDR_IN_ADDR(&to), sizeof(in_addr));
+    if (to.ss_family == AF_INET6)
+        return std::string((const char *) &SOCK_ADDR_IN6_ADDR(&to), sizeof(in6_addr));
+    return std::string();
+}
+
+int ant::Path_mtu::probe(sockaddr_storage const& to)
+{
+#ifdef __linux__
+    int level, discover_opt, discover_val, mtu_opt;
+    socklen_t addr_len;
+    if (to.ss_family == AF_INET) {
+        level = IPPROTO_IP;
+        discover_opt = IP_MTU_DISCOVER;
+        discover_val = IP_PMTUDISC_DO;
+        mtu_opt = IP_MTU;
+        addr_len = sizeof(sockaddr_in);
+    } else if (to.ss_family == AF_INET6) {
+        level = IPPROTO_IPV6;
+        discover_opt = IPV6_MTU_DISCOVER;
+        discover_val = IPV6_PMTUDISC_DO;
+        mtu_opt = IPV6_MTU;
+        addr_len = sizeof(sockaddr_in6);
+    } else {
+        return 0;
+    }
+
+    int sock = socket(to.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (sock < 0)
+        return 0;
+
+    // connect() of UDP socket sends nothing, it only resolves the route
+    sockaddr_storage dst = to;
+    if (!SOCK_ADDR_IN_PORT(&dst))
+        SOCK_ADDR_IN_PORT(&dst) = htons(9); // the port offset is the same for both families
+    int mtu = 0;
+    socklen_t mtu_len = sizeof(mtu);
+    if (setsockopt(sock, level, discover_opt, &discover_val, sizeof(discover_val)) != 0
+        || connect(sock, (sockaddr *) &dst, addr_len) != 0
+        || getsockopt(sock, level, mtu_opt, &mtu, &mtu_len) != 0) {
+        LOG(Log::EDebug, Log::ENet, "path mtu probe to %s failed: %s(%d)\n",
+            print_sockaddr(to).c_str(), strerror(errno), errno)
+        mtu = 0;
+    }
+    close(sock);
+    return mtu;
+#else
+    return 0;
+#endif
+}
+
+int ant::Path_mtu::get(sockaddr_storage const& to)
+{
+    std::string k = key(to);
+    if (k.empty())
+        return 0;
+
+    clock::time_point now = clock::now();
+    {
+        std::lock_guard<std::mutex> lock(_mt);
+        auto itr = _paths.find(k);
+        if (itr != _paths.end() && itr->second.expires > now)
+            return itr->second.mtu;
+    }
+
+    int mtu = probe(to);
+    if (mtu <= 0)
+        return 0;
+
+    LOG(Log::EInfo, Log::ENet, "path mtu to %s is %d bytes\n", print_sockaddr(to).c_str(), mtu)
+
+    std::lock_guard<std::mutex> lock(_mt);
+    Entry &entry = _paths[k];
+    entry.mtu = mtu;
+    entry.expires = now + std::chrono::seconds(ETtlSec);
+    return mtu;
+}
+
+void ant::Path_mtu::update(sockaddr_storage const& to, int mtu)
+{
+    std::string k = key(to);
+    if (k.empty() || mtu <= 0)
+        return;
+    if (mtu < EMinMtu)
+        mtu = EMinMtu;
+
+    LOG(Log::EInfo, Log::ENet, "path mtu to %s is reported as %d bytes\n", print_sockaddr(to).c_str(), mtu)
+
+    clock::time_point now = clock::now();
+    std::lock_guard<std::mutex> lock(_mt);
+    auto itr = _paths.find(k);
+    if (itr != _paths.end() && itr->second.expires > now && itr->second.mtu <= mtu)
+        return;
+    Entry &entry = _paths[k];
+    entry.mtu = mtu;
+    entry.expires = now + std::chrono::seconds(ETtlSec);
+}
+
+void ant::Path_mtu::clear()
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    _paths.clear();
+}
+
+size_t ant::Path_mtu::size() const
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    return _paths.size();
+}
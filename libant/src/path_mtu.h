@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/socket.h>
+
+namespace ant {
+
+    // Path MTU per destination address.
+    // Unknown paths are probed by the kernel route lookup (IP_MTU of a connected socket with
+    // IP_PMTUDISC_DO), ICMP "fragmentation needed" reports lower the cached value.
+    // It is an upper bound: a tunnel or an ICMP black hole further on is unknown to the route.
+    // Entries expire after ETtlSec like the kernel's PMTU cache, so a path can grow back.
+    // Thread safe.
+    class Path_mtu
+    {
+    public:
+        enum {
+            EMinMtu = 576,      // IPv4 minimum reassembly size
+            ETtlSec = 600
+        };
+
+        Path_mtu();
+
+        // return the path MTU for the destination or 0 if it can't be discovered
+        int get(sockaddr_storage const& to);
+        // feedback from the error queue, the cached MTU is only lowered
+        void update(sockaddr_storage const& to, int mtu);
+        void clear();
+        size_t size() const;
+
+        // return the MTU of the route to the destination or 0 if the platform can't tell it
+        static int probe(sockaddr_storage const& to);
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        struct Entry {
+            int mtu;
+            clock::time_point expires;
+        };
+
+        // the address without port
+        static std::string key(sockaddr_storage const& to);
+
+        mutable std::mutex _mt;
+        std::unordered_map<std::string, Entry> _paths;
+    };
+
+}
@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include "reactor.h"
+#include "logger.h"
+#ifdef ANT_UNIT_TESTS
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include <gtest/gtest.h>
+# ifdef __linux__
+#  include <sys/eventfd.h>
+# endif
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+static void check_dispatch(Reactor::Backend backend)
+{
+    Reactor reactor;
+    ASSERT_EQ(reactor.open(backend), 0);
+
+    int p1[2], p2[2];
+    ASSERT_EQ(pipe(p1), 0);
+    ASSERT_EQ(pipe(p2), 0);
+
+    int fired1 = 0, fired2 = 0;
+    ASSERT_EQ(reactor.add(p1[0], Reactor::ERead, [&](int fd, int events) {
+        char c; ::read(fd, &c, 1); ++fired1;
+        // handler can unregister other descriptors
+        reactor.remove(p2[0]);
+    }), 0);
+    ASSERT_EQ(reactor.add(p2[0], Reactor::ERead, [&](int fd, int events) {
+        char c; ::read(fd, &c, 1); ++fired2;
+    }), 0);
+    ASSERT_TRUE(reactor.contains(p1[0]));
+    ASSERT_EQ(reactor.size(), 2u);
+
+    EXPECT_EQ(reactor.poll(0), 0);
+
+    ASSERT_EQ(::write(p2[1], "x", 1), 1);
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_EQ(fired2, 1);
+
+    ASSERT_EQ(::write(p1[1], "x", 1), 1);
+    EXPECT_EQ(reactor.poll(100), 1);
+    EXPECT_EQ(fired1, 1);
+    EXPECT_FALSE(reactor.contains(p2[0]));
+
+    ASSERT_EQ(::write(p2[1], "x", 1), 1);
+    EXPECT_EQ(reactor.poll(10), 0);
+    EXPECT_EQ(fired2, 1);
+
+    reactor.close();
+    ::close(p1[0]); ::close(p1[1]);
+    ::close(p2[0]); ::close(p2[1]);
+}
+
+TEST(Reactor, dispatch)
+{
+    check_dispatch(Reactor::EEpoll);
+    check_dispatch(Reactor::EUring);
+}
+
+#ifdef __linux__
+TEST(Reactor, receiver)
+{
+    for (Reactor::Backend backend: {Reactor::EEpoll, Reactor::EUring}) {
+        Reactor reactor;
+        ASSERT_EQ(reactor.open(backend), 0);
+
+        int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        int wakeups = 0;
+        ASSERT_EQ(reactor.add_eventfd(efd, [&wakeups](int fd, int events) { ++wakeups; }), 0);
+
+        int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+        sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(::bind(sock, (sockaddr *) &sa, sizeof(sa)), 0);
+        socklen_t sa_len = sizeof(sa);
+        getsockname(sock, (sockaddr *) &sa, &sa_len);
+
+        int received = 0, polled = 0;
+        ASSERT_EQ(reactor.add_receiver(sock, 1500, 64, 8,
+            [&received](int fd, const Reactor::Message *msgs, size_t count) {
+                for (size_t i = 0; i < count; ++i) {
+                    EXPECT_EQ(msgs[i].payload_len, 5u);
+                    EXPECT_EQ(msgs[i].name->ss_family, AF_INET);
+                    received += !memcmp(msgs[i].payload, "hello", 5);
+                }
+            },
+            [&polled](int fd, int events) {
+                char buf[1500];
+                while (::recv(fd, buf, sizeof(buf), MSG_DONTWAIT) == 5)
+                    ++polled;
+            }), 0);
+
+        // more datagrams than buffers in the ring
+        int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        for (int i = 0; i < 20; ++i)
+            ASSERT_EQ(::sendto(s, "hello", 5, 0, (sockaddr *) &sa, sizeof(sa)), 5);
+        uint64_t one = 1;
+        ASSERT_EQ(::write(efd, &one, sizeof(one)), (ssize_t) sizeof(one));
+        for (int i = 0; i < 20 && received + polled < 20; ++i)
+            reactor.poll(50);
+        EXPECT_EQ(received + polled, 20);
+        EXPECT_EQ(wakeups, 1);
+        if (reactor.backend() == Reactor::EUring)
+            EXPECT_GT(received, 0);
+        else
+            EXPECT_EQ(polled, 20);
+
+        // the counter was reset, the next wakeup is reported again
+        reactor.poll(0);
+        ASSERT_EQ(::write(efd, &one, sizeof(one)), (ssize_t) sizeof(one));
+        EXPECT_EQ(reactor.poll(100), 1);
+        EXPECT_EQ(wakeups, 2);
+
+        EXPECT_EQ(reactor.remove(sock), 0);
+        ::sendto(s, "hello", 5, 0, (sockaddr *) &sa, sizeof(sa));
+        reactor.poll(10);
+        EXPECT_EQ(received + polled, 20);
+
+        reactor.close();
+        ::close(s);
+        ::close(sock);
+        ::close(efd);
+    }
+}
+#endif
+
+}
+#endif
+
+#ifdef ANT_HAVE_IO_URING
+namespace {
+    enum {
+        EUringEntries = 256,
+        EUserKindShift = 56,
+        EUserGenShift = 32,
+        EUserGenMask = 0xffffff
+    };
+
+    uint64_t user_data(int kind, uint32_t gen, int fd)
+    {
+        return ((uint64_t) kind << EUserKindShift) | ((uint64_t) (gen & EUserGenMask) << EUserGenShift) | (uint32_t) fd;
+    }
+}
+#endif
+
+ant::Reactor::Reactor()
+    : _backend(EEpoll)
+    , _waits(0)
+#ifdef __linux__
+    , _epfd(-1)
+#endif
+#ifdef ANT_HAVE_IO_URING
+    , _next_gen(1)
+    , _next_gid(1)
+    , _eventfd_value(0)
+#endif
+{
+}
+
+ant::Reactor::~Reactor()
+{
+    close();
+}
+
+int ant::Reactor::open(Backend backend)
+{
+#ifdef ANT_HAVE_IO_URING
+    if (_uring.is_open())
+        return 0;
+    if (backend == EUring && _epfd == -1) {
+        int error = _uring.open(EUringEntries);
+        if (!error) {
+            _backend = EUring;
+            return 0;
+        }
+        LOG(Log::EInfo, Log::ENet, "io_uring is unavailable (%s), epoll is used\n", strerror(error))
+    }
+#endif
+#ifdef __linux__
+    if (_epfd != -1)
+        return 0;
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0) {
+        int error = errno;
+        LOG(Log::EError, Log::ENet, "syscall epoll_create1 failed: %s(%d)\n", strerror(errno), errno);
+        return error;
+    }
+    _ready.resize(64);
+#endif
+    _backend = EEpoll;
+    return 0;
+}
+
+void ant::Reactor::close()
+{
+#ifdef __linux__
+    if (_epfd != -1)
+        ::close(_epfd);
+    _epfd = -1;
+#endif
+#ifdef ANT_HAVE_IO_URING
+    _uring.close();
+    _receiving.clear();
+#endif
+    _handlers.clear();
+    _backend = EEpoll;
+}
+
+int ant::Reactor::add(int fd, int events, handler const& h)
+{
+    if (fd < 0)
+        return EBADF;
+#ifdef ANT_HAVE_IO_URING
+    if (_backend == EUring) {
+        if (contains(fd))
+            remove(fd);
+        Entry &entry = _handlers[fd];
+        entry.events = events;
+        entry.on_event = std::make_shared<handler>(h);
+        entry.kind = EPoll;
+        entry.gen = _next_gen++;
+        post(fd, entry);
+        return 0;
+    }
+#endif
+#ifdef __linux__
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (events & ERead ? EPOLLIN : 0) | EPOLLERR;
+    ev.data.fd = fd;
+    int op = contains(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(_epfd, op, fd, &ev)) {
+        int error = errno;
+        LOG(Log::EError, Log::ENet, "syscall epoll_ctl(%d) failed: %s(%d)\n", fd, strerror(errno), errno);
+        return error;
+    }
+#else
+    if (fd >= FD_SETSIZE)
+        return EMFILE;
+#endif
+    Entry &entry = _handlers[fd];
+    entry.events = events;
+    entry.on_event = std::make_shared<handler>(h);
+    entry.kind = EPoll;
+    return 0;
+}
+
+int ant::Reactor::add_eventfd(int fd, handler const& h)
+{
+#ifdef ANT_HAVE_IO_URING
+    if (_backend == EUring && fd >= 0) {
+        if (contains(fd))
+            remove(fd);
+        Entry &entry = _handlers[fd];
+        entry.events = ERead;
+        entry.on_event = std::make_shared<handler>(h);
+        entry.kind = EEventfd;
+        entry.gen = _next_gen++;
+        post(fd, entry);
+        return 0;
+    }
+#endif
+    return add(fd, ERead, [h](int fd, int events) {
+        uint64_t value;
+        ::read(fd, &value, sizeof(value));
+        h(fd, events);
+    });
+}
+
+int ant::Reactor::add_receiver(int fd, size_t payload_size, size_t control_size, unsigned count, receiver const& r,
+    handler const& h)
+{
+#ifdef ANT_HAVE_IO_URING
+    if (_backend == EUring && fd >= 0) {
+        if (contains(fd))
+            remove(fd);
+        uint16_t gid = _next_gid++;
+        // every buffer holds the recvmsg header, the address, the ancillary data and the payload
+        size_t size = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_storage) + control_size + payload_size;
+        int error = _uring.add_buf_ring(gid, count, size);
+        if (!error) {
+            Entry &entry = _handlers[fd];
+            entry.events = ERead;
+            entry.on_event = std::make_shared<handler>(h);
+            entry.kind = EReceiver;
+            entry.on_messages = std::make_shared<receiver>(r);
+            entry.gen = _next_gen++;
+            entry.gid = gid;
+            memset(&entry.hdr, 0, sizeof(entry.hdr));
+            entry.hdr.msg_namelen = sizeof(sockaddr_storage);
+            entry.hdr.msg_controllen = control_size;
+            entry.queued = false;
+            entry.rearm = false;
+            post(fd, entry);
+            return 0;
+        }
+        LOG(Log::EInfo, Log::ENet, "io_uring can't receive on socket(%d), it is polled\n", fd)
+    }
+#endif
+    return add(fd, ERead, h);
+}
+
+int ant::Reactor::remove(int fd)
+{
+    auto itr = _handlers.find(fd);
+    if (itr == _handlers.end())
+        return ENOENT;
+#ifdef ANT_HAVE_IO_URING
+    if (_backend == EUring) {
+        Kind kind = itr->second.kind;
+        uint16_t gid = itr->second.gid;
+        _handlers.erase(itr);
+
+        io_uring_sqe *sqe = _uring.get_sqe();
+        if (!sqe && _uring.enter(0) == 0)
+            sqe = _uring.get_sqe();
+        if (!sqe) {
+            LOG(Log::EError, Log::ENet, "io_uring cancel of descriptor %d failed\n", fd)
+            return EBUSY;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = user_data(0, 0, fd);
+        // the cancel runs now, so the caller can close the descriptor and the ring can be released
+        _uring.enter(0);
+        if (kind == EReceiver)
+            _uring.remove_buf_ring(gid);
+        return 0;
+    }
+#endif
+    _handlers.erase(itr);
+#ifdef __linux__
+    if (epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr)) {
+        int error = errno;
+        LOG(Log::EError, Log::ENet, "syscall epoll_ctl(%d) failed: %s(%d)\n", fd, strerror(errno), errno);
+        return error;
+    }
+#endif
+    return 0;
+}
+
+int ant::Reactor::poll(int timeout_ms)
+{
+    ++_waits;
+#ifdef ANT_HAVE_IO_URING
+    if (_backend == EUring)
+        return poll_uring(timeout_ms);
+#endif
+#ifdef __linux__
+    int rc = epoll_wait(_epfd, _ready.data(), _ready.size(), timeout_ms);
+    if (rc <= 0)
+        return rc;
+
+    for (int i = 0; i < rc; ++i) {
+        // handler of a previous descriptor could remove this one
+        auto itr = _handlers.find(_ready[i].data.fd);
+        if (itr == _handlers.end())
+            continue;
+        int events = 0;
+        if (_ready[i].events & (EPOLLIN | EPOLLHUP))
+            events |= ERead;
+        if (_ready[i].events & EPOLLERR)
+            events |= EError;
+        std::shared_ptr<handler> h = itr->second.on_event;
+        (*h)(_ready[i].data.fd, events & (itr->second.events | EError));
+    }
+
+    if ((size_t) rc == _ready.size())
+        _ready.resize(_ready.size() * 2);
+    return rc;
+#else
+    fd_set rd_fds, err_fds;
+    FD_ZERO(&rd_fds);
+    FD_ZERO(&err_fds);
+    int nfds = -1;
+    for (auto const& item: _handlers) {
+        if (item.second.events & ERead)
+            FD_SET(item.first, &rd_fds);
+        FD_SET(item.first, &err_fds);
+        nfds = std::max(nfds, item.first);
+    }
+
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    int rc = select(nfds + 1, &rd_fds, nullptr, &err_fds, timeout_ms < 0 ? nullptr : &tv);
+    if (rc <= 0)
+        return rc;
+
+    std::vector<std::pair<int, int>> ready;
+    for (auto const& item: _handlers) {
+        int events = 0;
+        if (FD_ISSET(item.first, &rd_fds))
+            events |= ERead;
+        if (FD_ISSET(item.first, &err_fds))
+            events |= EError;
+        if (events)
+            ready.push_back(std::make_pair(item.first, events));
+    }
+    for (auto const& item: ready) {
+        auto itr = _handlers.find(item.first);
+        if (itr == _handlers.end())
+            continue;
+        std::shared_ptr<handler> h = itr->second.on_event;
+        (*h)(item.first, item.second);
+    }
+    return ready.size();
+#endif
+}
+
+#ifdef ANT_HAVE_IO_URING
+void ant::Reactor::post(int fd, Entry& entry)
+{
+    io_uring_sqe *sqe = _uring.get_sqe();
+    if (!sqe && _uring.enter(0) == 0)
+        sqe = _uring.get_sqe();
+    if (!sqe) {
+        LOG(Log::EError, Log::ENet, "io_uring submission ring is full, descriptor %d isn't polled\n", fd)
+        return;
+    }
+
+    sqe->fd = fd;
+    sqe->user_data = user_data(entry.kind, entry.gen, fd);
+    switch (entry.kind) {
+        case EPoll:
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->poll32_events = (entry.events & ERead ? POLLIN : 0) | POLLERR | POLLHUP;
+            break;
+
+        case EEventfd:
+            sqe->opcode = IORING_OP_READ;
+            sqe->addr = (uint64_t) (uintptr_t) &_eventfd_value;
+            sqe->len = sizeof(_eventfd_value);
+            break;
+
+        case EReceiver:
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->addr = (uint64_t) (uintptr_t) &entry.hdr;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = entry.gid;
+            break;
+    }
+}
+
+int ant::Reactor::poll_uring(int timeout_ms)
+{
+    if (_uring.enter(timeout_ms) != 0)
+        return -1;
+    _cqes.clear();
+    if (!_uring.reap(_cqes))
+        return 0;
+
+    int dispatched = 0;
+    for (auto const& cqe: _cqes) {
+        int fd = (int) (uint32_t) cqe.user_data;
+        int kind = (int) (cqe.user_data >> EUserKindShift);
+        uint32_t gen = (cqe.user_data >> EUserGenShift) & EUserGenMask;
+        // completions of removed or replaced registrations and of cancels are stale
+        auto itr = _handlers.find(fd);
+        if (!kind || itr == _handlers.end() || itr->second.kind != kind || (itr->second.gen & EUserGenMask) != gen)
+            continue;
+
+        Entry &entry = itr->second;
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+        if (kind == EReceiver) {
+            on_messages(fd, entry, cqe);
+            continue;
+        }
+
+        if (cqe.res < 0) {
+            if (cqe.res != -ECANCELED)
+                LOG(Log::EError, Log::ENet, "io_uring request on descriptor %d failed: %s(%d)\n", fd,
+                    strerror(-cqe.res), -cqe.res)
+            if (kind == EPoll && !more)
+                post(fd, entry);
+            continue;
+        }
+
+        int events = ERead;
+        if (kind == EPoll) {
+            events = 0;
+            if (cqe.res & (POLLIN | POLLHUP))
+                events |= ERead;
+            if (cqe.res & POLLERR)
+                events |= EError;
+            events &= entry.events | EError;
+        }
+        // multishot polls end on overflow, the eventfd read is one shot
+        if (!more)
+            post(fd, entry);
+        std::shared_ptr<handler> h = entry.on_event;
+        ++dispatched;
+        (*h)(fd, events);
+    }
+
+    for (int fd: _receiving) {
+        auto itr = _handlers.find(fd);
+        // a handler could remove it
+        if (itr == _handlers.end() || itr->second.kind != EReceiver)
+            continue;
+        Entry &entry = itr->second;
+        entry.queued = false;
+        _delivered.swap(entry.batch);
+        _recycled.swap(entry.bids);
+        uint16_t gid = entry.gid;
+        if (!_delivered.empty()) {
+            std::shared_ptr<receiver> r = entry.on_messages;
+            ++dispatched;
+            (*r)(fd, _delivered.data(), _delivered.size());
+        }
+        for (uint16_t bid: _recycled)
+            _uring.recycle(gid, bid);
+        _delivered.clear();
+        _recycled.clear();
+
+        // the multishot receive ended because the ring ran out of buffers, it is posted again with them
+        itr = _handlers.find(fd);
+        if (itr != _handlers.end() && itr->second.kind == EReceiver && itr->second.rearm) {
+            itr->second.rearm = false;
+            post(fd, itr->second);
+        }
+    }
+    _receiving.clear();
+    return dispatched;
+}
+
+void ant::Reactor::on_messages(int fd, Entry& entry, io_uring_cqe const& cqe)
+{
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t *buf = _uring.buffer(entry.gid, bid);
+        if (buf && cqe.res >= (int) (sizeof(io_uring_recvmsg_out) + entry.hdr.msg_namelen + entry.hdr.msg_controllen)) {
+            io_uring_recvmsg_out *out = (io_uring_recvmsg_out *) buf;
+            Message msg;
+            msg.name = (const sockaddr_storage *) (buf + sizeof(*out));
+            msg.name_len = std::min<socklen_t>(out->namelen, entry.hdr.msg_namelen);
+            const uint8_t *control = buf + sizeof(*out) + entry.hdr.msg_namelen;
+            msg.control = control;
+            msg.control_len = std::min<size_t>(out->controllen, entry.hdr.msg_controllen);
+            msg.payload = control + entry.hdr.msg_controllen;
+            msg.payload_len = std::min<size_t>(out->payloadlen, buf + cqe.res - msg.payload);
+            msg.flags = out->flags;
+            entry.batch.push_back(msg);
+        }
+        entry.bids.push_back(bid);
+    }
+
+    if (cqe.res < 0) {
+        int error = -cqe.res;
+        if (error == EINVAL) {
+            // the kernel can't receive multishot, the descriptor is polled instead
+            LOGS(Log::EInfo, Log::ENet, "io_uring multishot receive is unsupported, the socket is polled\n")
+            _uring.remove_buf_ring(entry.gid);
+            entry.kind = EPoll;
+            entry.on_messages = nullptr;
+            entry.batch.clear();
+            entry.bids.clear();
+            entry.gen = _next_gen++;
+            post(fd, entry);
+            std::shared_ptr<handler> h = entry.on_event;
+            (*h)(fd, ERead);
+            return;
+        }
+        if (error != ENOBUFS && error != ECANCELED) {
+            // socket errors like ICMP reports end the request
+            std::shared_ptr<handler> h = entry.on_event;
+            (*h)(fd, EError);
+            auto itr = _handlers.find(fd);
+            if (itr == _handlers.end() || itr->second.kind != EReceiver)
+                return;
+        }
+    }
+
+    Entry &current = _handlers.find(fd)->second;
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+        current.rearm = true;
+    if (!current.queued) {
+        current.queued = true;
+        _receiving.push_back(fd);
+    }
+}
+#endif
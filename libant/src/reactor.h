@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#ifdef __linux__
+#    include <sys/epoll.h>
+#endif
+#include "uring.h"
+
+namespace ant {
+
+    // Readiness notifications for file descriptors.
+    // Descriptors stay registered until remove() is called, so the waiting loop doesn't rebuild
+    // interest sets on every iteration. Linux uses epoll or io_uring, other platforms fall back to select().
+    // Not thread safe: all calls must come from the loop thread.
+    class Reactor
+    {
+    public:
+        enum Event {
+            ERead = 1,
+            EError = 2
+        };
+
+        enum Backend {
+            EEpoll = 1,     // select() on other platforms
+            EUring = 2
+        };
+
+        typedef std::function<void(int fd, int events)> handler;
+
+        // a datagram received by the reactor, valid during the receiver call only
+        struct Message {
+            const uint8_t *payload;
+            size_t payload_len;
+            const sockaddr_storage *name;
+            socklen_t name_len;
+            const void *control;
+            size_t control_len;
+            int flags;          // MSG_TRUNC, MSG_CTRUNC
+        };
+        typedef std::function<void(int fd, const Message *msgs, size_t count)> receiver;
+
+        Reactor();
+        ~Reactor();
+
+        // EUring falls back to epoll if io_uring is unavailable
+        // return 0 if success or system error code
+        int open(Backend backend = EEpoll);
+        void close();
+        Backend backend() const {
+            return _backend;
+        }
+
+        // return 0 if success or system error code
+        int add(int fd, int events, handler const& h);
+        // eventfd whose counter the reactor resets before calling the handler
+        // io_uring reads it by a request posted along with the wait, so a wakeup costs the loop no syscall
+        int add_eventfd(int fd, handler const& h);
+        // io_uring receives datagrams of fd itself: a multishot recvmsg stays posted over a ring of count
+        // (power of two) buffers, the receiver gets the datagrams of one poll() as a batch
+        // h is called with EError for socket errors. With epoll, or if the kernel can't receive multishot,
+        // the descriptor is polled and h reads it.
+        int add_receiver(int fd, size_t payload_size, size_t control_size, unsigned count, receiver const& r,
+            handler const& h);
+        int remove(int fd);
+        bool contains(int fd) const {
+            return _handlers.find(fd) != _handlers.end();
+        }
+        size_t size() const {
+            return _handlers.size();
+        }
+
+        // waits for events up to timeout_ms and calls handlers of ready descriptors
+        // returns the number of dispatched descriptors or -1 (errno is set)
+        int poll(int timeout_ms);
+        // calls of the waiting syscall
+        uint64_t waits() const {
+            return _waits;
+        }
+        // io_uring_enter() calls, 0 with epoll
+        uint64_t enters() const {
+#ifdef ANT_HAVE_IO_URING
+            return _uring.enters();
+#else
+            return 0;
+#endif
+        }
+
+    private:
+        enum Kind {
+            EPoll = 1,
+            EEventfd = 2,
+            EReceiver = 3
+        };
+
+        // the callbacks are shared, so a dispatch keeps them alive without copying them
+        // while they remove their own descriptor
+        struct Entry {
+            int events;
+            std::shared_ptr<handler> on_event;
+            Kind kind;
+            std::shared_ptr<receiver> on_messages;
+            // io_uring registration
+            uint32_t gen;
+            uint16_t gid;
+            msghdr hdr;
+            std::vector<Message> batch;
+            std::vector<uint16_t> bids;
+            bool queued;        // in _receiving
+            bool rearm;         // the multishot request has ended
+        };
+        std::unordered_map<int, Entry> _handlers;
+        Backend _backend;
+        uint64_t _waits;
+
+#ifdef __linux__
+        int _epfd;
+        std::vector<epoll_event> _ready;
+#endif
+#ifdef ANT_HAVE_IO_URING
+        int poll_uring(int timeout_ms);
+        void post(int fd, Entry& entry);
+        void on_messages(int fd, Entry& entry, io_uring_cqe const& cqe);
+
+        Uring _uring;
+        std::vector<io_uring_cqe> _cqes;
+        // receivers with completions of the current poll()
+        std::vector<int> _receiving;
+        std::vector<Message> _delivered;
+        std::vector<uint16_t> _recycled;
+        uint32_t _next_gen;
+        uint16_t _next_gid;
+        // the target of eventfd reads, the value isn't used
+        uint64_t _eventfd_value;
+#endif
+    };
+
+}
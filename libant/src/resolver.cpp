@@ -0,0 +1,262 @@
+#include <cstring>
+#include <netdb.h>
+#include "resolver.h"
+#include "logger.h"
+#include "thread_util.h"
+#include "utils.hpp"
+#ifdef ANT_UNIT_TESTS
+# include <atomic>
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Resolver, cache)
+{
+    Resolver resolver;
+
+    // concurrent requests share one lookup
+    std::vector<std::future<Resolve_result>> results;
+    for (int i = 0; i < 3; ++i)
+        results.push_back(resolver.resolve("localhost", 80 + i));
+    for (int i = 0; i < 3; ++i) {
+        Resolve_result res = results[i].get();
+        ASSERT_EQ(res.error, 0);
+        ASSERT_FALSE(res.addrs.empty());
+        EXPECT_EQ(get_port(res.addrs.front()), 80 + i);
+    }
+    Resolver::Stats stats = resolver.stats();
+    EXPECT_EQ(stats.requests, 3u);
+    EXPECT_EQ(stats.lookups + stats.cache_hits + stats.coalesced, 3u);
+    EXPECT_LE(stats.lookups, 1u);
+
+    // the answer is cached
+    std::atomic<int> dispatched{0};
+    std::promise<Resolve_result> answer;
+    resolver.resolve("localhost", 6881, [&answer](Resolve_result const& res) { answer.set_value(res); },
+        [&dispatched](Task f) { ++dispatched; f(); });
+    Resolve_result res = answer.get_future().get();
+    EXPECT_EQ(res.error, 0);
+    EXPECT_EQ(dispatched, 1);
+    EXPECT_EQ(resolver.stats().cache_hits, stats.cache_hits + 1);
+
+    // so is a failure
+    EXPECT_NE(resolver.resolve("", 80).get().error, 0);
+    EXPECT_NE(resolver.resolve("", 80).get().error, 0);
+    EXPECT_EQ(resolver.stats().lookups, stats.lookups + 1);
+
+    resolver.clear_cache();
+    EXPECT_EQ(resolver.resolve("localhost", 80).get().error, 0);
+    EXPECT_EQ(resolver.stats().lookups, stats.lookups + 2);
+}
+
+TEST(Resolver, destroy)
+{
+    // the destructor doesn't wait for lookups, callbacks aren't called after it
+    std::shared_ptr<std::atomic<bool>> destroyed = std::make_shared<std::atomic<bool>>(false);
+    std::shared_ptr<std::atomic<int>> late = std::make_shared<std::atomic<int>>(0);
+    std::unique_ptr<Resolver> resolver(new Resolver());
+    for (const char *fqdn: {"localhost", "example.invalid"})
+        resolver->resolve(fqdn, 80, [destroyed, late](Resolve_result const&) {
+            if (*destroyed)
+                ++*late;
+        });
+    Chronometer<std::chrono::milliseconds> time_meter;
+    resolver.reset();
+    time_meter.stop();
+    *destroyed = true;
+    EXPECT_LT(time_meter.count(), 1000u);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(*late, 0);
+
+    // a callback can destroy the resolver
+    resolver.reset(new Resolver());
+    std::promise<void> destroyed_in_callback;
+    resolver->resolve("localhost", 80, [&resolver, &destroyed_in_callback](Resolve_result const&) {
+        resolver.reset();
+        destroyed_in_callback.set_value();
+    });
+    std::future<void> done = destroyed_in_callback.get_future();
+    ASSERT_EQ(done.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_FALSE(resolver);
+}
+
+}
+#endif
+
+// the resolver whose callbacks the worker thread runs
+static thread_local void const* delivering_state = nullptr;
+
+ant::Resolver& ant::Resolver::shared()
+{
+    static Resolver* instance = new Resolver();
+    return *instance;
+}
+
+ant::Resolver::Resolver(int workers)
+    : _state(std::make_shared<State>())
+{
+    _state->max_workers = workers > 0 ? workers : 1;
+    _state->workers = 0;
+    _state->stop = false;
+    _state->delivering = 0;
+    memset(&_state->stats, 0, sizeof(_state->stats));
+}
+
+ant::Resolver::~Resolver()
+{
+    // the callbacks can refer to the owner of the resolver, they are destroyed without the lock
+    std::unordered_map<std::string, std::vector<Waiter>> pending;
+    {
+        std::unique_lock<std::mutex> lock(_state->mt);
+        _state->stop = true;
+        _state->jobs.clear();
+        pending.swap(_state->pending);
+        _state->cv.notify_all();
+        // a callback which destroys the resolver doesn't wait for itself
+        int self = delivering_state == _state.get() ? 1 : 0;
+        _state->delivered.wait(lock, [this, self]() { return _state->delivering == self; });
+    }
+    pending.clear();
+}
+
+void ant::Resolver::resolve(std::string const& fqdn, uint16_t port, Resolve_cb cb, Dispatcher const& dispatcher)
+{
+    Waiter waiter = {port, std::move(cb), dispatcher};
+
+    std::unique_lock<std::mutex> lock(_state->mt);
+    ++_state->stats.requests;
+
+    auto cached = _state->cache.find(fqdn);
+    if (cached != _state->cache.end()) {
+        if (cached->second.expires > clock::now()) {
+            ++_state->stats.cache_hits;
+            int error = cached->second.error;
+            std::vector<sockaddr_storage> addrs = cached->second.addrs;
+            lock.unlock();
+            deliver(waiter, error, addrs);
+            return;
+        }
+        _state->cache.erase(cached);
+    }
+
+    std::vector<Waiter> &waiters = _state->pending[fqdn];
+    waiters.push_back(std::move(waiter));
+    if (waiters.size() > 1) {
+        ++_state->stats.coalesced;
+        return;
+    }
+
+    _state->jobs.push_back(fqdn);
+    if (_state->workers < _state->max_workers && (size_t) _state->workers < _state->jobs.size()) {
+        std::thread(&Resolver::worker_proc, _state).detach();
+        ++_state->workers;
+    }
+    // under the lock, a worker can run a callback which destroys the resolver as soon as it is released
+    _state->cv.notify_one();
+}
+
+std::future<ant::Resolve_result> ant::Resolver::resolve(std::string const& fqdn, uint16_t port)
+{
+    std::shared_ptr<std::promise<Resolve_result>> result = std::make_shared<std::promise<Resolve_result>>();
+    resolve(fqdn, port, [result](Resolve_result const& res) { result->set_value(res); });
+    return result->get_future();
+}
+
+void ant::Resolver::clear_cache()
+{
+    std::lock_guard<std::mutex> lock(_state->mt);
+    _state->cache.clear();
+}
+
+ant::Resolver::Stats ant::Resolver::stats() const
+{
+    std::lock_guard<std::mutex> lock(_state->mt);
+    return _state->stats;
+}
+
+void ant::Resolver::worker_proc(std::shared_ptr<State> state)
+{
+    set_thread_name("ant-resolver");
+    std::unique_lock<std::mutex> lock(state->mt);
+    for (;;) {
+        state->cv.wait(lock, [&state]() { return state->stop || !state->jobs.empty(); });
+        if (state->stop)
+            return;
+
+        std::string fqdn = state->jobs.front();
+        state->jobs.pop_front();
+        ++state->stats.lookups;
+        lock.unlock();
+
+        std::vector<sockaddr_storage> addrs;
+        int error = lookup(fqdn, addrs);
+
+        lock.lock();
+        if (state->stop)
+            return;
+        Entry &entry = state->cache[fqdn];
+        entry.error = error;
+        entry.addrs = addrs;
+        entry.expires = clock::now() + std::chrono::seconds(error ? ENegativeTtlSec : EPositiveTtlSec);
+
+        std::vector<Waiter> waiters;
+        waiters.swap(state->pending[fqdn]);
+        state->pending.erase(fqdn);
+        ++state->delivering;
+        lock.unlock();
+
+        delivering_state = state.get();
+        for (auto &waiter: waiters)
+            deliver(waiter, error, addrs);
+        delivering_state = nullptr;
+        waiters.clear();
+
+        lock.lock();
+        --state->delivering;
+        if (state->stop)
+            state->delivered.notify_all();
+    }
+}
+
+int ant::Resolver::lookup(std::string const& fqdn, std::vector<sockaddr_storage>& addrs)
+{
+    struct addrinfo hints, *res0 = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    Chronometer<std::chrono::milliseconds> time_meter;
+    int error = getaddrinfo(fqdn.c_str(), nullptr, &hints, &res0);
+    time_meter.stop();
+    LOG(Log::EInfo, Log::ENet, "resolve \"%s\" for %u ms\n", fqdn.c_str(), time_meter.count());
+    if (error) {
+        LOG(Log::EError, Log::ENet, "syscall getaddrinfo failed: %s(%d) %s\n", gai_strerror(error), error, fqdn.c_str());
+        return error;
+    }
+
+    for (struct addrinfo *ai = res0; ai != nullptr; ai = ai->ai_next) {
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+            continue;
+        sockaddr_storage addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+        addrs.push_back(addr);
+    }
+    freeaddrinfo(res0);
+    return addrs.empty() ? EAI_NONAME : 0;
+}
+
+void ant::Resolver::deliver(Waiter const& waiter, int error, std::vector<sockaddr_storage> const& addrs)
+{
+    Resolve_result res = {error, addrs};
+    for (auto &addr: res.addrs)
+        set_port(addr, waiter.port);
+
+    if (waiter.dispatcher)
+        waiter.dispatcher(std::bind(waiter.cb, std::move(res)));
+    else
+        waiter.cb(res);
+}
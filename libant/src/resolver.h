@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include "task.h"
+
+namespace ant {
+
+    struct Resolve_result {
+        int error;                              // getaddrinfo() error code, 0 if success
+        std::vector<sockaddr_storage> addrs;    // with the requested port
+    };
+
+    typedef std::function<void(Resolve_result const&)> Resolve_cb;
+
+    // Asynchronous getaddrinfo() on a small pool of worker threads.
+    // Concurrent requests for the same name share one lookup, answers and failures are cached
+    // for fixed TTLs since getaddrinfo() doesn't report the records' TTL.
+    class Resolver
+    {
+    public:
+        enum {
+            EWorkers = 2,
+            EPositiveTtlSec = 300,
+            ENegativeTtlSec = 30
+        };
+
+        // delivers a callback to the thread where it must run
+        typedef std::function<void(Task)> Dispatcher;
+
+        struct Stats {
+            uint64_t requests;
+            uint64_t cache_hits;
+            uint64_t coalesced;     // requests joined an outstanding lookup
+            uint64_t lookups;       // getaddrinfo() calls
+        };
+
+        // shared by the blocking helpers of Network, it is never destroyed
+        // because workers can be stuck in getaddrinfo() at exit
+        static Resolver& shared();
+
+        explicit Resolver(int workers = EWorkers);
+        // drops the callbacks of outstanding requests and waits for the ones being delivered,
+        // workers stuck in getaddrinfo() exit on their own
+        ~Resolver();
+
+        Resolver(Resolver const&) = delete;
+        Resolver& operator=(Resolver const&) = delete;
+
+        // cb is passed to dispatcher, or called on a worker thread if there is no dispatcher
+        void resolve(std::string const& fqdn, uint16_t port, Resolve_cb cb, Dispatcher const& dispatcher = nullptr);
+        std::future<Resolve_result> resolve(std::string const& fqdn, uint16_t port);
+
+        void clear_cache();
+        Stats stats() const;
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        struct Waiter {
+            uint16_t port;
+            Resolve_cb cb;
+            Dispatcher dispatcher;
+        };
+
+        struct Entry {
+            int error;
+            std::vector<sockaddr_storage> addrs;    // without port
+            clock::time_point expires;
+        };
+
+        // shared with the workers, they can outlive the resolver
+        struct State {
+            int max_workers;
+            int workers;
+            bool stop;
+            int delivering;     // workers running callbacks
+            std::mutex mt;
+            std::condition_variable cv;
+            std::condition_variable delivered;
+            std::deque<std::string> jobs;
+            // waiters of outstanding lookups by name
+            std::unordered_map<std::string, std::vector<Waiter>> pending;
+            std::unordered_map<std::string, Entry> cache;
+            Stats stats;
+        };
+
+        static void worker_proc(std::shared_ptr<State> state);
+        static int lookup(std::string const& fqdn, std::vector<sockaddr_storage>& addrs);
+        static void deliver(Waiter const& waiter, int error, std::vector<sockaddr_storage> const& addrs);
+
+        std::shared_ptr<State> _state;
+    };
+
+}
@@ -0,0 +1,416 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include "srt_relay.h"
+#include "logger.h"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+// the handshake type of a conclusion request or response
+static const uint32_t SRT_HS_CONCLUSION = 0xFFFFFFFF;
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+static sockaddr_storage loopback(uint16_t port)
+{
+    sockaddr_storage sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.ss_family = AF_INET;
+    SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(INADDR_LOOPBACK);
+    SOCK_ADDR_IN_PORT(&sa) = htons(port);
+    return sa;
+}
+
+TEST(Srt_relay, forward)
+{
+    // plays the SRT listener
+    int srt = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_storage srt_addr = loopback(0);
+    ASSERT_EQ(bind(srt, (sockaddr *) &srt_addr, sizeof(sockaddr_in)), 0);
+    socklen_t len = sizeof(srt_addr);
+    getsockname(srt, (sockaddr *) &srt_addr, &len);
+
+    Srt_relay relay;
+    sockaddr_storage remote = loopback(4000);
+    sockaddr_storage local;
+    bool created = false;
+    EXPECT_EQ(relay.open(remote, local, created), -1);
+    EXPECT_EQ(errno, ENOTCONN);
+    relay.set_listener(srt_addr);
+
+    uint8_t induction[64];
+    memset(induction, 0, sizeof(induction));
+    induction[0] = 0x80;
+    EXPECT_TRUE(relay.is_srt(induction, sizeof(induction)));
+    EXPECT_FALSE(relay.is_srt(induction, Srt_relay::EHeaderSize - 1));
+
+    // other control packets and short handshakes of unknown remotes don't open a relay
+    uint8_t keepalive[16];
+    memset(keepalive, 0, sizeof(keepalive));
+    keepalive[0] = 0x80;
+    keepalive[1] = 1;
+    EXPECT_TRUE(relay.is_srt(keepalive, sizeof(keepalive)));
+    EXPECT_EQ(relay.inbound(keepalive, sizeof(keepalive), remote, created), -1);
+    EXPECT_EQ(errno, ENOENT);
+    EXPECT_EQ(relay.inbound(induction, Srt_relay::EHandshakeSize - 1, remote, created), -1);
+    EXPECT_EQ(relay.size(), 0u);
+    EXPECT_EQ(relay.refused(), 2u);
+
+    int fd = relay.inbound(induction, sizeof(induction), remote, created);
+    ASSERT_GE(fd, 0);
+    EXPECT_TRUE(created);
+    EXPECT_EQ(relay.size(), 1u);
+
+    uint8_t buf[128];
+    sockaddr_storage from;
+    len = sizeof(from);
+    ASSERT_EQ(recvfrom(srt, buf, sizeof(buf), 0, (sockaddr *) &from, &len), (ssize_t) sizeof(induction));
+    EXPECT_EQ(relay.open(remote, local, created), fd);
+    EXPECT_FALSE(created);
+    EXPECT_TRUE(sock_addr_cmp(&from, &local));
+    sockaddr_storage back;
+    ASSERT_TRUE(relay.remote_of(local, back));
+    EXPECT_TRUE(sock_addr_cmp(&back, &remote));
+
+    // the handshake going out announces socket 0x01020304
+    uint8_t conclusion[64];
+    memset(conclusion, 0, sizeof(conclusion));
+    conclusion[0] = 0x80;
+    conclusion[40] = 1; conclusion[41] = 2; conclusion[42] = 3; conclusion[43] = 4;
+    uint8_t data[32];
+    memset(data, 'd', sizeof(data));
+    data[12] = 1; data[13] = 2; data[14] = 3; data[15] = 4;
+    EXPECT_FALSE(relay.is_srt(data, sizeof(data)));
+    sockaddr_storage to;
+    EXPECT_FALSE(relay.outbound(fd + 100, conclusion, sizeof(conclusion), srt_addr, to));
+    ASSERT_TRUE(relay.outbound(fd, conclusion, sizeof(conclusion), srt_addr, to));
+    EXPECT_TRUE(sock_addr_cmp(&to, &remote));
+    EXPECT_TRUE(relay.is_srt(data, sizeof(data)));
+    data[15] = 5;
+    EXPECT_FALSE(relay.is_srt(data, sizeof(data)));
+
+    // a remote which has only sent a handshake goes after EHandshakeSec, data makes it last EIdleSec
+    sockaddr_storage spoofed = loopback(4001);
+    int pending = relay.inbound(induction, sizeof(induction), spoofed, created);
+    ASSERT_GE(pending, 0);
+    sockaddr_storage caller = loopback(4002);
+    int answered = relay.inbound(induction, sizeof(induction), caller, created);
+    ASSERT_GE(answered, 0);
+    data[15] = 4;
+    EXPECT_EQ(relay.inbound(data, sizeof(data), caller, created), answered);
+    EXPECT_EQ(relay.size(), 3u);
+    for (int i = 0; i < 3; ++i)
+        ASSERT_GT(recvfrom(srt, buf, sizeof(buf), 0, nullptr, nullptr), 0);
+
+    std::vector<int> closed;
+    Srt_relay::clock::time_point now = Srt_relay::clock::now();
+    relay.expire(now, closed);
+    EXPECT_TRUE(closed.empty());
+    relay.expire(now + std::chrono::seconds(Srt_relay::EHandshakeSec + 1), closed);
+    ASSERT_EQ(closed.size(), 1u);
+    EXPECT_EQ(closed[0], pending);
+    close(pending);
+    closed.clear();
+    relay.expire(now + std::chrono::seconds(Srt_relay::EIdleSec + 1), closed);
+    ASSERT_EQ(closed.size(), 2u);
+    for (int closed_fd: closed)
+        close(closed_fd);
+    EXPECT_EQ(relay.size(), 0u);
+    EXPECT_FALSE(relay.remote_of(local, back));
+    EXPECT_FALSE(relay.is_srt(data, sizeof(data)));
+
+    // an address can't hold more than EMaxPendingPerAddress pending relays
+    for (int i = 0; i < Srt_relay::EMaxPendingPerAddress; ++i)
+        ASSERT_GE(relay.inbound(induction, sizeof(induction), loopback(5000 + i), created), 0);
+    EXPECT_EQ(relay.inbound(induction, sizeof(induction), spoofed, created), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+    EXPECT_EQ(relay.refused(), 3u);
+
+    // a conclusion answered by SRT establishes the relay, it doesn't count as pending anymore
+    int concluded = relay.open(loopback(5000), local, created);
+    EXPECT_FALSE(created);
+    memset(conclusion + 36, 0xff, 4);
+    ASSERT_TRUE(relay.outbound(concluded, conclusion, sizeof(conclusion), srt_addr, to));
+    EXPECT_GE(relay.inbound(induction, sizeof(induction), spoofed, created), 0);
+    EXPECT_TRUE(created);
+
+    // a new pending relay pushes out the oldest one, established ones stay
+    auto other = [](int i) {
+        sockaddr_storage sa = loopback(6000);
+        SOCK_ADDR_IN_ADDR(&sa).s_addr = htonl(0x7f000100 + i);
+        return sa;
+    };
+    for (int i = 0; i < Srt_relay::EMaxPending; ++i)
+        ASSERT_GE(relay.inbound(induction, sizeof(induction), other(i), created), 0);
+    EXPECT_EQ(relay.size(), (size_t) Srt_relay::EMaxPending + 1);
+    closed.clear();
+    relay.expire(Srt_relay::clock::now(), closed);
+    EXPECT_EQ(closed.size(), (size_t) Srt_relay::EMaxPendingPerAddress);
+    for (int closed_fd: closed)
+        close(closed_fd);
+    EXPECT_EQ(relay.open(loopback(5000), local, created), concluded);
+    EXPECT_FALSE(created);
+
+    // the number of relays is limited
+    for (int i = 0; relay.size() < Srt_relay::EMaxRelays; ++i)
+        ASSERT_GE(relay.open(loopback(7000 + i), local, created), 0);
+    EXPECT_EQ(relay.open(loopback(6999), local, created), -1);
+    EXPECT_EQ(errno, ENOBUFS);
+    relay.clear();
+    close(srt);
+}
+
+}
+#endif
+
+ant::Srt_relay::Srt_relay()
+    : _refused(0)
+    , _pending(0)
+{
+    memset(&_listener, 0, sizeof(_listener));
+}
+
+ant::Srt_relay::~Srt_relay()
+{
+    clear();
+}
+
+void ant::Srt_relay::set_listener(sockaddr_storage const& addr)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    _listener = addr;
+}
+
+sockaddr_storage ant::Srt_relay::listener() const
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    return _listener;
+}
+
+size_t ant::Srt_relay::size() const
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    return _relays.size();
+}
+
+uint64_t ant::Srt_relay::refused() const
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    return _refused;
+}
+
+int ant::Srt_relay::open(sockaddr_storage const& remote, sockaddr_storage& local, bool& created)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    Relay *relay = find_or_open(remote, false, created);
+    if (!relay)
+        return -1;
+    // the connection of the application
+    establish(remote, *relay);
+    local = relay->local;
+    return relay->fd;
+}
+
+bool ant::Srt_relay::remote_of(sockaddr_storage const& local, sockaddr_storage& remote) const
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    auto itr = _locals.find(local);
+    if (itr == _locals.end())
+        return false;
+    remote = itr->second;
+    return true;
+}
+
+std::string ant::Srt_relay::address_of(sockaddr_storage const& remote)
+{
+    if (remote.ss_family == AF_INET6)
+        return std::string((const char *) &SOCK_ADDR_IN6_ADDR(&remote), sizeof(in6_addr));
+    return std::string((const char *) &SOCK_ADDR_IN_ADDR(&remote), sizeof(in_addr));
+}
+
+// handshake is false for the relays of the application which are established at once
+ant::Srt_relay::Relay* ant::Srt_relay::find_or_open(sockaddr_storage const& remote, bool handshake,
+    bool& created)
+{
+    created = false;
+    auto itr = _relays.find(remote);
+    if (itr != _relays.end())
+        return &itr->second;
+
+    if (_listener.ss_family != AF_INET && _listener.ss_family != AF_INET6) {
+        errno = ENOTCONN;
+        return nullptr;
+    }
+    if (handshake) {
+        if (_pending_by_address[address_of(remote)] >= EMaxPendingPerAddress) {
+            ++_refused;
+            errno = ENOBUFS;
+            return nullptr;
+        }
+        if (_pending >= EMaxPending)
+            evict_oldest_pending();
+    }
+    if (_relays.size() >= EMaxRelays) {
+        ++_refused;
+        errno = ENOBUFS;
+        return nullptr;
+    }
+    int fd = socket(_listener.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd < 0)
+        return nullptr;
+
+    Relay relay;
+    relay.fd = fd;
+    memset(&relay.local, 0, sizeof(relay.local));
+    relay.local.ss_family = _listener.ss_family;
+    socklen_t len = sizeof(sockaddr_in);
+    if (_listener.ss_family == AF_INET) {
+        SOCK_ADDR_IN_ADDR(&relay.local).s_addr = htonl(INADDR_LOOPBACK);
+    } else {
+        SOCK_ADDR_IN6_ADDR(&relay.local) = in6addr_loopback;
+        len = sizeof(sockaddr_in6);
+    }
+    if (::bind(fd, (sockaddr *) &relay.local, len) || getsockname(fd, (sockaddr *) &relay.local, &len)
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return nullptr;
+    }
+    relay.srt = _listener;
+    relay.active = clock::now();
+    relay.established = false;
+
+    LOG(Log::EDebug, Log::ENet, "srt relay %s for %s\n", print_sockaddr(relay.local).c_str(),
+        print_sockaddr(remote).c_str())
+    created = true;
+    ++_pending;
+    ++_pending_by_address[address_of(remote)];
+    _remotes[fd] = remote;
+    _locals[relay.local] = remote;
+    return &(_relays[remote] = relay);
+}
+
+int ant::Srt_relay::inbound(const uint8_t *buffer, size_t len, sockaddr_storage const& remote, bool& created)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    if (!is_handshake(buffer, len) && !_relays.count(remote)) {
+        if (_listener.ss_family == AF_INET || _listener.ss_family == AF_INET6) {
+            ++_refused;
+            errno = ENOENT;
+        } else {
+            errno = ENOTCONN;
+        }
+        return -1;
+    }
+    Relay *relay = find_or_open(remote, true, created);
+    if (!relay)
+        return -1;
+    relay->active = clock::now();
+    if (!(buffer[0] & 0x80))
+        establish(remote, *relay);
+    socklen_t addr_len = relay->srt.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    // a full SRT queue drops the datagram like the network would
+    if (::sendto(relay->fd, buffer, len, MSG_DONTWAIT, (sockaddr *) &relay->srt, addr_len) < 0)
+        LOG(Log::EDebug, Log::ENet, "srt relay for %s: %s(%d)\n", print_sockaddr(remote).c_str(), strerror(errno),
+            errno)
+    return relay->fd;
+}
+
+bool ant::Srt_relay::outbound(int fd, const uint8_t *buffer, size_t len, sockaddr_storage const& from,
+    sockaddr_storage& remote)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    auto itr = _remotes.find(fd);
+    if (itr == _remotes.end())
+        return false;
+    remote = itr->second;
+    Relay &relay = _relays[remote];
+    // replies go to the SRT socket which talks to the remote, the listener or a caller
+    relay.srt = from;
+    relay.active = clock::now();
+
+    // handshake control packet, the CIF has the handshake type at offset 20 and the SRT socket id at offset 24
+    if (len >= 44 && buffer[0] == 0x80 && buffer[1] == 0) {
+        uint32_t id = read_id(buffer + 40);
+        if (id && _ids.insert(id).second)
+            relay.ids.push_back(id);
+        // SRT answers a conclusion only if the remote has returned its cookie, i.e. the address isn't spoofed
+        if (read_id(buffer + 36) == SRT_HS_CONCLUSION)
+            establish(remote, relay);
+    }
+    return true;
+}
+
+void ant::Srt_relay::establish(sockaddr_storage const& remote, Relay& relay)
+{
+    if (relay.established)
+        return;
+    relay.established = true;
+    --_pending;
+    auto itr = _pending_by_address.find(address_of(remote));
+    if (itr != _pending_by_address.end() && !--itr->second)
+        _pending_by_address.erase(itr);
+}
+
+void ant::Srt_relay::evict_oldest_pending()
+{
+    auto oldest = _relays.end();
+    for (auto itr = _relays.begin(); itr != _relays.end(); ++itr) {
+        if (!itr->second.established && (oldest == _relays.end() || itr->second.active < oldest->second.active))
+            oldest = itr;
+    }
+    if (oldest == _relays.end())
+        return;
+    LOG(Log::EDebug, Log::ENet, "srt relay for %s is pushed out\n", print_sockaddr(oldest->first).c_str())
+    _evicted.push_back(oldest->second.fd);
+    forget(oldest);
+}
+
+void ant::Srt_relay::forget(std::map<sockaddr_storage, Relay, sockaddr_storage_comparator>::iterator itr)
+{
+    Relay &relay = itr->second;
+    establish(itr->first, relay);
+    for (uint32_t id: relay.ids)
+        _ids.erase(id);
+    _remotes.erase(relay.fd);
+    _locals.erase(relay.local);
+    _relays.erase(itr);
+}
+
+void ant::Srt_relay::expire(clock::time_point now, std::vector<int>& closed)
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    closed.insert(closed.end(), _evicted.begin(), _evicted.end());
+    _evicted.clear();
+    for (auto itr = _relays.begin(); itr != _relays.end();) {
+        Relay const& relay = itr->second;
+        if (relay.active >= now - std::chrono::seconds(relay.established ? EIdleSec : EHandshakeSec)) {
+            ++itr;
+            continue;
+        }
+        LOG(Log::EDebug, Log::ENet, "srt relay for %s is idle, closed\n", print_sockaddr(itr->first).c_str())
+        closed.push_back(relay.fd);
+        forget(itr++);
+    }
+}
+
+void ant::Srt_relay::clear()
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    for (auto &itr: _relays)
+        ::close(itr.second.fd);
+    for (int fd: _evicted)
+        ::close(fd);
+    _evicted.clear();
+    _relays.clear();
+    _pending = 0;
+    _pending_by_address.clear();
+    _remotes.clear();
+    _locals.clear();
+    _ids.clear();
+}
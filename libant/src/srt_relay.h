@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/socket.h>
+#include "utils.hpp"
+
+namespace ant {
+
+    // SRT traffic of a port shared with other protocols, see Network::set_srt_demux().
+    // The SRT library owns its UDP sockets, so every remote gets a relay socket on the loopback interface:
+    // datagrams of the remote are passed from it to SRT, and whatever SRT sends to it goes out to the remote.
+    // SRT sees the relay address as its peer.
+    // Only a handshake opens a relay for a remote. Until SRT answers it with a conclusion (the remote has
+    // returned the cookie of the listener) or data passes, the relay is pending: it is closed after EHandshakeSec,
+    // a remote address can have EMaxPendingPerAddress of them and a new one pushes out the oldest of EMaxPending.
+    // So spoofed handshakes can't use up the file descriptors nor keep the established peers out.
+    // Thread safe, except the SRT socket ids which belong to the loop thread.
+    class Srt_relay
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        enum {
+            EHeaderSize = 16,
+            EHandshakeSize = EHeaderSize + 48,  // the header and the handshake CIF
+            EMaxRelays = 256,
+            EMaxPending = 64,
+            EMaxPendingPerAddress = 8,
+            EIdleSec = 60,      // relays without traffic in both directions are closed
+            EHandshakeSec = 5   // pending relays are closed
+        };
+
+        Srt_relay();
+        ~Srt_relay();
+
+        // the SRT listener which gets datagrams of new remotes
+        void set_listener(sockaddr_storage const& addr);
+        sockaddr_storage listener() const;
+
+        // return the relay socket of the remote or -1 (errno is set, ENOBUFS if there are EMaxRelays),
+        // created is set if it has been opened, the relay is established
+        int open(sockaddr_storage const& remote, sockaddr_storage& local, bool& created);
+        // the remote of a relay address
+        bool remote_of(sockaddr_storage const& local, sockaddr_storage& remote) const;
+        size_t size() const;
+        // datagrams of unknown remotes which haven't opened a relay
+        uint64_t refused() const;
+
+        // SRT control packets have the high bit set, data packets carry the id of the destination socket
+        // which is learned from handshakes going out
+        bool is_srt(const uint8_t *buffer, size_t len) const {
+            if (len < EHeaderSize)
+                return false;
+            if (buffer[0] & 0x80)
+                return true;
+            return !_ids.empty() && _ids.count(read_id(buffer + 12));
+        }
+        // a handshake control packet with the full CIF
+        static bool is_handshake(const uint8_t *buffer, size_t len) {
+            return len >= EHandshakeSize && buffer[0] == 0x80 && buffer[1] == 0;
+        }
+
+        // passes a datagram of the remote to SRT, a handshake of an unknown remote opens a relay
+        // return the relay socket or -1 (errno is set, ENOENT if the remote is unknown and it isn't a handshake,
+        // ENOBUFS if there are EMaxRelays or the address has EMaxPendingPerAddress), created is set if it has been opened
+        int inbound(const uint8_t *buffer, size_t len, sockaddr_storage const& remote, bool& created);
+        // a datagram SRT sent to the relay socket from the from address
+        // return false if fd isn't a relay, otherwise remote is the destination
+        bool outbound(int fd, const uint8_t *buffer, size_t len, sockaddr_storage const& from,
+            sockaddr_storage& remote);
+
+        // moves relays idle for EIdleSec, pending for EHandshakeSec or pushed out to closed,
+        // the caller closes the sockets
+        void expire(clock::time_point now, std::vector<int>& closed);
+        void clear();
+
+    private:
+        struct Relay {
+            int fd;
+            sockaddr_storage local;
+            sockaddr_storage srt;       // the SRT socket the remote talks to
+            clock::time_point active;
+            bool established;           // SRT has accepted the handshake, data has passed or the connection is ours
+            std::vector<uint32_t> ids;  // local SRT sockets announced through the relay
+        };
+
+        static uint32_t read_id(const uint8_t *p) {
+            return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+        }
+        // the address without port
+        static std::string address_of(sockaddr_storage const& remote);
+        // return the relay or nullptr (errno is set), _mt is locked
+        Relay* find_or_open(sockaddr_storage const& remote, bool handshake, bool& created);
+        void establish(sockaddr_storage const& remote, Relay& relay);
+        // the relay is moved to _evicted, _mt is locked
+        void evict_oldest_pending();
+        void forget(std::map<sockaddr_storage, Relay, sockaddr_storage_comparator>::iterator itr);
+
+        mutable std::mutex _mt;
+        sockaddr_storage _listener;
+        std::map<sockaddr_storage, Relay, sockaddr_storage_comparator> _relays;
+        std::unordered_map<int, sockaddr_storage> _remotes;
+        std::map<sockaddr_storage, sockaddr_storage, sockaddr_storage_comparator> _locals;
+        uint64_t _refused;
+        size_t _pending;
+        std::unordered_map<std::string, int> _pending_by_address;
+        // sockets of pushed out relays for the next expire()
+        std::vector<int> _evicted;
+        // loop thread only
+        std::unordered_set<uint32_t> _ids;
+    };
+
+}
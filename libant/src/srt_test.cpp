@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <thread>
+#include <future>
 #include <getopt.h>
 #include <memory>
 #include <random>
@@ -35,6 +36,7 @@
 #include "libsrt.h"
 #include "bencode.h"
 #include "stat.h"
+#include "thread_util.h"
 
 
 const int DEFAULT_PORT = 3010;
@@ -486,6 +488,7 @@ private:
 
     void thread_proc()
     {
+        ant::set_thread_name("srt-test");
         // prepare sending buffer
         std::vector<uint8_t> buffer(o_bufsize);
         unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
@@ -585,6 +588,21 @@ protected:
                 last_stat.pktSent, last_stat.byteSent, last_stat.mbpsSendRate, last_stat.pktRetrans, pktUnackedSent,
                 last_stat.pktRecv, last_stat.byteRecv, last_stat.mbpsRecvRate, last_stat.pktRcvLoss,
                 last_stat.msRTT, last_stat.mbpsBandwidth)
+
+            if (last_stat.pktSndDrop || last_stat.pktRcvDrop) {
+                LOG(ant::Log::EInfo, ant::Log::EAnt,
+                    "connection(%d): dropped by SRT buffers: send %d pkt, recv %d pkt\n",
+                    itr.first, last_stat.pktSndDrop, last_stat.pktRcvDrop)
+            }
+
+            ant::Latency_histogram delivery;
+            if (_srt->delivery_latency(itr.first, delivery) && delivery.count()) {
+                LOG(ant::Log::EInfo, ant::Log::EAnt,
+                    "connection(%d): delivery latency: %llu msg, min %llu us, p50 %llu us, p99 %llu us, max %llu us\n",
+                    itr.first, (unsigned long long) delivery.count(), (unsigned long long) delivery.min(),
+                    (unsigned long long) delivery.percentile(50), (unsigned long long) delivery.percentile(99),
+                    (unsigned long long) delivery.max())
+            }
         }
     }
 
@@ -653,18 +671,29 @@ void ant_tests::ANTSrtTest::start() {
     
     ant::Network::ptr net(new ant::Network(0));
     
-    // choose appropriate interface and port
+    // the network listens on all interfaces, the loop looks up the one for SRT meanwhile
     sockaddr_storage bind_interface;
-    ant::Network::find_interface("router.bittorrent.com", 6881, bind_interface);
+    memset(&bind_interface, 0, sizeof(bind_interface));
+    bind_interface.ss_family = AF_INET;
     ant::set_port(bind_interface, o_local_ant_port);
-    LOG(ant::Log::EDebug, ant::Log::ENet, "appropriate local interface is %s, network port %d, srt port\n",
-        ant::sockaddr_storage_to_host_name(bind_interface).c_str(), o_local_ant_port, o_local_srt_port);
-    
     if (net->start(bind_interface)) {
         std::cerr << "Network can't start" << std::endl;
         exit(1);
     }
 
+    // choose appropriate interface, a name which can't be resolved doesn't hold the start up
+    std::shared_ptr<std::promise<sockaddr_storage>> found = std::make_shared<std::promise<sockaddr_storage>>();
+    net->find_interface_async("router.bittorrent.com", 6881, [found](int error, sockaddr_storage const& local_addr) {
+        if (!error)
+            found->set_value(local_addr);
+    });
+    std::future<sockaddr_storage> srt_interface = found->get_future();
+    sockaddr_storage srt_addr = net->getbindaddr();
+    if (srt_interface.wait_for(std::chrono::seconds(5)) == std::future_status::ready)
+        srt_addr = srt_interface.get();
+    LOG(ant::Log::EDebug, ant::Log::ENet, "appropriate local interface is %s, network port %d, srt port %d\n",
+        ant::sockaddr_storage_to_host_name(srt_addr).c_str(), o_local_ant_port, o_local_srt_port);
+
     
     std::string ip;
     uint16_t port = DEFAULT_PORT;
@@ -682,7 +711,7 @@ void ant_tests::ANTSrtTest::start() {
     std::this_thread::sleep_for(std::chrono::seconds(1));
     // TODO этот старт стоит разделить, он разный для конектора и ассептора
     // это вызывет проблемы при мультиконекте так как тогда нам нужно передать столько callback сколько конектов
-    app->start(net->getbindaddr(), o_local_srt_port, o_remote_address, connect_callback);
+    app->start(srt_addr, o_local_srt_port, o_remote_address, connect_callback);
     
     if (o_listen== true && o_server_proxy) {
         // _local_srt_addr <- _proxy_addr <- _remote_addr
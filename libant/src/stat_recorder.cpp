@@ -0,0 +1,258 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stat_recorder.h"
+#include "logger.h"
+#ifdef ANT_UNIT_TESTS
+# include <atomic>
+# include <thread>
+# include <gtest/gtest.h>
+#endif
+
+static const char STAT_MAGIC[8] = {'A', 'N', 'T', 'S', 'T', 'A', 'T', 0};
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Stat_recorder, ring)
+{
+    char path[] = "/tmp/ant_stat_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+
+    Stat_recorder recorder;
+    ASSERT_EQ(recorder.open(path, 8), 0);
+    for (int i = 0; i < 10; ++i) {
+        Stat_record record;
+        memset(&record, 0, sizeof(record));
+        record.time_us = 1000 + i;
+        record.conn_id = 5;
+        record.sent_bytes = i * 100;
+        recorder.record(record);
+    }
+    EXPECT_EQ(recorder.recorded(), 10u);
+
+    // the last 8 from the oldest one
+    std::vector<Stat_record> records;
+    ASSERT_EQ(Stat_recorder::read(path, records), 0);
+    ASSERT_EQ(records.size(), 8u);
+    EXPECT_EQ(records[0].seq, 3u);
+    EXPECT_EQ(records[0].time_us, 1002u);
+    EXPECT_EQ(records[7].sent_bytes, 900u);
+    EXPECT_EQ(records[7].conn_id, 5);
+
+    // reopened with the same capacity the file goes on
+    recorder.close();
+    ASSERT_EQ(recorder.open(path, 8), 0);
+    Stat_record record;
+    memset(&record, 0, sizeof(record));
+    recorder.record(record);
+    EXPECT_EQ(recorder.recorded(), 11u);
+    ASSERT_EQ(Stat_recorder::read(path, records), 0);
+    ASSERT_EQ(records.size(), 8u);
+    EXPECT_EQ(records[7].seq, 11u);
+    EXPECT_GT(records[7].time_us, 1000000u);
+    recorder.close();
+
+    // another capacity starts over
+    ASSERT_EQ(recorder.open(path, 16), 0);
+    EXPECT_EQ(recorder.recorded(), 0u);
+    recorder.close();
+    ASSERT_EQ(Stat_recorder::read(path, records), 0);
+    EXPECT_TRUE(records.empty());
+
+    fd = ::open(path, O_WRONLY | O_TRUNC);
+    ASSERT_EQ(write(fd, "not a record file", 17), 17);
+    ::close(fd);
+    EXPECT_EQ(Stat_recorder::read(path, records), EINVAL);
+    unlink(path);
+}
+
+TEST(Stat_recorder, live)
+{
+    char path[] = "/tmp/ant_stat_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ::close(fd);
+
+    // a small ring is overwritten while it is read, no record is torn
+    Stat_recorder recorder;
+    ASSERT_EQ(recorder.open(path, 4), 0);
+    std::atomic<bool> stop{false};
+    std::thread writer([&recorder, &stop]() {
+        for (uint64_t i = 1; !stop; ++i) {
+            Stat_record record;
+            memset(&record, 0, sizeof(record));
+            record.time_us = i;
+            record.sent_bytes = i;
+            record.sending_bytes = i;
+            recorder.record(record);
+        }
+    });
+    while (recorder.recorded() < 8)
+        std::this_thread::yield();
+    size_t read = 0;
+    for (int i = 0; i < 200; ++i) {
+        std::vector<Stat_record> records;
+        ASSERT_EQ(Stat_recorder::read(path, records), 0);
+        for (auto &record: records) {
+            EXPECT_EQ(record.sent_bytes, record.time_us);
+            EXPECT_EQ(record.sending_bytes, record.time_us);
+        }
+        read += records.size();
+    }
+    stop = true;
+    writer.join();
+    EXPECT_GT(read, 0u);
+    recorder.close();
+    unlink(path);
+}
+
+}
+#endif
+
+ant::Stat_recorder::Stat_recorder()
+    : _header(nullptr)
+    , _records(nullptr)
+    , _size(0)
+{
+}
+
+ant::Stat_recorder::~Stat_recorder()
+{
+    close();
+}
+
+uint64_t ant::Stat_recorder::now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int ant::Stat_recorder::open(std::string const& path, size_t capacity)
+{
+    close();
+    if (!capacity)
+        return EINVAL;
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return errno;
+    size_t size = sizeof(Header) + capacity * sizeof(Stat_record);
+    struct stat st;
+    Header header;
+    bool reuse = fstat(fd, &st) == 0 && (size_t) st.st_size == size
+        && pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+        && !memcmp(header.magic, STAT_MAGIC, sizeof(STAT_MAGIC)) && header.version == EVersion
+        && header.record_size == sizeof(Stat_record) && header.capacity == capacity;
+    if (!reuse && (ftruncate(fd, 0) || ftruncate(fd, size))) {
+        int error = errno;
+        ::close(fd);
+        return error;
+    }
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        LOG(Log::EError, Log::EAnt, "stat recorder %s: mmap: %s(%d)\n", path.c_str(), strerror(error), error)
+        return error;
+    }
+
+    _header = (Header *) map;
+    _records = (Stat_record *) ((char *) map + sizeof(Header));
+    _size = size;
+    if (!reuse) {
+        memcpy(_header->magic, STAT_MAGIC, sizeof(STAT_MAGIC));
+        _header->version = EVersion;
+        _header->record_size = sizeof(Stat_record);
+        _header->capacity = capacity;
+        _header->next.store(0, std::memory_order_relaxed);
+        _header->created_us = now_us();
+    }
+    LOG(Log::EInfo, Log::EAnt, "stat recorder %s: %llu records of %llu\n", path.c_str(),
+        (unsigned long long) _header->next.load(), (unsigned long long) capacity)
+    return 0;
+}
+
+void ant::Stat_recorder::close()
+{
+    if (!_header)
+        return;
+    munmap(_header, _size);
+    _header = nullptr;
+    _records = nullptr;
+    _size = 0;
+}
+
+uint64_t ant::Stat_recorder::recorded() const
+{
+    return _header ? _header->next.load(std::memory_order_relaxed) : 0;
+}
+
+void ant::Stat_recorder::record(Stat_record const& record)
+{
+    if (!_header)
+        return;
+    uint64_t seq = _header->next.fetch_add(1, std::memory_order_relaxed);
+    Stat_record *slot = _records + seq % _header->capacity;
+    // a reader of a live file or of a crash leftover skips the slot until seq is set
+    slot->seq = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy((char *) slot + sizeof(slot->seq), (char const *) &record + sizeof(record.seq),
+           sizeof(Stat_record) - sizeof(slot->seq));
+    if (!slot->time_us)
+        slot->time_us = now_us();
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->seq = seq + 1;
+}
+
+int ant::Stat_recorder::read(std::string const& path, std::vector<Stat_record>& records)
+{
+    records.clear();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return errno;
+    struct stat st;
+    Header header;
+    if (fstat(fd, &st) || pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)
+        || memcmp(header.magic, STAT_MAGIC, sizeof(STAT_MAGIC)) || header.version != EVersion
+        || header.record_size != sizeof(Stat_record) || !header.capacity
+        || (size_t) st.st_size != sizeof(Header) + header.capacity * sizeof(Stat_record)) {
+        ::close(fd);
+        return EINVAL;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return error;
+
+    Header const* file = (Header const*) map;
+    Stat_record const* slots = (Stat_record const*) ((char const*) map + sizeof(Header));
+    uint64_t next = file->next.load(std::memory_order_acquire);
+    uint64_t first = next > header.capacity ? next - header.capacity : 0;
+    records.reserve(next - first);
+    for (uint64_t seq = first; seq < next; ++seq) {
+        // a writer can overwrite the slot while it is copied, it is accepted if seq didn't change
+        Stat_record const volatile& slot = slots[seq % header.capacity];
+        uint64_t slot_seq = slot.seq;
+        if (slot_seq != seq + 1)
+            continue;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        Stat_record record;
+        memcpy(&record, (void const*) &slot, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq != slot_seq)
+            continue;
+        record.seq = slot_seq;
+        records.push_back(record);
+    }
+    munmap(map, size);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ant {
+
+    // A sample of a connection, 64 bytes in the file. The counters are totals since the connection started,
+    // differences of neighbour records give the rates.
+    struct Stat_record {
+        uint64_t seq;               // record number + 1 in the file, 0 while the slot is written
+        uint64_t time_us;           // system clock, records of several files merge by it
+        int32_t conn_id;
+        uint32_t buffer_bytes;      // send queue of the connection
+        uint64_t sent_bytes;        // handed to SRT
+        uint64_t sending_bytes;     // queued by the application
+        uint32_t rtt_us;            // SRT estimate
+        uint32_t loss_pkts;         // lost packets reported by the receiver
+        uint32_t retrans_pkts;
+        uint32_t bandwidth_kbps;    // SRT estimate of the link capacity
+        uint64_t reserved;
+    };
+    static_assert(sizeof(Stat_record) == 64, "Stat_record is a file format");
+
+    // Appends Stat_records to a memory-mapped ring file, the oldest ones are overwritten.
+    // record() copies into the mapping without system calls or formatting, the kernel writes the pages
+    // back, so the history survives a crash of the process. Thread safe.
+    class Stat_recorder
+    {
+    public:
+        enum {
+            EVersion = 1,
+            EDefaultCapacity = 1 << 20      // 64 MB
+        };
+
+        Stat_recorder();
+        ~Stat_recorder();
+
+        Stat_recorder(Stat_recorder const&) = delete;
+        Stat_recorder& operator=(Stat_recorder const&) = delete;
+
+        // a file of the same capacity is continued, anything else is overwritten
+        // return 0 if success or system error code
+        int open(std::string const& path, size_t capacity = EDefaultCapacity);
+        void close();
+        bool is_open() const { return _header != nullptr; }
+
+        // seq is assigned, time_us is set if it is 0
+        void record(Stat_record const& record);
+        uint64_t recorded() const;
+
+        // the records of a file from the oldest one, torn records are skipped
+        // return 0 if success, system error code or EINVAL if it isn't a record file
+        static int read(std::string const& path, std::vector<Stat_record>& records);
+
+        static uint64_t now_us();
+
+    private:
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+            uint64_t capacity;
+            std::atomic<uint64_t> next;     // records written since the file was created
+            uint64_t created_us;
+            uint8_t reserved[24];
+        };
+        static_assert(sizeof(Header) == sizeof(Stat_record), "records follow the header");
+
+        Header *_header;
+        Stat_record *_records;
+        size_t _size;
+    };
+
+}
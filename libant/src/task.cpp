@@ -0,0 +1,106 @@
+#include <mutex>
+#include <vector>
+#include <memory>
+#include "task.h"
+#ifdef ANT_UNIT_TESTS
+# include <functional>
+# include <gtest/gtest.h>
+#endif
+
+namespace {
+
+    std::mutex& pool_mutex()
+    {
+        static std::mutex mt;
+        return mt;
+    }
+
+    std::vector<void*>& free_blocks()
+    {
+        static std::vector<void*> blocks;
+        return blocks;
+    }
+
+}
+
+void* ant::Task_pool::allocate(size_t size)
+{
+    if (size > EBlockSize)
+        return ::operator new(size);
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex());
+        std::vector<void*>& blocks = free_blocks();
+        if (!blocks.empty()) {
+            void* p = blocks.back();
+            blocks.pop_back();
+            return p;
+        }
+    }
+    return ::operator new(EBlockSize);
+}
+
+void ant::Task_pool::deallocate(void* p, size_t size) noexcept
+{
+    if (size <= EBlockSize) {
+        std::lock_guard<std::mutex> lock(pool_mutex());
+        std::vector<void*>& blocks = free_blocks();
+        if (blocks.size() < EMaxFreeBlocks) {
+            blocks.push_back(p);
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Task, storage)
+{
+    int calls = 0;
+    Task empty;
+    EXPECT_FALSE(empty);
+
+    // small capture is stored inline
+    Task small([&calls]() { ++calls; });
+    EXPECT_TRUE(small.is_inline());
+    small();
+    EXPECT_EQ(calls, 1);
+
+    // move-only capture
+    std::unique_ptr<int> value(new int(10));
+    Task move_only(std::bind([&calls](std::unique_ptr<int>& v) { calls += *v; }, std::move(value)));
+    Task moved(std::move(move_only));
+    EXPECT_FALSE(move_only);
+    moved();
+    EXPECT_EQ(calls, 11);
+
+    // big capture is pooled
+    struct Big {
+        char payload[Task::EInlineSize * 2];
+        int* calls;
+        void operator()() { ++*calls; }
+    };
+    Big big;
+    big.calls = &calls;
+    Task pooled(big);
+    EXPECT_FALSE(pooled.is_inline());
+    Task assigned;
+    assigned = std::move(pooled);
+    assigned();
+    EXPECT_EQ(calls, 12);
+    assigned.reset();
+    EXPECT_FALSE(assigned);
+
+    // captured objects are destroyed exactly once
+    std::shared_ptr<int> shared = std::make_shared<int>(0);
+    {
+        Task a([shared]() {});
+        Task b(std::move(a));
+        EXPECT_EQ(shared.use_count(), 2);
+    }
+    EXPECT_EQ(shared.use_count(), 1);
+}
+
+}
+#endif
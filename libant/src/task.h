@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ant {
+
+    // Fixed size blocks for callables which don't fit into Task, shared by all threads.
+    class Task_pool
+    {
+    public:
+        enum {
+            EBlockSize = 512,
+            EMaxFreeBlocks = 1024
+        };
+
+        static void* allocate(size_t size);
+        static void deallocate(void* p, size_t size) noexcept;
+    };
+
+    // Move-only void() callable.
+    // Callables up to EInlineSize bytes (i.e. a bound Srt_events call with a connection id and sockaddr_storage)
+    // are stored inline, bigger ones are placed into Task_pool blocks.
+    class Task
+    {
+    public:
+        enum { EInlineSize = 176 };
+
+        Task() noexcept : _ops(nullptr) {}
+
+        template<typename F, typename = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+        Task(F&& f) : _ops(nullptr) {
+            typedef typename std::decay<F>::type Callable;
+            construct<Callable>(std::forward<F>(f), std::integral_constant<bool, fits_inline<Callable>()>());
+        }
+
+        Task(Task&& other) noexcept : _ops(other._ops) {
+            if (_ops) {
+                _ops->move(_storage, other._storage);
+                other._ops = nullptr;
+            }
+        }
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                reset();
+                _ops = other._ops;
+                if (_ops) {
+                    _ops->move(_storage, other._storage);
+                    other._ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        Task(Task const&) = delete;
+        Task& operator=(Task const&) = delete;
+
+        ~Task() { reset(); }
+
+        void operator()() { _ops->invoke(_storage); }
+
+        explicit operator bool() const noexcept { return _ops != nullptr; }
+
+        bool is_inline() const noexcept { return _ops && _ops->is_inline; }
+
+        void reset() noexcept {
+            if (_ops) {
+                _ops->destroy(_storage);
+                _ops = nullptr;
+            }
+        }
+
+    private:
+        struct Ops {
+            void (*invoke)(void* storage);
+            void (*move)(void* dst, void* src) noexcept;
+            void (*destroy)(void* storage) noexcept;
+            bool is_inline;
+        };
+
+        template<typename F>
+        static constexpr bool fits_inline() {
+            return sizeof(F) <= EInlineSize && alignof(F) <= alignof(std::max_align_t)
+                && std::is_nothrow_move_constructible<F>::value;
+        }
+
+        template<typename F>
+        struct Inline_ops {
+            static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+            static void move(void* dst, void* src) noexcept {
+                new (dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            }
+            static void destroy(void* storage) noexcept { static_cast<F*>(storage)->~F(); }
+            static Ops const* ops() {
+                static const Ops inst = { &invoke, &move, &destroy, true };
+                return &inst;
+            }
+        };
+
+        template<typename F>
+        struct Pooled_ops {
+            static F* target(void* storage) { return *static_cast<F**>(storage); }
+            static void invoke(void* storage) { (*target(storage))(); }
+            static void move(void* dst, void* src) noexcept { *static_cast<F**>(dst) = target(src); }
+            static void destroy(void* storage) noexcept {
+                F* f = target(storage);
+                f->~F();
+                Task_pool::deallocate(f, sizeof(F));
+            }
+            static Ops const* ops() {
+                static const Ops inst = { &invoke, &move, &destroy, false };
+                return &inst;
+            }
+        };
+
+        template<typename F, typename Arg>
+        void construct(Arg&& f, std::true_type /*inline*/) {
+            new (_storage) F(std::forward<Arg>(f));
+            _ops = Inline_ops<F>::ops();
+        }
+
+        template<typename F, typename Arg>
+        void construct(Arg&& f, std::false_type /*inline*/) {
+            void* p = Task_pool::allocate(sizeof(F));
+            try {
+                *reinterpret_cast<F**>(_storage) = new (p) F(std::forward<Arg>(f));
+            } catch (...) {
+                Task_pool::deallocate(p, sizeof(F));
+                throw;
+            }
+            _ops = Pooled_ops<F>::ops();
+        }
+
+        alignas(std::max_align_t) unsigned char _storage[EInlineSize];
+        Ops const* _ops;
+    };
+
+}
@@ -0,0 +1,309 @@
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "thread_util.h"
+#include "logger.h"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Spin_budget, timeout)
+{
+    Spin_budget idle;
+    EXPECT_EQ(idle.timeout(250), 250);
+    idle.on_poll(true);
+    EXPECT_EQ(idle.timeout(250), 250);
+
+    Spin_budget budget(20000);
+    // nothing has happened yet
+    EXPECT_EQ(budget.timeout(250), 250);
+    budget.on_poll(true);
+    EXPECT_TRUE(budget.spinning());
+    EXPECT_EQ(budget.timeout(250), 0);
+    for (int i = 0; i < 200; ++i)
+        budget.on_poll(false);
+    EXPECT_EQ(budget.timeout(250), 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    EXPECT_FALSE(budget.spinning());
+    EXPECT_EQ(budget.timeout(250), 250);
+
+    budget.set(0);
+    budget.on_poll(true);
+    EXPECT_EQ(budget.timeout(250), 250);
+}
+
+#ifdef __linux__
+TEST(Spin_budget, realtime)
+{
+    // a SCHED_FIFO spinner sleeps instead of yielding, other classes wouldn't get the CPU otherwise
+    std::thread t([]() {
+        if (set_realtime(1))
+            return;     // not permitted
+        Spin_budget budget(100000);
+        budget.on_poll(true);
+        for (int i = 0; i < Spin_budget::EYieldAfterPolls; ++i)
+            budget.on_poll(false);
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_EQ(budget.timeout(250), 0);
+        EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::microseconds(Spin_budget::ERealtimeSleepUs));
+        set_realtime(0);
+    });
+    t.join();
+}
+#endif
+
+TEST(Loop_meter, stats)
+{
+    Loop_meter meter;
+    std::thread t([&meter]() {
+        meter.start("ant-test-thread-name");
+#ifdef __linux__
+        char name[16];
+        ASSERT_EQ(pthread_getname_np(pthread_self(), name, sizeof(name)), 0);
+        EXPECT_STREQ(name, "ant-test-thread");
+#endif
+        for (int i = 0; i < 3; ++i) {
+            // 20 ms of CPU, then idle for 20 ms
+            uint64_t until = thread_cpu_ns() + 20000000;
+            while (thread_cpu_ns() < until)
+                ;
+            meter.begin_wait();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            meter.end_wait();
+        }
+        Thread_stats running = meter.stats();
+        EXPECT_GE(running.cpu_ns, 40000000u);
+        meter.stop();
+    });
+    t.join();
+
+    Thread_stats stats = meter.stats();
+    EXPECT_STREQ(stats.name, "ant-test-thread-name");
+    EXPECT_EQ(stats.iterations, 3u);
+    EXPECT_GE(stats.cpu_ns, 60000000u);
+    EXPECT_GE(stats.idle_ns, 60000000u);
+    EXPECT_GT(stats.busy_ratio(), 0.3);
+    EXPECT_GT(stats.cpu_utilization(), 0.2);
+    EXPECT_LE(stats.cpu_utilization(), 1.05);
+}
+
+#ifdef __linux__
+TEST(Latency_mode, pin_thread)
+{
+    std::thread t([]() {
+        cpu_set_t allowed;
+        ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+        int cpu = 0;
+        while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &allowed))
+            ++cpu;
+        Latency_mode mode;
+        mode.cpu = cpu;
+        EXPECT_EQ(apply_latency_mode(mode, "test"), 0);
+        EXPECT_EQ(sched_getcpu(), cpu);
+        EXPECT_EQ(pin_thread(CPU_SETSIZE), EINVAL);
+    });
+    t.join();
+}
+#endif
+
+}
+#endif
+
+int ant::pin_thread(int cpu)
+{
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return EINVAL;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    // macOS has affinity tags only, which are hints for cache sharing
+    return EOPNOTSUPP;
+#endif
+}
+
+int ant::set_realtime(int priority)
+{
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param);
+}
+
+int ant::apply_latency_mode(Latency_mode const& mode, const char *name)
+{
+    int error = 0;
+    if (mode.cpu >= 0) {
+        int rc = pin_thread(mode.cpu);
+        if (rc)
+            LOG(Log::EWarning, Log::ENet, "%s thread can't be pinned to CPU %d: %s(%d)\n", name, mode.cpu,
+                strerror(rc), rc)
+        else
+            LOG(Log::EInfo, Log::ENet, "%s thread is pinned to CPU %d\n", name, mode.cpu)
+        error = rc;
+    }
+    if (mode.rt_priority > 0) {
+        // needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance
+        int rc = set_realtime(mode.rt_priority);
+        if (rc)
+            LOG(Log::EWarning, Log::ENet, "%s thread can't run SCHED_FIFO %d: %s(%d)\n", name, mode.rt_priority,
+                strerror(rc), rc)
+        if (!error)
+            error = rc;
+    }
+    return error;
+}
+
+ant::Spin_budget::Spin_budget(int spin_us)
+    : _spin(0)
+    , _last_event()
+    , _empty_polls(0)
+    , _realtime(false)
+{
+    set(spin_us);
+}
+
+void ant::Spin_budget::set(int spin_us)
+{
+    _spin = std::chrono::microseconds(spin_us > 0 ? spin_us : 0);
+    int policy = SCHED_OTHER;
+    sched_param param;
+    _realtime = _spin.count() && pthread_getschedparam(pthread_self(), &policy, &param) == 0
+        && (policy == SCHED_FIFO || policy == SCHED_RR);
+}
+
+int ant::Spin_budget::timeout(int blocking_ms)
+{
+    if (!spinning())
+        return blocking_ms;
+    if (_empty_polls >= EYieldAfterPolls) {
+        _empty_polls = 0;
+        if (_realtime)
+            std::this_thread::sleep_for(std::chrono::microseconds(ERealtimeSleepUs));
+        else
+            std::this_thread::yield();
+    }
+    return 0;
+}
+
+void ant::Spin_budget::on_poll(bool active)
+{
+    if (!_spin.count())
+        return;
+    if (active) {
+        _last_event = clock::now();
+        _empty_polls = 0;
+    } else {
+        ++_empty_polls;
+    }
+}
+
+void ant::set_thread_name(const char *name)
+{
+#if defined(__APPLE__)
+    pthread_setname_np(name);
+#elif defined(__linux__)
+    // longer names are refused with ERANGE
+    char buf[16];
+    strncpy(buf, name, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    pthread_setname_np(pthread_self(), buf);
+#else
+    (void) name;
+#endif
+}
+
+uint64_t ant::thread_cpu_ns()
+{
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+ant::Loop_meter::Loop_meter()
+    : _name("")
+    , _iterations(0)
+    , _busy_ns(0)
+    , _idle_ns(0)
+    , _cpu_ns(0)
+    , _mark()
+    , _sampled()
+    , _cpu_start(0)
+    , _running(false)
+{
+}
+
+void ant::Loop_meter::start(const char *name)
+{
+    set_thread_name(name);
+    std::lock_guard<std::mutex> lock(_mt);
+    _name = name;
+    _iterations = 0;
+    _busy_ns = 0;
+    _idle_ns = 0;
+    _cpu_ns = 0;
+    _cpu_start = thread_cpu_ns();
+    _mark = _sampled = clock::now();
+    _running = true;
+#ifdef __linux__
+    _running = pthread_getcpuclockid(pthread_self(), &_cpu_clock) == 0;
+#endif
+}
+
+void ant::Loop_meter::stop()
+{
+    std::lock_guard<std::mutex> lock(_mt);
+    _busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _mark).count();
+    _cpu_ns = thread_cpu_ns() - _cpu_start;
+    _running = false;
+}
+
+void ant::Loop_meter::begin_wait()
+{
+    clock::time_point now = clock::now();
+    _busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - _mark).count(),
+        std::memory_order_relaxed);
+    _mark = now;
+}
+
+void ant::Loop_meter::end_wait()
+{
+    clock::time_point now = clock::now();
+    _idle_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(now - _mark).count(),
+        std::memory_order_relaxed);
+    _iterations.fetch_add(1, std::memory_order_relaxed);
+    _mark = now;
+#ifndef __linux__
+    if (now - _sampled >= std::chrono::milliseconds(100)) {
+        _sampled = now;
+        _cpu_ns.store(thread_cpu_ns() - _cpu_start, std::memory_order_relaxed);
+    }
+#endif
+}
+
+ant::Thread_stats ant::Loop_meter::stats() const
+{
+    Thread_stats stats;
+    std::lock_guard<std::mutex> lock(_mt);
+    stats.name = _name;
+    stats.iterations = _iterations.load(std::memory_order_relaxed);
+    stats.busy_ns = _busy_ns.load(std::memory_order_relaxed);
+    stats.idle_ns = _idle_ns.load(std::memory_order_relaxed);
+    stats.cpu_ns = _cpu_ns.load(std::memory_order_relaxed);
+#ifdef __linux__
+    timespec ts;
+    if (_running && !clock_gettime(_cpu_clock, &ts))
+        stats.cpu_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec - _cpu_start;
+#endif
+    return stats;
+}
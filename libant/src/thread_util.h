@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <time.h>
+
+namespace ant {
+
+    // Scheduling of a loop thread for tick-sensitive traffic.
+    // The defaults leave the thread to the scheduler and block as soon as there is nothing to do.
+    struct Latency_mode {
+        int cpu;            // CPU the thread is pinned to, -1 for any
+        int rt_priority;    // SCHED_FIFO priority 1..99, 0 keeps the normal class
+        int spin_us;        // the loop polls without blocking for this long after the last event
+        // SO_BUSY_POLL of the socket: the kernel polls the device queue on a blocking receive.
+        // The loops read non-blocking after epoll, which busy polls only if the net.core.busy_poll sysctl
+        // is set, so without it the option does nothing.
+        int busy_poll_us;
+
+        Latency_mode()
+            : cpu(-1)
+            , rt_priority(0)
+            , spin_us(0)
+            , busy_poll_us(0)
+        {}
+    };
+
+    // return 0 if success or system error code, they act on the calling thread
+    // pinning is Linux only, other platforms return EOPNOTSUPP
+    int pin_thread(int cpu);
+    int set_realtime(int priority);
+    // applies cpu and rt_priority, failures are logged and the first error code is returned
+    int apply_latency_mode(Latency_mode const& mode, const char *name);
+
+    // names the calling thread for top -H, ps and debuggers, Linux keeps the first 15 characters
+    void set_thread_name(const char *name);
+    // CPU time consumed by the calling thread in nanoseconds, user and system
+    uint64_t thread_cpu_ns();
+
+    struct Thread_stats {
+        const char *name;
+        uint64_t iterations;    // loop iterations
+        uint64_t cpu_ns;        // CPU time of the thread since start()
+        uint64_t busy_ns;       // wall time outside the wait
+        uint64_t idle_ns;       // wall time blocked in the wait
+        // CPU time over wall time, 1.0 is a whole core
+        double cpu_utilization() const {
+            return busy_ns + idle_ns ? (double) cpu_ns / (busy_ns + idle_ns) : 0;
+        }
+        double busy_ratio() const {
+            return busy_ns + idle_ns ? (double) busy_ns / (busy_ns + idle_ns) : 0;
+        }
+    };
+
+    // Accounts the time of a loop thread. The thread calls start() and stop(), and begin_wait()/end_wait()
+    // around its blocking call, which is an iteration. stats() can be called from any thread: on Linux it
+    // reads the CPU clock of the running thread, elsewhere the loop samples its clock every 100 ms.
+    class Loop_meter
+    {
+    public:
+        Loop_meter();
+
+        Loop_meter(Loop_meter const&) = delete;
+        Loop_meter& operator=(Loop_meter const&) = delete;
+
+        // names the calling thread and resets the counters
+        void start(const char *name);
+        void stop();
+        void begin_wait();
+        void end_wait();
+
+        Thread_stats stats() const;
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        const char *_name;
+        std::atomic<uint64_t> _iterations;
+        std::atomic<uint64_t> _busy_ns;
+        std::atomic<uint64_t> _idle_ns;
+        std::atomic<uint64_t> _cpu_ns;      // the last sample
+        // loop thread only
+        clock::time_point _mark;            // start of the current busy or idle span
+        clock::time_point _sampled;
+        uint64_t _cpu_start;
+
+        mutable std::mutex _mt;             // stop() waits for readers of the thread clock
+        bool _running;
+#ifdef __linux__
+        clockid_t _cpu_clock;
+#endif
+    };
+
+    // Decides how long the loop waits: nothing while it is spinning, the blocking timeout otherwise.
+    // Empty polls of a long spin give the CPU away now and then, so a pinned thread doesn't starve others:
+    // a yield, or a short sleep if the thread is SCHED_FIFO/SCHED_RR, since a real-time thread
+    // yields to real-time threads only.
+    // Not thread safe: all calls must come from the loop thread, set() and the constructor check its class.
+    class Spin_budget
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        enum {
+            EYieldAfterPolls = 64,  // empty polls in a row before each yield
+            ERealtimeSleepUs = 50   // instead of the yield of a real-time thread
+        };
+
+        explicit Spin_budget(int spin_us = 0);
+
+        void set(int spin_us);
+        bool spinning() const {
+            return _spin.count() > 0 && clock::now() - _last_event < _spin;
+        }
+
+        // the wait timeout in milliseconds, blocking_ms once the budget since the last event is spent
+        int timeout(int blocking_ms);
+        // reports whether the last wait delivered events
+        void on_poll(bool active);
+
+    private:
+        std::chrono::microseconds _spin;
+        clock::time_point _last_event;
+        unsigned _empty_polls;
+        bool _realtime;
+    };
+
+}
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <exception>
+#include "timer_wheel.h"
+#include "logger.h"
+#ifdef ANT_UNIT_TESTS
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Timer_wheel, expire)
+{
+    using std::chrono::milliseconds;
+    Timer_wheel wheel;
+    Timer_wheel::clock::time_point t0 = Timer_wheel::clock::now();
+    std::vector<int> fired;
+
+    EXPECT_EQ(wheel.next_timeout(t0, 1000), 1000);
+
+    wheel.add(1, t0 + milliseconds(30), milliseconds(0), [&fired]() { fired.push_back(1); });
+    wheel.add(2, t0 + milliseconds(10), milliseconds(0), [&fired]() { fired.push_back(2); });
+    // beyond one revolution of the wheel
+    wheel.add(3, t0 + milliseconds(Timer_wheel::ESlots * Timer_wheel::EResolutionMs + 100), milliseconds(0),
+        [&fired]() { fired.push_back(3); });
+    wheel.add(4, t0 + milliseconds(20), milliseconds(0), [&fired]() { fired.push_back(4); });
+    EXPECT_EQ(wheel.size(), 4u);
+
+    int timeout = wheel.next_timeout(t0, 1000);
+    EXPECT_GE(timeout, 10);
+    EXPECT_LE(timeout, 10 + Timer_wheel::EResolutionMs);
+
+    EXPECT_TRUE(wheel.cancel(4));
+    EXPECT_FALSE(wheel.cancel(4));
+    // a cancelled timer doesn't shorten the wait
+    EXPECT_TRUE(wheel.cancel(2));
+    timeout = wheel.next_timeout(t0, 1000);
+    EXPECT_GE(timeout, 30);
+    EXPECT_LE(timeout, 30 + Timer_wheel::EResolutionMs);
+    wheel.add(2, t0 + milliseconds(10), milliseconds(0), [&fired]() { fired.push_back(2); });
+
+    EXPECT_EQ(wheel.expire(t0 + milliseconds(5)), 0u);
+    EXPECT_EQ(wheel.expire(t0 + milliseconds(50)), 2u);
+    ASSERT_EQ(fired.size(), 2u);
+    EXPECT_EQ(fired[0], 2);
+    EXPECT_EQ(fired[1], 1);
+
+    // the far timer stays until its round comes
+    EXPECT_EQ(wheel.expire(t0 + milliseconds(Timer_wheel::ESlots * Timer_wheel::EResolutionMs)), 0u);
+    EXPECT_EQ(wheel.expire(t0 + milliseconds(Timer_wheel::ESlots * Timer_wheel::EResolutionMs + 100)), 1u);
+    EXPECT_EQ(fired.back(), 3);
+    EXPECT_EQ(wheel.size(), 0u);
+
+    // periodic timer cancelling itself on the third run
+    fired.clear();
+    Timer_wheel::clock::time_point t1 = t0 + milliseconds(10000);
+    wheel.add(5, t1 + milliseconds(100), milliseconds(100), [&fired, &wheel]() {
+        fired.push_back(5);
+        if (fired.size() == 3)
+            wheel.cancel(5);
+    });
+    for (int i = 1; i <= 5; ++i)
+        wheel.expire(t1 + milliseconds(100 * i));
+    EXPECT_EQ(fired.size(), 3u);
+    EXPECT_EQ(wheel.size(), 0u);
+
+    // the nearest bucket lies past the end of the wheel
+    Timer_wheel::clock::time_point t2 = t1 + milliseconds(500);
+    wheel.add(6, t2 + milliseconds(2000), milliseconds(0), []() {});
+    timeout = wheel.next_timeout(t2, 3000);
+    EXPECT_GE(timeout, 2000);
+    EXPECT_LE(timeout, 2000 + Timer_wheel::EResolutionMs);
+}
+
+}
+#endif
+
+ant::Timer_wheel::Timer_wheel()
+    : _origin(clock::now())
+    , _current(0)
+    , _slots(ESlots)
+{
+    std::fill(_occupied, _occupied + ESlots / 64, 0);
+}
+
+uint64_t ant::Timer_wheel::to_tick(clock::time_point t) const
+{
+    if (t <= _origin)
+        return 0;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t - _origin).count() / EResolutionMs;
+}
+
+void ant::Timer_wheel::insert(Timer_id id, Entry& entry)
+{
+    // nothing can be due in the ticks which are already processed
+    entry.tick = std::max(entry.tick, _current + 1);
+    size_t slot = entry.tick % ESlots;
+    _slots[slot].push_back(id);
+    _occupied[slot / 64] |= uint64_t(1) << (slot % 64);
+}
+
+uint64_t ant::Timer_wheel::next_occupied(uint64_t tick, uint64_t last) const
+{
+    while (tick <= last) {
+        size_t slot = tick % ESlots;
+        // the buckets of a word are consecutive ticks, the wheel wraps at a word boundary
+        uint64_t bits = _occupied[slot / 64] >> (slot % 64);
+        if (bits) {
+#if defined(__GNUC__) || defined(__clang__)
+            tick += __builtin_ctzll(bits);
+#else
+            for (; !(bits & 1); bits >>= 1)
+                ++tick;
+#endif
+            return std::min(tick, last + 1);
+        }
+        tick += 64 - slot % 64;
+    }
+    return last + 1;
+}
+
+void ant::Timer_wheel::add(Timer_id id, clock::time_point deadline, std::chrono::milliseconds period, Task f)
+{
+    // a timer never fires before its deadline, so the tick is rounded up
+    Entry entry = {to_tick(deadline + std::chrono::milliseconds(EResolutionMs - 1)), period, std::move(f)};
+    insert(id, entry);
+    _timers[id] = std::move(entry);
+}
+
+bool ant::Timer_wheel::cancel(Timer_id id)
+{
+    return _timers.erase(id) != 0;
+}
+
+void ant::Timer_wheel::clear()
+{
+    for (auto &slot: _slots)
+        slot.clear();
+    std::fill(_occupied, _occupied + ESlots / 64, 0);
+    _timers.clear();
+    _due.clear();
+}
+
+int ant::Timer_wheel::next_timeout(clock::time_point now, int max_ms) const
+{
+    int64_t now_ms = now > _origin ? std::chrono::duration_cast<std::chrono::milliseconds>(now - _origin).count() : 0;
+
+    uint64_t last = _current + ESlots;
+    for (uint64_t tick = next_occupied(_current + 1, last); tick <= last; tick = next_occupied(tick + 1, last)) {
+        int64_t timeout = (int64_t) tick * EResolutionMs - now_ms;
+        if (timeout >= max_ms)
+            break;
+        for (Timer_id id: _slots[tick % ESlots]) {
+            auto itr = _timers.find(id);
+            if (itr != _timers.end() && itr->second.tick == tick)
+                return timeout > 0 ? (int) timeout : 0;
+        }
+    }
+    return max_ms;
+}
+
+size_t ant::Timer_wheel::expire(clock::time_point now)
+{
+    uint64_t now_tick = to_tick(now);
+    if (now_tick <= _current)
+        return 0;
+
+    uint64_t span = std::min<uint64_t>(now_tick - _current, ESlots);
+    for (uint64_t i = 1; i <= span; ++i) {
+        size_t index = (_current + i) % ESlots;
+        std::vector<Timer_id> &slot = _slots[index];
+        size_t kept = 0;
+        for (Timer_id id: slot) {
+            auto itr = _timers.find(id);
+            if (itr == _timers.end())
+                continue; // cancelled
+            if (itr->second.tick <= now_tick)
+                _due.push_back(id);
+            else
+                slot[kept++] = id;
+        }
+        slot.resize(kept);
+        if (!kept)
+            _occupied[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
+    _current = now_tick;
+
+    if (_due.size() > 1) {
+        std::stable_sort(_due.begin(), _due.end(), [this](Timer_id a, Timer_id b) {
+            return _timers.at(a).tick < _timers.at(b).tick;
+        });
+    }
+
+    std::vector<Timer_id> due;
+    due.swap(_due);
+
+    size_t fired = 0;
+    for (Timer_id id: due) {
+        auto itr = _timers.find(id);
+        if (itr == _timers.end())
+            continue; // cancelled by a previous timer
+
+        // the task is moved out, so the timer can cancel itself
+        Task f = std::move(itr->second.f);
+        std::chrono::milliseconds period = itr->second.period;
+        if (!period.count())
+            _timers.erase(itr);
+
+        ++fired;
+        try {
+            f();
+        } catch (std::exception const &e) {
+            LOG(Log::EError, Log::ENet, "catch exception into timer call: %s\n", e.what());
+        }
+
+        if (period.count()) {
+            itr = _timers.find(id);
+            if (itr == _timers.end())
+                continue;
+            uint64_t period_ticks = std::max<uint64_t>(1, (period.count() + EResolutionMs - 1) / EResolutionMs);
+            itr->second.f = std::move(f);
+            itr->second.tick += period_ticks;
+            // skip runs missed by a stalled loop
+            if (itr->second.tick <= _current)
+                itr->second.tick = _current + period_ticks;
+            insert(id, itr->second);
+        }
+    }
+
+    due.clear();
+    if (_due.empty())
+        _due.swap(due); // keep the capacity
+    return fired;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "task.h"
+
+namespace ant {
+
+    typedef uint64_t Timer_id;
+
+    // Hashed timer wheel: ESlots buckets of EResolutionMs each, deadlines beyond one revolution
+    // stay in their bucket until their round comes. Adding and cancelling are O(1), cancelled
+    // timers are dropped lazily when their bucket is visited. A bitmap of the non-empty buckets
+    // lets next_timeout() skip the empty ones a word at a time.
+    // Not thread safe: all calls must come from the loop thread.
+    class Timer_wheel
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        enum {
+            ESlots = 512,       // a multiple of 64
+            EResolutionMs = 4
+        };
+
+        Timer_wheel();
+
+        // id must be unique and non zero, period 0 means a one-shot timer
+        void add(Timer_id id, clock::time_point deadline, std::chrono::milliseconds period, Task f);
+        // return false if the timer has already fired or was cancelled
+        bool cancel(Timer_id id);
+        void clear();
+        size_t size() const {
+            return _timers.size();
+        }
+
+        // milliseconds until the nearest deadline, max_ms if nothing is due within max_ms
+        int next_timeout(clock::time_point now, int max_ms) const;
+        // runs timers due by now, timers can add or cancel timers
+        // return the number of fired timers
+        size_t expire(clock::time_point now);
+
+    private:
+        struct Entry {
+            uint64_t tick;
+            std::chrono::milliseconds period;
+            Task f;
+        };
+
+        uint64_t to_tick(clock::time_point t) const;
+        void insert(Timer_id id, Entry& entry);
+        // the first tick from tick to last whose bucket isn't empty, last + 1 if there is none
+        uint64_t next_occupied(uint64_t tick, uint64_t last) const;
+
+        clock::time_point _origin;
+        // all ticks up to _current are processed
+        uint64_t _current;
+        std::vector<std::vector<Timer_id>> _slots;
+        uint64_t _occupied[ESlots / 64];    // a bit per non-empty bucket
+        std::unordered_map<Timer_id, Entry> _timers;
+        std::vector<Timer_id> _due;
+    };
+
+}
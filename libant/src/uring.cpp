@@ -0,0 +1,294 @@
+#include "uring.h"
+
+#ifdef ANT_HAVE_IO_URING
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "logger.h"
+#ifdef ANT_UNIT_TESTS
+# include <chrono>
+# include <gtest/gtest.h>
+#endif
+
+#ifdef ANT_UNIT_TESTS
+namespace ant {
+
+TEST(Uring, enter)
+{
+    Uring ring;
+    if (ring.open(8) != 0)
+        return; // io_uring is disabled on this host
+
+    for (int i = 0; i < 8; ++i) {
+        io_uring_sqe *sqe = ring.get_sqe();
+        ASSERT_NE(sqe, nullptr);
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = i + 1;
+    }
+    EXPECT_EQ(ring.get_sqe(), nullptr);
+
+    std::vector<io_uring_cqe> cqes;
+    while (cqes.size() < 8) {
+        ASSERT_EQ(ring.enter(100), 0);
+        ring.reap(cqes);
+    }
+    for (int i = 0; i < 8; ++i)
+        EXPECT_EQ(cqes[i].user_data, (uint64_t) i + 1);
+
+    // nothing is queued, the wait ends by the timeout
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(ring.enter(20), 0);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(15));
+    cqes.clear();
+    EXPECT_EQ(ring.reap(cqes), 0u);
+
+    ASSERT_EQ(ring.add_buf_ring(1, 4, 256), 0);
+    EXPECT_TRUE(ring.has_buf_ring(1));
+    EXPECT_NE(ring.buffer(1, 3), nullptr);
+    EXPECT_EQ(ring.buffer(1, 4), nullptr);
+    ring.remove_buf_ring(1);
+    EXPECT_FALSE(ring.has_buf_ring(1));
+}
+
+}
+#endif
+
+namespace {
+    int io_uring_setup(unsigned entries, io_uring_params *p)
+    {
+        return (int) syscall(__NR_io_uring_setup, entries, p);
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+    {
+        return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+    }
+
+    int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+    {
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+}
+
+ant::Uring::Uring()
+    : _fd(-1)
+    , _sq_ptr(MAP_FAILED)
+    , _sq_bytes(0)
+    , _sqes((io_uring_sqe *) MAP_FAILED)
+    , _sqes_bytes(0)
+    , _enters(0)
+{
+}
+
+ant::Uring::~Uring()
+{
+    close();
+}
+
+int ant::Uring::open(unsigned entries)
+{
+    if (_fd >= 0)
+        return 0;
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // completions are run on the next io_uring_enter() of the loop instead of interrupting it
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    // multishot requests post bursts of completions
+    params.cq_entries = entries * 4;
+    _fd = io_uring_setup(entries, &params);
+    if (_fd < 0 && errno == EINVAL) {
+        // kernels before 6.1
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        _fd = io_uring_setup(entries, &params);
+    }
+    if (_fd < 0) {
+        int error = errno;
+        LOG(Log::EInfo, Log::ENet, "syscall io_uring_setup failed: %s(%d)\n", strerror(errno), errno)
+        return error;
+    }
+
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        LOG(Log::EInfo, Log::ENet, "io_uring features 0x%x are too old\n", params.features)
+        close();
+        return EOPNOTSUPP;
+    }
+
+    // one mapping holds both rings (IORING_FEAT_SINGLE_MMAP)
+    _sq_bytes = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    _sq_ptr = mmap(nullptr, _sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    _sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe *) mmap(nullptr, _sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+        IORING_OFF_SQES);
+    if (_sq_ptr == MAP_FAILED || _sqes == MAP_FAILED) {
+        int error = errno;
+        LOG(Log::EError, Log::ENet, "syscall mmap of io_uring failed: %s(%d)\n", strerror(errno), errno)
+        close();
+        return error;
+    }
+    uint8_t *sq = (uint8_t *) _sq_ptr;
+    _sq_head = (unsigned *) (sq + params.sq_off.head);
+    _sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    _sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    _sq_entries = *(unsigned *) (sq + params.sq_off.ring_entries);
+    // submission entries are used in ring order
+    unsigned *array = (unsigned *) (sq + params.sq_off.array);
+    for (unsigned i = 0; i < _sq_entries; ++i)
+        array[i] = i;
+    _sq_local_tail = *_sq_tail;
+    _sq_submitted = _sq_local_tail;
+
+    uint8_t *cq = (uint8_t *) _sq_ptr;
+    _cq_head = (unsigned *) (cq + params.cq_off.head);
+    _cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    _cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+void ant::Uring::close()
+{
+    if (_fd >= 0) {
+        for (auto &item: _buf_rings)
+            munmap(item.second.ring, item.second.ring_bytes);
+        _buf_rings.clear();
+    }
+    if (_sqes != MAP_FAILED)
+        munmap(_sqes, _sqes_bytes);
+    _sqes = (io_uring_sqe *) MAP_FAILED;
+    if (_sq_ptr != MAP_FAILED)
+        munmap(_sq_ptr, _sq_bytes);
+    _sq_ptr = MAP_FAILED;
+    if (_fd >= 0)
+        ::close(_fd);
+    _fd = -1;
+}
+
+io_uring_sqe* ant::Uring::get_sqe()
+{
+    unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (_sq_local_tail - head >= _sq_entries)
+        return nullptr;
+    io_uring_sqe *sqe = &_sqes[_sq_local_tail & _sq_mask];
+    ++_sq_local_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int ant::Uring::enter(int timeout_ms)
+{
+    unsigned to_submit = _sq_local_tail - _sq_submitted;
+    if (to_submit)
+        __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+
+    // completions are already waiting
+    bool ready = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+    unsigned wait_nr = timeout_ms != 0 && !ready ? 1 : 0;
+
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = timeout_ms > 0 ? (uint64_t) (uintptr_t) &ts : 0;
+
+    ++_enters;
+    // GETEVENTS also runs the deferred completion work
+    int rc = io_uring_enter(_fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+        sizeof(arg));
+    if (rc >= 0) {
+        _sq_submitted += rc;
+        // entries rejected at submission are reported by completions, the rest is retried next time
+        return 0;
+    }
+    if (errno == ETIME || errno == EBUSY)
+        return 0;
+    return -1;
+}
+
+size_t ant::Uring::reap(std::vector<io_uring_cqe>& cqes)
+{
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    for (unsigned i = head; i != tail; ++i)
+        cqes.push_back(_cqes[i & _cq_mask]);
+    __atomic_store_n(_cq_head, tail, __ATOMIC_RELEASE);
+    return tail - head;
+}
+
+int ant::Uring::add_buf_ring(uint16_t gid, unsigned count, size_t size)
+{
+    if (!count || (count & (count - 1)) || count > 32768 || has_buf_ring(gid))
+        return EINVAL;
+
+    Buf_ring buf;
+    buf.ring_bytes = count * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, buf.ring_bytes, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED)
+        return errno;
+    buf.ring = (io_uring_buf *) ring;
+    buf.mask = count - 1;
+    buf.tail = 0;
+    buf.size = size;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring;
+    reg.ring_entries = count;
+    reg.bgid = gid;
+    if (io_uring_register(_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        int error = errno;
+        LOG(Log::EInfo, Log::ENet, "io_uring buffer ring registration failed: %s(%d)\n", strerror(errno), errno)
+        munmap(ring, buf.ring_bytes);
+        return error;
+    }
+
+    Buf_ring &added = _buf_rings[gid] = std::move(buf);
+    added.buffers.resize(count * size);
+    for (unsigned bid = 0; bid < count; ++bid)
+        recycle(gid, bid);
+    return 0;
+}
+
+void ant::Uring::remove_buf_ring(uint16_t gid)
+{
+    auto itr = _buf_rings.find(gid);
+    if (itr == _buf_rings.end())
+        return;
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = gid;
+    if (io_uring_register(_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1) != 0)
+        LOG(Log::EWarning, Log::ENet, "io_uring buffer ring removal failed: %s(%d)\n", strerror(errno), errno)
+    munmap(itr->second.ring, itr->second.ring_bytes);
+    _buf_rings.erase(itr);
+}
+
+uint8_t* ant::Uring::buffer(uint16_t gid, uint16_t bid)
+{
+    auto itr = _buf_rings.find(gid);
+    if (itr == _buf_rings.end() || bid > itr->second.mask)
+        return nullptr;
+    return itr->second.buffers.data() + bid * itr->second.size;
+}
+
+void ant::Uring::recycle(uint16_t gid, uint16_t bid)
+{
+    auto itr = _buf_rings.find(gid);
+    if (itr == _buf_rings.end() || bid > itr->second.mask)
+        return;
+    Buf_ring &buf = itr->second;
+    io_uring_buf &entry = buf.ring[buf.tail & buf.mask];
+    entry.addr = (uint64_t) (uintptr_t) (buf.buffers.data() + bid * buf.size);
+    entry.len = buf.size;
+    entry.bid = bid;
+    __atomic_store_n(&buf.ring[0].resv, ++buf.tail, __ATOMIC_RELEASE);
+}
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+#if defined(__linux__) && defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#        include <linux/io_uring.h>
+#        include <sys/syscall.h>
+#    endif
+#endif
+// multishot receive and provided buffer rings need the kernel 6.0 headers
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#    define ANT_HAVE_IO_URING 1
+#endif
+
+#ifdef ANT_HAVE_IO_URING
+namespace ant {
+
+    // io_uring over raw syscalls: a submission and a completion ring mapped by open(), plus rings of
+    // provided buffers which multishot receives fill without a request per datagram.
+    // Single issuer: all calls must come from one thread.
+    class Uring
+    {
+    public:
+        Uring();
+        ~Uring();
+
+        Uring(Uring const&) = delete;
+        Uring& operator=(Uring const&) = delete;
+
+        // return 0 if success or system error code (ENOSYS or EPERM if io_uring is disabled)
+        int open(unsigned entries);
+        void close();
+        bool is_open() const {
+            return _fd >= 0;
+        }
+
+        // return a zeroed entry or nullptr if the submission ring is full
+        io_uring_sqe* get_sqe();
+        // submits the queued entries and waits up to timeout_ms (-1 infinite, 0 no wait) for a completion
+        // return 0 if success or -1 (errno is set), a timeout isn't an error
+        int enter(int timeout_ms);
+        // appends the completions and consumes them
+        size_t reap(std::vector<io_uring_cqe>& cqes);
+        // io_uring_enter() calls
+        uint64_t enters() const {
+            return _enters;
+        }
+
+        // registers a group of count (power of two) buffers of size bytes
+        // return 0 if success or system error code
+        int add_buf_ring(uint16_t gid, unsigned count, size_t size);
+        void remove_buf_ring(uint16_t gid);
+        bool has_buf_ring(uint16_t gid) const {
+            return _buf_rings.count(gid) != 0;
+        }
+        uint8_t* buffer(uint16_t gid, uint16_t bid);
+        // gives the buffer back to the kernel
+        void recycle(uint16_t gid, uint16_t bid);
+
+    private:
+        struct Buf_ring {
+            // io_uring_buf_ring, whose flexible array gets a wrong offset in C++,
+            // the tail overlays the resv field of the first entry
+            io_uring_buf *ring;
+            size_t ring_bytes;
+            unsigned mask;
+            uint16_t tail;
+            size_t size;
+            std::vector<uint8_t> buffers;
+        };
+
+        int _fd;
+        void *_sq_ptr;
+        size_t _sq_bytes;
+        io_uring_sqe *_sqes;
+        size_t _sqes_bytes;
+
+        unsigned *_sq_head;
+        unsigned *_sq_tail;
+        unsigned _sq_mask;
+        unsigned _sq_entries;
+        unsigned _sq_local_tail;
+        unsigned _sq_submitted;
+
+        unsigned *_cq_head;
+        unsigned *_cq_tail;
+        unsigned _cq_mask;
+        io_uring_cqe *_cqes;
+
+        uint64_t _enters;
+        std::map<uint16_t, Buf_ring> _buf_rings;
+    };
+
+}
+#endif
@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include <thread>
+#include <future>
 #include <getopt.h>
 #include <memory>
 #include <random>
@@ -33,6 +34,8 @@
 #include "network.h"
 #include "libsrt.h"
 #include "bencode.h"
+#include "thread_util.h"
+#include "metrics.h"
 
 const int DEFAULT_PORT = 3010;
 
@@ -42,6 +45,7 @@ static bool o_echo = false;
 static uint16_t o_local_ant_port = DEFAULT_PORT;
 static uint16_t o_local_srt_port = DEFAULT_PORT+1;
 static bool o_rendezvous_mode = false;
+static bool o_demux = false;
 static std::list<std::string> o_remote_address;
 static int o_bufsize = SRT_LIVE_DEF_PLSIZE;
 static int o_hwm = -1;
@@ -49,6 +53,10 @@ static int o_lwm = -1;
 static int o_send_timeout_ms = 1000;
 static int o_inter_timeout_ms = 1;
 static int o_timeout = 60;
+static int o_metrics_port = 0;
+static std::string o_statsd;
+static std::string o_record_file;
+static bool o_async_log = false;
 
 
 static void usage(char *name)
@@ -67,6 +75,7 @@ static void usage(char *name)
     fprintf(stderr, "    -l              Listen mode\n");
     fprintf(stderr, "    -r              Rendezvous mode (local and remote ports must be equals!)\n");
     fprintf(stderr, "    -s <port>       Local port\n");
+    fprintf(stderr, "    -d              Single port: SRT shares the local port, remotes are given by their local port\n");
     fprintf(stderr, "    -e              Echo mode for server only, to send all receive data back to the client\n");
     fprintf(stderr, "    -b <bufsize>    Buffer size to send, by default %d bytes\n", o_bufsize);
     fprintf(stderr, "    -t <msec>       Period in milliseconds to send buffer, by default %d ms\n", o_send_timeout_ms);
@@ -74,6 +83,10 @@ static void usage(char *name)
     fprintf(stderr, "    -T <sec>        Common timeout, by default 60\n");
     fprintf(stderr, "    -H <hwm>        High Water Mark in bytes\n");
     fprintf(stderr, "    -L <lwm>        Low Water Mark in bytes\n");
+    fprintf(stderr, "    -P <port>       Serve Prometheus metrics on http://localhost:<port>/metrics\n");
+    fprintf(stderr, "    -D <host:port>  Push metrics to a StatsD daemon every 10 sec\n");
+    fprintf(stderr, "    -R <file>       Record connection stats every 100 ms, see stat_reader\n");
+    fprintf(stderr, "    -A              Asynchronous logging, for -vvv without slowing the transfer down\n");
     fprintf(stderr, "\n");
     exit(1);
 }
@@ -227,6 +240,9 @@ struct Peer {
     Moving_average<unsigned> recv_stat;
     Moving_average<unsigned> send_stat;
 
+    ant::Latency_histogram _cur_rtt;    // of DATA requests, 5 sec interval
+    ant::Latency_histogram _sum_rtt;
+
     bool _congestion;
 };
 
@@ -258,6 +274,16 @@ public:
         delete _srt;
     }
 
+    void collect_metrics(ant::Metrics_sink& sink)
+    {
+        _srt->collect_metrics(sink);
+    }
+
+    void set_recorder(std::shared_ptr<ant::Stat_recorder> const& recorder)
+    {
+        _srt->set_recorder(recorder);
+    }
+
     void start(sockaddr_storage const& bind_addr, int port, std::list<std::string> const& remote_address, ant::Srt_connecting_cb const& addr_cb)
     {
         sockaddr_storage bind_interface = bind_addr;
@@ -453,6 +479,8 @@ public:
                 LOG(ant::Log::EInfo, ant::Log::EAnt,
                     "PACKET TRIP seq: %d rtt: %f sec\n", in_cmd_id, rtt);
                 assert(rtt < 2.0);
+                if (rtt >= 0)
+                    peer->_cur_rtt.record((uint64_t) diff_sec * 1000000 + diff_usec);
 
             }
         }
@@ -519,6 +547,7 @@ private:
 
     void thread_proc()
     {
+        ant::set_thread_name("srt-test");
         // prepare sending buffer
         std::vector<uint8_t> buffer(o_bufsize);
         unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
@@ -618,9 +647,38 @@ protected:
                 last_stat.pktSent, last_stat.byteSent, last_stat.mbpsSendRate, last_stat.pktRetrans, pktUnackedSent,
                 last_stat.pktRecv, last_stat.byteRecv, last_stat.mbpsRecvRate, last_stat.pktRcvLoss,
                 last_stat.msRTT, last_stat.mbpsBandwidth)
+
+            if (last_stat.pktSndDrop || last_stat.pktRcvDrop) {
+                LOG(ant::Log::EInfo, ant::Log::EAnt,
+                    "connection(%d): dropped by SRT buffers: send %d pkt, recv %d pkt\n",
+                    itr.first, last_stat.pktSndDrop, last_stat.pktRcvDrop)
+            }
+
+            show_latency(itr.first, "app rtt", peer->_cur_rtt);
+            peer->_sum_rtt.merge(peer->_cur_rtt);
+            peer->_cur_rtt.clear();
+
+            ant::Latency_histogram histogram;
+            if (_srt->latency(itr.first, ant::Srt::ESrtRtt, histogram, true))
+                show_latency(itr.first, "srt rtt", histogram);
+            if (_srt->latency(itr.first, ant::Srt::ESendSojourn, histogram, true))
+                show_latency(itr.first, "send queue", histogram);
+            if (_srt->latency(itr.first, ant::Srt::EDeliveryLatency, histogram, true))
+                show_latency(itr.first, "delivery latency", histogram);
         }
     }
 
+    void show_latency(ant::Srt_connection_id conn_id, const char *name, ant::Latency_histogram const& histogram)
+    {
+        if (!histogram.count())
+            return;
+        LOG(ant::Log::EInfo, ant::Log::EAnt,
+            "connection(%d): %s: %llu samples, min %llu us, p50 %llu us, p99 %llu us, p99.9 %llu us, max %llu us\n",
+            conn_id, name, (unsigned long long) histogram.count(), (unsigned long long) histogram.min(),
+            (unsigned long long) histogram.percentile(50), (unsigned long long) histogram.percentile(99),
+            (unsigned long long) histogram.percentile(99.9), (unsigned long long) histogram.max())
+    }
+
     void show_30_sec_statistics()
     {
         for (auto itr: _peers) {
@@ -643,6 +701,11 @@ protected:
                 }
                 printf("\n");
             }
+            if (peer->_sum_rtt.count()) {
+                printf("srt_test: connection(%d): app rtt: p50 %.1f ms, p99 %.1f ms, p99.9 %.1f ms, max %.1f ms\n",
+                    itr.first, peer->_sum_rtt.percentile(50) / 1000.0, peer->_sum_rtt.percentile(99) / 1000.0,
+                    peer->_sum_rtt.percentile(99.9) / 1000.0, peer->_sum_rtt.max() / 1000.0);
+            }
         }
     }
 };
@@ -652,7 +715,7 @@ protected:
 int main(int argc, char* argv[])
 {
 	while(true) {
-		char c = getopt(argc, argv, "hvlrecxs:b:t:i:T:H:L:");
+		char c = getopt(argc, argv, "hvlrecdxAs:b:t:i:T:H:L:P:D:R:");
 		if (c == -1) break;
 		switch(c) {
 			case 'h':
@@ -669,6 +732,9 @@ int main(int argc, char* argv[])
                 break;
             case 'r':
                 o_rendezvous_mode = true;
+                break;
+            case 'd':
+                o_demux = true;
                 break;
 			case 's':
 				if (optarg)
@@ -696,6 +762,18 @@ int main(int argc, char* argv[])
                 break;
             case 'L':
                 o_lwm = std::stoi(optarg);
+                break;
+            case 'P':
+                o_metrics_port = std::stoi(optarg);
+                break;
+            case 'D':
+                o_statsd = optarg;
+                break;
+            case 'R':
+                o_record_file = optarg;
+                break;
+            case 'A':
+                o_async_log = true;
                 break;
 			default:
 				throw std::runtime_error("Unhandled argument\n");
@@ -706,6 +784,8 @@ int main(int argc, char* argv[])
 		o_remote_address.push_back(argv[i]);
 
     ant::Log::set(log);
+    if (o_async_log)
+        ant::Log::set_async(true);
     switch (o_debug) {
         case 0:
             ant::Log::enable_log_name(ant::Log::ESrt, ant::Log::EError);
@@ -741,19 +821,34 @@ int main(int argc, char* argv[])
     LOG(ant::Log::EInfo, ant::Log::EAnt, "Starting...\n");
 
 	ant::Network::ptr net(new ant::Network(0));
+	if (o_demux) {
+		net->set_srt_demux(true);
+		o_local_srt_port = 0;
+	}
 
-    // choose appropriate interface and port
+    // the network listens on all interfaces, the loop looks up the one for SRT meanwhile
     sockaddr_storage bind_interface;
-    ant::Network::find_interface("router.bittorrent.com", 6881, bind_interface);
+    memset(&bind_interface, 0, sizeof(bind_interface));
+    bind_interface.ss_family = AF_INET;
     ant::set_port(bind_interface, o_local_ant_port);
-    LOG(ant::Log::EDebug, ant::Log::ENet, "appropriate local interface is %s, network port %d, srt port\n",
-        ant::sockaddr_storage_to_host_name(bind_interface).c_str(), o_local_ant_port, o_local_srt_port);
-
     if (net->start(bind_interface)) {
         std::cerr << "Network can't start" << std::endl;
         exit(1);
     }
 
+    // choose appropriate interface, a name which can't be resolved doesn't hold the start up
+    std::shared_ptr<std::promise<sockaddr_storage>> found = std::make_shared<std::promise<sockaddr_storage>>();
+    net->find_interface_async("router.bittorrent.com", 6881, [found](int error, sockaddr_storage const& local_addr) {
+        if (!error)
+            found->set_value(local_addr);
+    });
+    std::future<sockaddr_storage> srt_interface = found->get_future();
+    sockaddr_storage srt_addr = net->getbindaddr();
+    if (srt_interface.wait_for(std::chrono::seconds(5)) == std::future_status::ready)
+        srt_addr = srt_interface.get();
+    LOG(ant::Log::EDebug, ant::Log::ENet, "appropriate local interface is %s, network port %d, srt port %d\n",
+        ant::sockaddr_storage_to_host_name(srt_addr).c_str(), o_local_ant_port, o_local_srt_port);
+
 	std::string ip;
 	uint16_t port = DEFAULT_PORT;
 
@@ -787,15 +882,61 @@ int main(int argc, char* argv[])
 	std::this_thread::sleep_for(std::chrono::seconds(1));
 	// TODO этот старт стоит разделить, он разный для конектора и ассептора
 	// это вызывет проблемы при мультиконекте так как тогда нам нужно передать столько callback сколько конектов
-	app->start(net->getbindaddr(), o_local_srt_port, o_remote_address, connect_callback);
+	if (!o_record_file.empty()) {
+		std::shared_ptr<ant::Stat_recorder> recorder(new ant::Stat_recorder());
+		if (recorder->open(o_record_file) == 0)
+			app->set_recorder(recorder);
+		else
+			std::cerr << "Can't open " << o_record_file << std::endl;
+	}
+	app->start(srt_addr, o_local_srt_port, o_remote_address, connect_callback);
+
+	// nothing is collected unless an exporter is enabled
+	ant::Metrics_registry metrics;
+	metrics.add([&net](ant::Metrics_sink& sink) { net->collect_metrics(sink); });
+	metrics.add([app](ant::Metrics_sink& sink) { app->collect_metrics(sink); });
+	ant::Prometheus_exporter prometheus(metrics);
+	ant::Statsd_exporter statsd(metrics, "srt_test");
+	if (o_metrics_port) {
+		sockaddr_storage addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.ss_family = AF_INET;
+		SOCK_ADDR_IN_ADDR(&addr).s_addr = htonl(INADDR_LOOPBACK);
+		SOCK_ADDR_IN_PORT(&addr) = htons(o_metrics_port);
+		if (prometheus.start(addr))
+			std::cerr << "Metrics endpoint can't start" << std::endl;
+	}
+	if (!o_statsd.empty()) {
+		auto pos = o_statsd.find_last_of(':');
+		std::string host = o_statsd.substr(0, pos);
+		std::string service = pos != std::string::npos ? o_statsd.substr(pos + 1) : "8125";
+		struct addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) == 0) {
+			sockaddr_storage addr;
+			memset(&addr, 0, sizeof(addr));
+			memcpy(&addr, res->ai_addr, res->ai_addrlen);
+			freeaddrinfo(res);
+			if (statsd.start(addr))
+				std::cerr << "StatsD exporter can't start" << std::endl;
+		} else {
+			std::cerr << "Can't resolve " << o_statsd << std::endl;
+		}
+	}
 
 	for (int i = 1; i < o_timeout; ++i) {
 		std::this_thread::sleep_for(std::chrono::seconds(1));
 	}
 
 	std::cout << "Stopping..." << std::endl;
+	prometheus.stop();
+	statsd.stop();
 	app->stop();
 	delete app;
+	if (o_async_log && ant::Log::dropped())
+		std::cout << "Log messages dropped: " << ant::Log::dropped() << std::endl;
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
 }
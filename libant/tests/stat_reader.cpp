@@ -0,0 +1,100 @@
+// Offline reader of Stat_recorder files: merges the records of the files by time and prints them as CSV.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <vector>
+#include "stat_recorder.h"
+
+static void usage(char *name)
+{
+    fprintf(stderr, "\nUsage:\n");
+    fprintf(stderr, "    %s [options] <file>...\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -h              Help\n");
+    fprintf(stderr, "    -c <conn_id>    Records of the connection only\n");
+    fprintf(stderr, "    -f <time_us>    Records from the time (microseconds since the epoch)\n");
+    fprintf(stderr, "    -t <time_us>    Records up to the time\n");
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+struct Stream {
+    const char *path;
+    std::vector<ant::Stat_record> records;
+    size_t pos;
+};
+
+int main(int argc, char *argv[])
+{
+    bool by_conn = false;
+    int32_t conn_id = 0;
+    uint64_t from_us = 0;
+    uint64_t to_us = UINT64_MAX;
+    int c;
+    while ((c = getopt(argc, argv, "hc:f:t:")) != -1) {
+        switch (c) {
+            case 'c':
+                by_conn = true;
+                conn_id = std::stoi(optarg);
+                break;
+            case 'f':
+                from_us = std::stoull(optarg);
+                break;
+            case 't':
+                to_us = std::stoull(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+
+    std::vector<Stream> streams;
+    for (int i = optind; i < argc; ++i) {
+        Stream stream = {argv[i], std::vector<ant::Stat_record>(), 0};
+        int rc = ant::Stat_recorder::read(argv[i], stream.records);
+        if (rc) {
+            fprintf(stderr, "%s: %s\n", argv[i], rc == EINVAL ? "not a stat record file" : strerror(rc));
+            return 1;
+        }
+        // writers of several threads can interleave a little
+        std::stable_sort(stream.records.begin(), stream.records.end(),
+            [](ant::Stat_record const& a, ant::Stat_record const& b) { return a.time_us < b.time_us; });
+        streams.push_back(std::move(stream));
+    }
+
+    // the stream with the oldest next record on top
+    auto later = [&streams](size_t a, size_t b) {
+        return streams[a].records[streams[a].pos].time_us > streams[b].records[streams[b].pos].time_us;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (!streams[i].records.empty())
+            heads.push(i);
+    }
+
+    printf("time_us,file,conn_id,buffer_bytes,sent_bytes,sending_bytes,rtt_us,loss_pkts,retrans_pkts,"
+           "bandwidth_kbps\n");
+    while (!heads.empty()) {
+        size_t i = heads.top();
+        heads.pop();
+        Stream &stream = streams[i];
+        ant::Stat_record const& r = stream.records[stream.pos++];
+        if (stream.pos < stream.records.size())
+            heads.push(i);
+        if (r.time_us < from_us || r.time_us > to_us || (by_conn && r.conn_id != conn_id))
+            continue;
+        printf("%llu,%s,%d,%u,%llu,%llu,%u,%u,%u,%u\n", (unsigned long long) r.time_us, stream.path, r.conn_id,
+               r.buffer_bytes, (unsigned long long) r.sent_bytes, (unsigned long long) r.sending_bytes, r.rtt_us,
+               r.loss_pkts, r.retrans_pkts, r.bandwidth_kbps);
+    }
+    return 0;
+}